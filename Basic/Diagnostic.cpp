@@ -78,14 +78,15 @@ static const StaticDiagInfoRec *GetDiagInfo(unsigned short DiagID) {
   unsigned NumDiagEntries = sizeof(StaticDiagInfo)/sizeof(StaticDiagInfo[0])-1;
 
   // If assertions are enabled, verify that the StaticDiagInfo array is sorted.
+  // This runs once even when diagnostics are emitted on several threads.
 #ifndef NDEBUG
-  static bool IsFirst = true;
-  if (IsFirst) {
+  static bool IsSorted = [NumDiagEntries] {
     for (unsigned i = 1; i != NumDiagEntries; ++i)
       assert(StaticDiagInfo[i-1] < StaticDiagInfo[i] &&
              "Improperly sorted diag info");
-    IsFirst = false;
-  }
+    return true;
+  }();
+  (void) IsSorted;
 #endif
   
   // Search the diagnostic table with a binary search.
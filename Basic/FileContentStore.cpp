@@ -0,0 +1,60 @@
+/***********************************
+* File:     FileContentStore.cpp
+*
+* Author:   agent
+*
+* Email:    agent@local
+*
+* Date:     2026/10/16
+***********************************/
+
+#include "FileContentStore.h"
+#include "FileManager.h"
+#include "SourceManager.h"
+#include "llvm/MemoryBuffer.h"
+
+using namespace CPToyC::Compiler;
+
+FileContentStore::~FileContentStore() {
+    for (unsigned i = 0; i != NumShards; ++i)
+        for (llvm::DenseMap<const FileEntry*, Contents>::iterator
+                     I = Shards[i].Files.begin(), E = Shards[i].Files.end();
+             I != E; ++I) {
+            delete I->second.Buffer;
+            delete I->second.Directives;
+        }
+}
+
+const MemoryBuffer *FileContentStore::getBuffer(const FileEntry *FE) {
+    Shard &S = Shards[FE->getUID() % NumShards];
+    std::lock_guard<std::mutex> Guard(S.Lock);
+
+    Contents &C = S.Files[FE];
+    // A file that could not be read is tried again on the next request, as
+    // ContentCache does.
+    if (!C.Buffer)
+        C.Buffer = MemoryBuffer::getFile(FE->getName(), 0, FE->getSize());
+    return C.Buffer;
+}
+
+const DirectiveIndex *FileContentStore::getDirectiveIndex(const FileEntry *FE) {
+    Shard &S = Shards[FE->getUID() % NumShards];
+    std::lock_guard<std::mutex> Guard(S.Lock);
+
+    llvm::DenseMap<const FileEntry*, Contents>::iterator I = S.Files.find(FE);
+    return I != S.Files.end() ? I->second.Directives : 0;
+}
+
+const DirectiveIndex *FileContentStore::addDirectiveIndex(const FileEntry *FE,
+                                                          const DirectiveIndex *DI) {
+    Shard &S = Shards[FE->getUID() % NumShards];
+    std::lock_guard<std::mutex> Guard(S.Lock);
+
+    // The index is built outside the lock, so two threads may race to add one.
+    Contents &C = S.Files[FE];
+    if (C.Directives)
+        delete DI;
+    else
+        C.Directives = DI;
+    return C.Directives;
+}
@@ -0,0 +1,72 @@
+/***********************************
+* File:     FileContentStore.h
+*
+* Author:   agent
+*
+* Email:    agent@local
+*
+* Date:     2026/10/16
+***********************************/
+
+#ifndef CPTOYC_FILECONTENTSTORE_H
+#define CPTOYC_FILECONTENTSTORE_H
+
+#include "llvm/DenseMap.h"
+#include <mutex>
+
+namespace CPToyC {
+    namespace Compiler {
+        class FileEntry;
+        class MemoryBuffer;
+        struct DirectiveIndex;
+
+        /// FileContentStore - The contents of the files loaded so far, shared by
+        /// the SourceManagers of translation units preprocessed on several threads.
+        /// A file is loaded once, the first time any of them asks for it, and its
+        /// buffer is never changed or freed before the store goes away, so readers
+        /// need no locking once they hold it.
+        ///
+        /// The DirectiveIndex of a file is kept here too, so that a header shared
+        /// by the translation units is only prescanned once per process.
+        ///
+        /// Files are spread over shards by their FileEntry UID; a thread loading a
+        /// file only blocks threads asking for files of the same shard.
+        class FileContentStore {
+            struct Contents {
+                const MemoryBuffer *Buffer;
+                const DirectiveIndex *Directives;
+            };
+
+            struct Shard {
+                std::mutex Lock;
+                llvm::DenseMap<const FileEntry*, Contents> Files;
+            };
+
+            enum { NumShards = 16 };
+            Shard Shards[NumShards];
+
+            FileContentStore(const FileContentStore&); // DO NOT IMPLEMENT
+            void operator=(const FileContentStore&);   // DO NOT IMPLEMENT
+        public:
+            FileContentStore() {}
+            ~FileContentStore();
+
+            /// getBuffer - Return the contents of the specified file, loading it if
+            /// this is the first request for it.  Returns null if the file can't be
+            /// read.  The store keeps ownership of the buffer.
+            const MemoryBuffer *getBuffer(const FileEntry *FE);
+
+            /// getDirectiveIndex - Return the DirectiveIndex of the buffer of the
+            /// specified file, or null if none has been added yet.
+            const DirectiveIndex *getDirectiveIndex(const FileEntry *FE);
+
+            /// addDirectiveIndex - Keep the DirectiveIndex built for the buffer of
+            /// the specified file, taking ownership of it.  If another thread added
+            /// one first, DI is deleted and that one is returned instead.
+            const DirectiveIndex *addDirectiveIndex(const FileEntry *FE,
+                                                    const DirectiveIndex *DI);
+        };
+    }
+}
+
+#endif //CPTOYC_FILECONTENTSTORE_H
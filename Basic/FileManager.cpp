@@ -10,7 +10,10 @@
 
 #include "FileManager.h"
 #include "llvm/SmallString.h"
+#include <dirent.h>
+#include <stdlib.h>
 #include <iostream>
+#include <string.h>
 
 using namespace CPToyC::Compiler;
 
@@ -34,59 +37,208 @@ using namespace CPToyC::Compiler;
 // Common logic.
 //===----------------------------------------------------------------------===//
 
+/// InodeMap - An open addressed hash table from a (device, inode) pair to an
+/// entry.  The entries are allocated from a bump allocator and never move, so
+/// the FileManager can hand out pointers to them; only the buckets are
+/// reallocated when the table grows.
+template<typename EntryTy>
+class InodeMap {
+    struct Bucket {
+        dev_t Device;
+        ino_t Inode;
+        EntryTy *Entry;     // Null if the bucket is empty.
+    };
+
+    Bucket *Buckets;
+    unsigned NumBuckets;    // Always a power of two.
+    unsigned NumItems;
+    llvm::BumpPtrAllocator Allocator;
+
+    // Statistics.
+    unsigned NumLookups, NumProbes, MaxProbes;
+
+    /// getHash - Inodes are often allocated sequentially, so mix the key with
+    /// a multiplicative hash and keep the high bits, which depend on all of it.
+    static unsigned getHash(dev_t Device, ino_t Inode) {
+        uint64_t Key = ((uint64_t) Inode ^ ((uint64_t) Device << 40)) *
+                       0x9E3779B97F4A7C15ULL;
+        return (unsigned) (Key >> 32);
+    }
+
+    /// LookupBucket - Return the bucket holding the key, or the empty bucket
+    /// it would be inserted in.
+    Bucket &LookupBucket(dev_t Device, ino_t Inode) {
+        ++NumLookups;
+        unsigned Probes = 1;
+        unsigned Mask = NumBuckets - 1;
+        for (unsigned i = getHash(Device, Inode) & Mask; ;
+             i = (i + 1) & Mask, ++Probes) {
+            Bucket &B = Buckets[i];
+            if (!B.Entry || (B.Device == Device && B.Inode == Inode)) {
+                NumProbes += Probes;
+                if (Probes > MaxProbes)
+                    MaxProbes = Probes;
+                return B;
+            }
+        }
+    }
+
+    /// Grow - Double the number of buckets and rehash the entries into them.
+    void Grow() {
+        Bucket *OldBuckets = Buckets;
+        unsigned OldNumBuckets = NumBuckets;
+        NumBuckets *= 2;
+        Buckets = static_cast<Bucket*>(calloc(NumBuckets, sizeof(Bucket)));
+        unsigned Mask = NumBuckets - 1;
+        for (unsigned i = 0; i != OldNumBuckets; ++i) {
+            Bucket &Old = OldBuckets[i];
+            if (!Old.Entry)
+                continue;
+            unsigned j = getHash(Old.Device, Old.Inode) & Mask;
+            while (Buckets[j].Entry)
+                j = (j + 1) & Mask;
+            Buckets[j] = Old;
+        }
+        free(OldBuckets);
+    }
+
+    InodeMap(const InodeMap&);       // DO NOT IMPLEMENT
+    void operator=(const InodeMap&); // DO NOT IMPLEMENT
+public:
+    InodeMap() : NumBuckets(64), NumItems(0),
+                 NumLookups(0), NumProbes(0), MaxProbes(0) {
+        Buckets = static_cast<Bucket*>(calloc(NumBuckets, sizeof(Bucket)));
+    }
+    ~InodeMap() { free(Buckets); }
+
+    /// GetOrCreate - Return the entry for the specified key, default
+    /// constructing it if there isn't one yet.
+    EntryTy &GetOrCreate(dev_t Device, ino_t Inode) {
+        Bucket *B = &LookupBucket(Device, Inode);
+        if (B->Entry)
+            return *B->Entry;
+
+        // Keep the load factor at most 3/4 so probe sequences stay short.
+        if ((NumItems + 1) * 4 > NumBuckets * 3) {
+            Grow();
+            B = &LookupBucket(Device, Inode);
+        }
+        ++NumItems;
+        B->Device = Device;
+        B->Inode = Inode;
+        B->Entry = new (Allocator.Allocate<EntryTy>()) EntryTy();
+        return *B->Entry;
+    }
+
+    size_t size() const { return NumItems; }
+
+    void PrintStats(const char *Name) const {
+        std::cerr << NumItems << " unique " << Name << " in " << NumBuckets
+                  << " buckets, " << NumLookups << " lookups, " << NumProbes
+                  << " probes (max " << MaxProbes << ").\n";
+    }
+};
+
 class FileManager::UniqueDirContainer {
-/// UniqueDirs - Cache from ID's to existing directories/files.
+    /// UniqueDirs - Cache from ID's to existing directories.
     ///
-    std::map<std::pair<dev_t, ino_t>, DirectoryEntry> UniqueDirs;
+    InodeMap<DirectoryEntry> UniqueDirs;
 
 public:
     DirectoryEntry &getDirectory(const char *Name, struct stat &StatBuf) {
-        return UniqueDirs[std::make_pair(StatBuf.st_dev, StatBuf.st_ino)];
+        return UniqueDirs.GetOrCreate(StatBuf.st_dev, StatBuf.st_ino);
     }
 
     size_t size() { return UniqueDirs.size(); }
+    void PrintStats() const { UniqueDirs.PrintStats("dirs"); }
 };
 
 class FileManager::UniqueFileContainer {
-    /// UniqueFiles - Cache from ID's to existing directories/files.
+    /// UniqueFiles - Cache from ID's to existing files.
     ///
-    std::set<FileEntry> UniqueFiles;
+    InodeMap<FileEntry> UniqueFiles;
 
 public:
     FileEntry &getFile(const char *Name, struct stat &StatBuf) {
-        return
-                const_cast<FileEntry&>(
-                        *UniqueFiles.insert(FileEntry(StatBuf.st_dev,
-                                                      StatBuf.st_ino,
-                                                      StatBuf.st_mode)).first);
+        FileEntry &UFE = UniqueFiles.GetOrCreate(StatBuf.st_dev, StatBuf.st_ino);
+        if (!UFE.Name) {
+            UFE.Device = StatBuf.st_dev;
+            UFE.Inode = StatBuf.st_ino;
+            UFE.FileMode = StatBuf.st_mode;
+        }
+        return UFE;
     }
 
     size_t size() { return UniqueFiles.size(); }
+    void PrintStats() const { UniqueFiles.PrintStats("files"); }
 };
 
 FileManager::FileManager()
         : UniqueDirs(*new UniqueDirContainer),
           UniqueFiles(*new UniqueFileContainer),
-          DirEntries(64), FileEntries(64), NextFileUID(0) {
+          NextFileUID(0), CacheDirListings(false) {
     NumDirLookups = NumFileLookups = 0;
     NumDirCacheMisses = NumFileCacheMisses = 0;
+    NumListingMisses = 0;
 }
 
 FileManager::~FileManager() {
+    for (unsigned i = 0, e = DirListings.size(); i != e; ++i)
+        delete DirListings[i];
     delete &UniqueDirs;
     delete &UniqueFiles;
 }
 
+/// ReadDirListing - Return the set of names in the specified directory, or null
+/// if it can't be read.
+static llvm::StringMap<char, llvm::BumpPtrAllocator> *
+ReadDirListing(const char *DirName) {
+    DIR *D = opendir(DirName);
+    if (!D)
+        return 0;
+
+    llvm::StringMap<char, llvm::BumpPtrAllocator> *Listing =
+            new llvm::StringMap<char, llvm::BumpPtrAllocator>();
+    while (struct dirent *Ent = readdir(D)) {
+        const char *Name = Ent->d_name;
+        Listing->GetOrCreateValue(Name, Name+strlen(Name));
+    }
+    closedir(D);
+    return Listing;
+}
+
+/// getShard - Return the shard of the path caches that holds the specified
+/// path.  This is the FNV-1a hash of the path.
+FileManager::NameShard &FileManager::getShard(const char *NameStart,
+                                              const char *NameEnd) {
+    unsigned Hash = 2166136261U;
+    for (const char *P = NameStart; P != NameEnd; ++P)
+        Hash = (Hash ^ (unsigned char) *P) * 16777619U;
+    return Shards[Hash % NumShards];
+}
+
 /// getDirectory - Lookup, cache, and verify the specified directory.  This
 /// returns null if the directory doesn't exist.
 ///
 const DirectoryEntry* FileManager::getDirectory(const char *NameStart,
                                                 const char *NameEnd){
     ++NumDirLookups;
-    llvm::StringMapEntry<DirectoryEntry *> &NamedDirEnt =
-            DirEntries.GetOrCreateValue(NameStart, NameEnd);
+    NameShard &Shard = getShard(NameStart, NameEnd);
 
     // See if there is already an entry in the map.
+    {
+        std::shared_lock<std::shared_mutex> Guard(Shard.Lock);
+        llvm::StringMap<DirectoryEntry*, llvm::BumpPtrAllocator>::iterator I =
+                Shard.DirEntries.find(llvm::StringRef(NameStart, NameEnd-NameStart));
+        if (I != Shard.DirEntries.end())
+            return I->getValue() == NON_EXISTENT_DIR ? 0 : I->getValue();
+    }
+
+    std::unique_lock<std::shared_mutex> Guard(Shard.Lock);
+    llvm::StringMapEntry<DirectoryEntry *> &NamedDirEnt =
+            Shard.DirEntries.GetOrCreateValue(NameStart, NameEnd);
+
+    // Another thread may have looked it up since we checked.
     if (NamedDirEnt.getValue())
         return NamedDirEnt.getValue() == NON_EXISTENT_DIR
                ? 0 : NamedDirEnt.getValue();
@@ -108,6 +260,7 @@ const DirectoryEntry* FileManager::getDirectory(const char *NameStart,
 
     // It exists.  See if we have already opened a directory with the same inode.
     // This occurs when one dir is symlinked to another, for example.
+    std::lock_guard<std::mutex> UniqueGuard(UniqueLock);
     DirectoryEntry &UDE = UniqueDirs.getDirectory(InterndDirName, StatBuf);
 
     NamedDirEnt.setValue(&UDE);
@@ -117,6 +270,11 @@ const DirectoryEntry* FileManager::getDirectory(const char *NameStart,
     // Otherwise, we don't have this directory yet, add it.  We use the string
     // key from the DirEntries map as the string.
     UDE.Name  = InterndDirName;
+    if (CacheDirListings) {
+        UDE.Listing = ReadDirListing(InterndDirName);
+        if (UDE.Listing)
+            DirListings.push_back(UDE.Listing);
+    }
     return &UDE;
 }
 
@@ -129,40 +287,51 @@ const DirectoryEntry* FileManager::getDirectory(const char *NameStart,
 const FileEntry *FileManager::getFile(const char *NameStart,
                                       const char *NameEnd) {
     ++NumFileLookups;
+    NameShard &Shard = getShard(NameStart, NameEnd);
 
     // See if there is already an entry in the map.
-    llvm::StringMapEntry<FileEntry *> &NamedFileEnt =
-            FileEntries.GetOrCreateValue(NameStart, NameEnd);
-
-    // See if there is already an entry in the map.
-    if (NamedFileEnt.getValue())
-        return NamedFileEnt.getValue() == NON_EXISTENT_FILE
-               ? 0 : NamedFileEnt.getValue();
-
-    ++NumFileCacheMisses;
-
-    // By default, initialize it to invalid.
-    NamedFileEnt.setValue(NON_EXISTENT_FILE);
+    {
+        std::shared_lock<std::shared_mutex> Guard(Shard.Lock);
+        llvm::StringMap<FileEntry*, llvm::BumpPtrAllocator>::iterator I =
+                Shard.FileEntries.find(llvm::StringRef(NameStart, NameEnd-NameStart));
+        if (I != Shard.FileEntries.end())
+            return I->getValue() == NON_EXISTENT_FILE ? 0 : I->getValue();
+    }
 
     // Figure out what directory it is in.   If the string contains a / in it,
-    // strip off everything after it.
+    // strip off everything after it.  This is done before taking the lock of
+    // our shard, since the directory may live in the same one.
     // FIXME: this logic should be in sys::Path.
     const char *SlashPos = NameEnd-1;
     while (SlashPos >= NameStart && !IS_DIR_SEPARATOR_CHAR(SlashPos[0]))
         --SlashPos;
+    const char *BaseName = SlashPos+1;
     // Ignore duplicate //'s.
     while (SlashPos > NameStart && IS_DIR_SEPARATOR_CHAR(SlashPos[-1]))
         --SlashPos;
 
-    const DirectoryEntry *DirInfo;
+    const DirectoryEntry *DirInfo = 0;
     if (SlashPos < NameStart) {
         // Use the current directory if file has no path component.
         const char *Name = ".";
         DirInfo = getDirectory(Name, Name+1);
-    } else if (SlashPos == NameEnd-1)
-        return 0;       // If filename ends with a /, it's a directory.
-    else
+    } else if (SlashPos != NameEnd-1)
         DirInfo = getDirectory(NameStart, SlashPos);
+    // else: if filename ends with a /, it's a directory.
+
+    std::unique_lock<std::shared_mutex> Guard(Shard.Lock);
+    llvm::StringMapEntry<FileEntry *> &NamedFileEnt =
+            Shard.FileEntries.GetOrCreateValue(NameStart, NameEnd);
+
+    // Another thread may have looked it up since we checked.
+    if (NamedFileEnt.getValue())
+        return NamedFileEnt.getValue() == NON_EXISTENT_FILE
+               ? 0 : NamedFileEnt.getValue();
+
+    ++NumFileCacheMisses;
+
+    // By default, initialize it to invalid.
+    NamedFileEnt.setValue(NON_EXISTENT_FILE);
 
     if (DirInfo == 0)  // Directory doesn't exist, file can't exist.
         return 0;
@@ -171,8 +340,13 @@ const FileEntry *FileManager::getFile(const char *NameStart,
     // FileEntries map.
     const char *InterndFileName = NamedFileEnt.getKeyData();
 
-    // FIXME: Use the directory info to prune this, before doing the stat syscall.
-    // FIXME: This will reduce the # syscalls.
+    // If we have read the directory, a name that is not in it doesn't exist.
+    if (DirInfo->Listing &&
+        DirInfo->Listing->find(llvm::StringRef(BaseName, NameEnd-BaseName)) ==
+                DirInfo->Listing->end()) {
+        ++NumListingMisses;
+        return 0;
+    }
 
     // Nope, there isn't.  Check to see if the file exists.
     struct stat StatBuf;
@@ -187,6 +361,7 @@ const FileEntry *FileManager::getFile(const char *NameStart,
 
     // It exists.  See if we have already opened a file with the same inode.
     // This occurs when one dir is symlinked to another, for example.
+    std::lock_guard<std::mutex> UniqueGuard(UniqueLock);
     FileEntry &UFE = UniqueFiles.getFile(InterndFileName, StatBuf);
 
     NamedFileEnt.setValue(&UFE);
@@ -206,19 +381,34 @@ const FileEntry *FileManager::getFile(const char *NameStart,
 
 void FileManager::PrintStats() const {
     std::cerr << "\n*** File Manager Stats:\n";
-    std::cerr << DirEntries.size() << " files found, "
-              << FileEntries.size() << " dirs found.\n";
+    unsigned NumDirEntries = 0, NumFileEntries = 0;
+    for (unsigned i = 0; i != NumShards; ++i) {
+        NumDirEntries += Shards[i].DirEntries.size();
+        NumFileEntries += Shards[i].FileEntries.size();
+    }
+    std::cerr << NumDirEntries << " files found, "
+              << NumFileEntries << " dirs found.\n";
     std::cerr << NumDirLookups << " dir lookups, "
               << NumDirCacheMisses << " dir cache misses.\n";
     std::cerr << NumFileLookups << " file lookups, "
               << NumFileCacheMisses << " file cache misses.\n";
+    if (CacheDirListings)
+        std::cerr << DirListings.size() << " directory listings read, "
+                  << NumListingMisses << " missing files found without stat.\n";
+    UniqueDirs.PrintStats();
+    UniqueFiles.PrintStats();
 
     //llvm::cerr << PagesMapped << BytesOfPagesMapped << FSLookups;
 }
 
 int MemorizeStatCalls::stat(const char *path, struct stat *buf) {
     int result = ::stat(path, buf);
+    Memorize(path, result, buf);
+    return result;
+}
 
+void MemorizeStatCalls::Memorize(const char *path, int result,
+                                 const struct stat *buf) {
     if (result != 0) {
         // Cache failed 'stat' results.
         struct stat empty;
@@ -230,6 +420,4 @@ int MemorizeStatCalls::stat(const char *path, struct stat *buf) {
         // paths.
         StatCalls[path] = StatResult(result, *buf);
     }
-
-    return result;
 }
\ No newline at end of file
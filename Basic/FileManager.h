@@ -14,9 +14,13 @@
 #include "llvm/StringMap.h"
 #include "llvm/OwningPtr.h"
 #include "llvm/Allocator.h"
+#include <atomic>
 #include <map>
+#include <mutex>
 #include <set>
+#include <shared_mutex>
 #include <string>
+#include <vector>
 // FIXME: Enhance libsystem to support inode and other fields in stat.
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -29,9 +33,14 @@ namespace CPToyC {
         ///
         class DirectoryEntry {
             const char  *Name;   // Name of the directory.
+
+            /// Listing - The names in the directory, read once if the FileManager
+            /// caches directory listings.  This is null otherwise, or if the
+            /// directory could not be read.  The FileManager owns it.
+            llvm::StringMap<char, llvm::BumpPtrAllocator> *Listing;
             friend class FileManager;
         public:
-            DirectoryEntry() : Name(nullptr) {}
+            DirectoryEntry() : Name(nullptr), Listing(nullptr) {}
             const char *getName() const { return Name; }
         };
 
@@ -99,9 +108,18 @@ namespace CPToyC {
             iterator end() const { return StatCalls.end(); }
 
             virtual int stat(const char *path, struct stat *buf);
+
+        protected:
+            /// Memorize - Record the result of stat'ing the specified path.
+            void Memorize(const char *path, int result, const struct stat *buf);
         };
 
 
+        /// FileManager - Implements support for file system lookup, file system
+        /// caching, and directory search management.  Lookups may be made from
+        /// several threads at once: the path caches are split into shards, each
+        /// behind its own reader/writer lock, so a hit only takes a shared lock
+        /// on one shard and threads looking up different paths rarely contend.
         class FileManager {
 
             class UniqueDirContainer;
@@ -112,20 +130,41 @@ namespace CPToyC {
             UniqueDirContainer &UniqueDirs;
             UniqueFileContainer &UniqueFiles;
 
-            /// DirEntries/FileEntries - This is a cache of directory/file entries we have
-            /// looked up.  The actual Entry is owned by UniqueFiles/UniqueDirs above.
-            ///
-            llvm::StringMap<DirectoryEntry*, llvm::BumpPtrAllocator> DirEntries;
-            llvm::StringMap<FileEntry*, llvm::BumpPtrAllocator> FileEntries;
+            /// NameShard - A slice of the directory/file entries we have looked up,
+            /// selected by a hash of the path.  The actual Entry is owned by
+            /// UniqueFiles/UniqueDirs above.
+            struct NameShard {
+                std::shared_mutex Lock;
+                llvm::StringMap<DirectoryEntry*, llvm::BumpPtrAllocator> DirEntries;
+                llvm::StringMap<FileEntry*, llvm::BumpPtrAllocator> FileEntries;
+            };
+
+            enum { NumShards = 16 };
+            NameShard Shards[NumShards];
 
+            NameShard &getShard(const char *NameStart, const char *NameEnd);
+
+            /// UniqueLock - Guards UniqueDirs, UniqueFiles and NextFileUID.  It is
+            /// only taken on a cache miss, and always after the lock of a shard.
+            std::mutex UniqueLock;
 
             /// NextFileUID - Each FileEntry we create is assigned a unique ID #.
             ///
             unsigned NextFileUID;
 
+            /// CacheDirListings - If true, each directory is read once when it is
+            /// first looked up, and files missing from the listing are known not to
+            /// exist without a stat.
+            bool CacheDirListings;
+
+            /// DirListings - The listings of the directories, owned here.  Guarded by
+            /// UniqueLock.
+            std::vector<llvm::StringMap<char, llvm::BumpPtrAllocator>*> DirListings;
+
             // Statistics.
-            unsigned NumDirLookups, NumFileLookups;
-            unsigned NumDirCacheMisses, NumFileCacheMisses;
+            std::atomic<unsigned> NumDirLookups, NumFileLookups;
+            std::atomic<unsigned> NumDirCacheMisses, NumFileCacheMisses;
+            std::atomic<unsigned> NumListingMisses;
 
             // Caching.
             llvm::OwningPtr<StatSysCallCache> StatCache;
@@ -139,11 +178,18 @@ namespace CPToyC {
 
             /// setStatCache - Installs the provided StatSysCallCache object within
             ///  the FileManager.  Ownership of this object is transferred to the
-            ///  FileManager.
+            ///  FileManager.  This must happen before the FileManager is shared
+            ///  between threads.
             void setStatCache(StatSysCallCache *statCache) {
                 StatCache.reset(statCache);
             }
 
+            /// setCacheDirectoryListings - Read each directory once and answer lookups
+            ///  of files missing from it without a stat.  Files created in a directory
+            ///  after it was read are not seen.  This must happen before the
+            ///  FileManager is shared between threads.
+            void setCacheDirectoryListings(bool Cache) { CacheDirListings = Cache; }
+
             /// getDirectory - Lookup, cache, and verify the specified directory.  This
             /// returns null if the directory doesn't exist.
             ///
@@ -0,0 +1,249 @@
+/***********************************
+* File:     HeaderGuardCache.cpp
+*
+* Author:   agent
+*
+* Email:    agent@local
+*
+* Date:     2026/10/16
+***********************************/
+
+#include "HeaderGuardCache.h"
+#include "FileManager.h"
+#include "llvm/MemoryBuffer.h"
+#include "llvm/OwningPtr.h"
+#include "llvm/raw_ostream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace CPToyC::Compiler;
+
+/// The first line of a cache file.  The version is bumped whenever the record
+/// layout changes, which discards caches written by older builds.
+static const char CacheSignature[] = "CPTOYC-GUARD-CACHE 2\n";
+
+thread_local IdentifierTable *HeaderGuardCache::Identifiers = 0;
+
+HeaderGuardCache::HeaderGuardCache()
+    : Dirty(false) {
+    NumLoaded = NumHits = NumStale = NumRecorded = 0;
+}
+
+HeaderGuardCache::~HeaderGuardCache() {}
+
+/// GetMTime - The modification time of a stat result in nanoseconds.
+static int64_t GetMTime(const struct stat &S) {
+#if defined(__APPLE__)
+    return S.st_mtimespec.tv_sec*1000000000LL + S.st_mtimespec.tv_nsec;
+#else
+    return S.st_mtim.tv_sec*1000000000LL + S.st_mtim.tv_nsec;
+#endif
+}
+
+/// StatFile - Fill in the identity of the header as it is on disk now.  The
+/// FileEntry only keeps the mtime in seconds, and may come from a stat cache,
+/// so the file is stat'ed again.
+bool HeaderGuardCache::StatFile(const FileEntry *FE, Entry &E) {
+    struct stat StatBuf;
+    if (::stat(FE->getName(), &StatBuf))
+        return false;
+    E.Device = StatBuf.st_dev;
+    E.Inode = StatBuf.st_ino;
+    E.Size = StatBuf.st_size;
+    E.ModTime = GetMTime(StatBuf);
+    return true;
+}
+
+bool HeaderGuardCache::Matches(const Entry &E, const Entry &Disk) {
+    return E.Device == Disk.Device && E.Inode == Disk.Inode &&
+           E.Size == Disk.Size && E.ModTime == Disk.ModTime;
+}
+
+/// ReadFromFile - Each record is one line: "device inode size mtime macro
+/// path".  The path comes last so it may contain spaces.
+bool HeaderGuardCache::ReadFromFile(const std::string &Path,
+                                    std::string *ErrStr) {
+    llvm::OwningPtr<MemoryBuffer> Buf(MemoryBuffer::getFile(Path.c_str()));
+    if (!Buf)
+        return true;   // No cache yet.
+
+    const char *Ptr = Buf->getBufferStart(), *End = Buf->getBufferEnd();
+    unsigned SigLen = sizeof(CacheSignature)-1;
+    if ((unsigned) (End-Ptr) < SigLen || memcmp(Ptr, CacheSignature, SigLen)) {
+        if (ErrStr) *ErrStr = "'" + Path + "' is not an include guard cache";
+        return false;
+    }
+    Ptr += SigLen;
+
+    while (Ptr != End) {
+        const char *LineEnd = (const char*) memchr(Ptr, '\n', End-Ptr);
+        if (!LineEnd) break;   // Truncated record.
+
+        Entry E;
+        char *Next;
+        E.Device = strtoull(Ptr, &Next, 10);
+        E.Inode = strtoull(Next, &Next, 10);
+        E.Size = strtoull(Next, &Next, 10);
+        E.ModTime = strtoll(Next, &Next, 10);
+        if (*Next != ' ') {
+            if (ErrStr) *ErrStr = "malformed record in '" + Path + "'";
+            return false;
+        }
+        const char *MacroStart = Next+1;
+        const char *MacroEnd = (const char*) memchr(MacroStart, ' ',
+                                                    LineEnd-MacroStart);
+        if (!MacroEnd || MacroEnd == MacroStart || MacroEnd+1 == LineEnd) {
+            if (ErrStr) *ErrStr = "malformed record in '" + Path + "'";
+            return false;
+        }
+        E.Macro.assign(MacroStart, MacroEnd);
+
+        llvm::StringMapEntry<unsigned> &Slot = EntryForPath.GetOrCreateValue(
+                llvm::StringRef(MacroEnd+1, LineEnd-(MacroEnd+1)), ~0U);
+        if (Slot.getValue() == ~0U) {
+            Slot.setValue(Entries.size());
+            Entries.push_back(E);
+        } else {
+            Entries[Slot.getValue()] = E;
+        }
+        ++NumLoaded;
+        Ptr = LineEnd+1;
+    }
+    return true;
+}
+
+bool HeaderGuardCache::WriteToFile(const std::string &Path,
+                                   std::string *ErrStr) {
+    if (!Dirty)
+        return true;
+
+    // Write a private temporary and rename it over the cache, so another run
+    // reading the cache sees either the old or the new version in full.
+    char Suffix[32];
+    snprintf(Suffix, sizeof(Suffix), ".tmp%d", (int) getpid());
+    std::string TmpPath = Path + Suffix;
+    {
+        std::string Error;
+        llvm::raw_fd_ostream OS(TmpPath.c_str(), true, true, Error);
+        if (!Error.empty()) {
+            if (ErrStr) *ErrStr = Error;
+            return false;
+        }
+
+        OS << CacheSignature;
+        for (llvm::StringMap<unsigned>::const_iterator I = EntryForPath.begin(),
+                     E = EntryForPath.end(); I != E; ++I) {
+            const Entry &R = Entries[I->getValue()];
+            if (R.Macro.empty())
+                continue;   // Dropped as stale.
+            OS << (unsigned long long) R.Device << ' '
+               << (unsigned long long) R.Inode << ' '
+               << (unsigned long long) R.Size << ' '
+               << (long long) R.ModTime << ' ' << R.Macro << ' ';
+            OS.write(I->getKeyData(), I->getKeyLength());
+            OS << '\n';
+        }
+    }
+
+    if (rename(TmpPath.c_str(), Path.c_str())) {
+        if (ErrStr) *ErrStr = "could not replace '" + Path + "'";
+        remove(TmpPath.c_str());
+        return false;
+    }
+    Dirty = false;
+    return true;
+}
+
+unsigned HeaderGuardCache::getControllingMacroID(const FileEntry *FE) {
+    const char *Name = FE->getName();
+    unsigned Index;
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        llvm::StringMap<unsigned>::iterator I =
+                EntryForPath.find(llvm::StringRef(Name, strlen(Name)));
+        if (I == EntryForPath.end() || Entries[I->getValue()].Macro.empty())
+            return 0;
+        Index = I->getValue();
+    }
+
+    // Stat without holding the lock, so other threads are not held up.
+    Entry Disk;
+    bool Exists = StatFile(FE, Disk);
+
+    std::lock_guard<std::mutex> Guard(Lock);
+    Entry &E = Entries[Index];
+    if (E.Macro.empty())
+        return 0;
+
+    // The header was edited since its guard was recorded: forget it.
+    if (!Exists || !Matches(E, Disk)) {
+        ++NumStale;
+        E.Macro.clear();
+        Dirty = true;
+        return 0;
+    }
+
+    ++NumHits;
+    return Index+1;
+}
+
+void HeaderGuardCache::SetControllingMacro(const FileEntry *FE,
+                                           const IdentifierInfo *Macro) {
+    const char *Name = FE->getName();
+    Entry Disk;
+    bool Exists = StatFile(FE, Disk);
+
+    // A header modified in the current second might be edited again within it
+    // without a visible change of mtime on coarse-grained file systems.  Such
+    // a guard is left unverified, and is recorded by a later run.
+    bool Racy = !Exists || Disk.ModTime/1000000000LL >= (int64_t) time(0);
+
+    std::lock_guard<std::mutex> Guard(Lock);
+    llvm::StringMap<unsigned>::iterator I =
+            EntryForPath.find(llvm::StringRef(Name, strlen(Name)));
+    if (Racy) {
+        if (I != EntryForPath.end() && !Entries[I->getValue()].Macro.empty()) {
+            Entries[I->getValue()].Macro.clear();
+            Dirty = true;
+        }
+        return;
+    }
+
+    llvm::StringMapEntry<unsigned> &Slot = EntryForPath.GetOrCreateValue(
+            llvm::StringRef(Name, strlen(Name)), ~0U);
+    if (Slot.getValue() == ~0U) {
+        Slot.setValue(Entries.size());
+        Entries.push_back(Entry());
+    }
+
+    Entry &E = Entries[Slot.getValue()];
+    if (Matches(E, Disk) && E.Macro == Macro->getName())
+        return;   // Already known.
+
+    Disk.Macro = Macro->getName();
+    E = Disk;
+    ++NumRecorded;
+    Dirty = true;
+}
+
+IdentifierInfo *HeaderGuardCache::GetIdentifier(unsigned ID) {
+    assert(Identifiers && "No identifier table to resolve guards in");
+    std::string Macro;
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        assert(ID && ID <= Entries.size() && "Invalid controlling macro ID");
+        Macro = Entries[ID-1].Macro;
+    }
+    return &Identifiers->get(Macro);
+}
+
+void HeaderGuardCache::PrintStats() const {
+    fprintf(stderr, "\n*** Include Guard Cache Stats:\n");
+    fprintf(stderr, "%u guards loaded, %u used, %u stale.\n",
+            NumLoaded, NumHits, NumStale);
+    fprintf(stderr, "%u guards recorded.\n", NumRecorded);
+}
@@ -0,0 +1,104 @@
+/***********************************
+* File:     HeaderGuardCache.h
+*
+* Author:   agent
+*
+* Email:    agent@local
+*
+* Date:     2026/10/16
+***********************************/
+
+#ifndef CPTOYC_HEADERGUARDCACHE_H
+#define CPTOYC_HEADERGUARDCACHE_H
+
+#include "IdentifierTable.h"
+#include "llvm/StringMap.h"
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace CPToyC {
+    namespace Compiler {
+        class FileEntry;
+
+        /// HeaderGuardCache - A record of the controlling macros of headers that
+        /// outlives the process.  The multiple-include optimization only learns a
+        /// header's guard after lexing it once; with this cache, a later run knows
+        /// the guard up front and HeaderSearch can refuse an #include of the header
+        /// before opening it, as soon as the guard macro is defined.
+        ///
+        /// Entries are keyed by the file's path and are only trusted while its
+        /// device, inode, size and modification time (in nanoseconds) are
+        /// unchanged.  A guard is not recorded while the header's mtime is still
+        /// the current second, as a later edit in that second could keep the
+        /// mtime.  The cache resolves its own controlling macro IDs, in the role
+        /// of HeaderSearch's ExternalIdentifierLookup.
+        ///
+        /// Translation units preprocessed on several threads share one cache.
+        /// Lookups and updates take a lock, and each thread resolves guards in the
+        /// identifier table it set with setIdentifierTable.
+        class HeaderGuardCache : public ExternalIdentifierLookup {
+            struct Entry {
+                uint64_t Device;
+                uint64_t Inode;
+                uint64_t Size;
+                int64_t ModTime;            // In nanoseconds.
+                std::string Macro;
+            };
+
+            /// Identifiers - The table of the translation unit being preprocessed
+            /// on this thread, in which recorded guard macros are resolved.
+            static thread_local IdentifierTable *Identifiers;
+
+            /// Lock - Guards the entries, Dirty and the statistics.
+            std::mutex Lock;
+
+            /// EntryForPath - Maps a header path to its index in Entries.
+            llvm::StringMap<unsigned> EntryForPath;
+            std::vector<Entry> Entries;
+
+            /// Dirty - True if the cache changed since it was read.
+            bool Dirty;
+
+            // Statistics.
+            unsigned NumLoaded, NumHits, NumStale, NumRecorded;
+
+            static bool StatFile(const FileEntry *FE, Entry &E);
+            static bool Matches(const Entry &E, const Entry &Disk);
+        public:
+            HeaderGuardCache();
+            virtual ~HeaderGuardCache();
+
+            /// setIdentifierTable - Resolve guard macros in the specified table from
+            /// now on, on the calling thread.  A cache shared by several translation
+            /// units is pointed at the table of each in turn.
+            void setIdentifierTable(IdentifierTable &IT) { Identifiers = &IT; }
+
+            /// ReadFromFile - Load the cache written by an earlier run.  A missing
+            /// file is an empty cache; a malformed one is reported through ErrStr and
+            /// otherwise ignored.
+            bool ReadFromFile(const std::string &Path, std::string *ErrStr = 0);
+
+            /// WriteToFile - Save the cache if it changed.  The file is replaced
+            /// atomically, so concurrent runs never see a partial cache.
+            bool WriteToFile(const std::string &Path, std::string *ErrStr = 0);
+
+            /// getControllingMacroID - Return the ID of the recorded controlling
+            /// macro of the specified header, or zero if none is known or the header
+            /// changed since it was recorded.
+            unsigned getControllingMacroID(const FileEntry *FE);
+
+            /// SetControllingMacro - Record the controlling macro the multiple
+            /// include optimization found for the specified header.
+            void SetControllingMacro(const FileEntry *FE, const IdentifierInfo *Macro);
+
+            /// GetIdentifier - Resolve an ID returned by getControllingMacroID.
+            virtual IdentifierInfo *GetIdentifier(unsigned ID);
+
+            void PrintStats() const;
+        };
+    }
+}
+
+#endif //CPTOYC_HEADERGUARDCACHE_H
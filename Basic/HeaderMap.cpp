@@ -15,7 +15,12 @@
 #include "llvm/MemoryBuffer.h"
 #include "llvm/OwningPtr.h"
 #include "llvm/SmallString.h"
+#include "llvm/raw_ostream.h"
+#include <algorithm>
 #include <cstdio>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace CPToyC::Compiler;
 
@@ -27,6 +32,10 @@ enum {
     HMAP_HeaderMagicNumber = ('h' << 24) | ('m' << 16) | ('a' << 8) | 'p',
     HMAP_HeaderVersion = 1,
 
+    /// Keys are matched case sensitively, as an -I directory on a case
+    /// sensitive file system would be.
+    HMAP_CaseSensitive = 1,
+
     HMAP_EmptyBucketKey = 0
 };
 
@@ -74,10 +83,13 @@ const HeaderMap *HeaderMap::Create(const FileEntry *FE) {
     else
         return 0;  // Not a header map.
 
-    if (Header->Reserved != 0) return 0;
+    unsigned Flags = NeedsByteSwap ? llvm::ByteSwap_16(Header->Flags)
+                                   : Header->Flags;
+    if (Flags & ~HMAP_CaseSensitive) return 0;
 
-    // Okay, everything looks good, create the header map.
-    return new HeaderMap(FileBuffer.get(), NeedsByteSwap);
+    // Okay, everything looks good, create the header map.  It owns the buffer.
+    return new HeaderMap(FileBuffer.take(), NeedsByteSwap,
+                         (Flags & HMAP_CaseSensitive) != 0);
 }
 
 HeaderMap::~HeaderMap() {
@@ -195,19 +207,23 @@ const FileEntry *HeaderMap::LookupFile(const char *FilenameStart,
     if (NumBuckets & (NumBuckets - 1))
         return 0;
 
-    // Linearly probe the hash table.
+    // Linearly probe the hash table.  The hash ignores case, so keys differing
+    // only in case share a chain even in a case sensitive map.
+    unsigned FilenameLen = FilenameEnd - FilenameStart;
     for (unsigned Bucket = HashHMapKey(FilenameStart, FilenameEnd);; ++Bucket) {
         HMapBucket B = getBucket(Bucket & (NumBuckets - 1));
-        if (B.Key == HMAP_EmptyBucketKey) return 0;// Hash miss.
+        if (B.Key == HMAP_EmptyBucketKey) return 0;  // Hash miss.
 
         // See if the key matches.  If not, probe on.
         const char *Key = getString(B.Key);
+        if (!Key) continue;
         unsigned BucketKeyLen = strlen(Key);
-        if (BucketKeyLen != unsigned(FilenameEnd - FilenameStart))
+        if (BucketKeyLen != FilenameLen)
             continue;
 
         // See if the actual strings equal.
-        if (!StringsEqualWithoutCase(FilenameStart, Key, BucketKeyLen))
+        if (CaseSensitive ? memcmp(FilenameStart, Key, BucketKeyLen) != 0
+                          : !StringsEqualWithoutCase(FilenameStart, Key, BucketKeyLen))
             continue;
 
         // If so, we have a match in the hash table.  Construct the destination
@@ -217,4 +233,159 @@ const FileEntry *HeaderMap::LookupFile(const char *FilenameStart,
         DestPath += getString(B.Suffix);
         return FM.getFile(DestPath.begin(), DestPath.end());
     }
-}
\ No newline at end of file
+}
+
+//===----------------------------------------------------------------------===//
+// Header Map Construction
+//===----------------------------------------------------------------------===//
+
+/// AddEntry - Map the specified #include name to Prefix+Suffix, unless it is
+/// mapped already.
+void HeaderMapBuilder::AddEntry(const std::string &Key,
+                                const std::string &Prefix,
+                                const std::string &Suffix) {
+    llvm::StringMapEntry<unsigned> &Index =
+            KeyIndices.GetOrCreateValue(Key.data(), Key.data()+Key.size(), ~0U);
+    if (Index.getValue() != ~0U)
+        return;
+    Index.setValue(Entries.size());
+
+    Entry E = { Key, Prefix, Suffix };
+    Entries.push_back(E);
+}
+
+/// AddDirectory - Add every file under the specified include directory, unless
+/// an earlier directory already provides its name.
+bool HeaderMapBuilder::AddDirectory(const std::string &Dir) {
+    struct stat StatBuf;
+    if (::stat(Dir.c_str(), &StatBuf) || !S_ISDIR(StatBuf.st_mode))
+        return false;
+
+    std::string Prefix(Dir);
+    if (Prefix.empty() || Prefix[Prefix.size()-1] != '/')
+        Prefix += '/';
+
+    std::vector<std::pair<uint64_t, uint64_t> > Visited;
+    Visited.push_back(std::make_pair((uint64_t) StatBuf.st_dev,
+                                     (uint64_t) StatBuf.st_ino));
+    AddDirectoryContents(Prefix, std::string(), Visited);
+    return true;
+}
+
+/// AddDirectoryContents - Add the files in Dir, which is RelDir under the
+/// include directory, and recurse into its subdirectories.  Visited holds the
+/// directories on the way down, so that a symlink cycle isn't followed forever.
+void HeaderMapBuilder::AddDirectoryContents(
+        const std::string &Dir, const std::string &RelDir,
+        std::vector<std::pair<uint64_t, uint64_t> > &Visited) {
+    DIR *D = opendir(Dir.c_str());
+    if (!D)
+        return;
+
+    // Sort the names so the header map doesn't depend on the order readdir
+    // returns them in.
+    std::vector<std::string> Names;
+    while (struct dirent *Ent = readdir(D)) {
+        if (strcmp(Ent->d_name, ".") && strcmp(Ent->d_name, ".."))
+            Names.push_back(Ent->d_name);
+    }
+    closedir(D);
+    std::sort(Names.begin(), Names.end());
+
+    for (unsigned i = 0, e = Names.size(); i != e; ++i) {
+        std::string Path = Dir + Names[i];
+        struct stat StatBuf;
+        if (::stat(Path.c_str(), &StatBuf))
+            continue;
+
+        if (S_ISREG(StatBuf.st_mode)) {
+            AddEntry(RelDir + Names[i], Dir, Names[i]);
+            continue;
+        }
+        if (!S_ISDIR(StatBuf.st_mode))
+            continue;
+
+        std::pair<uint64_t, uint64_t> ID((uint64_t) StatBuf.st_dev,
+                                         (uint64_t) StatBuf.st_ino);
+        if (std::find(Visited.begin(), Visited.end(), ID) != Visited.end())
+            continue;
+        Visited.push_back(ID);
+        AddDirectoryContents(Path + '/', RelDir + Names[i] + '/', Visited);
+        Visited.pop_back();
+    }
+}
+
+/// WriteToFile - Emit the header map in host byte order; HeaderMap::Create
+/// reads either order.
+bool HeaderMapBuilder::WriteToFile(const std::string &Path,
+                                   std::string *ErrStr) const {
+    // Keep the table at most half full, so probe sequences stay short.
+    unsigned NumBuckets = 8;
+    while (NumBuckets < Entries.size()*2)
+        NumBuckets *= 2;
+
+    // The string pool starts with an empty string: offset 0 is the empty key.
+    std::string StringData(1, '\0');
+    llvm::StringMap<uint32_t> StringOffsets;
+    auto AddString = [&](const std::string &Str) {
+        llvm::StringMapEntry<uint32_t> &Entry =
+                StringOffsets.GetOrCreateValue(Str.data(), Str.data()+Str.size(), 0);
+        if (!Entry.getValue()) {
+            Entry.setValue(StringData.size());
+            StringData += Str;
+            StringData += '\0';
+        }
+        return Entry.getValue();
+    };
+
+    std::vector<HMapBucket> Buckets(NumBuckets);
+    unsigned MaxValueLength = 0;
+    for (unsigned i = 0, e = Entries.size(); i != e; ++i) {
+        const Entry &E = Entries[i];
+        const char *KeyStart = E.Key.data();
+        unsigned Bucket = HashHMapKey(KeyStart, KeyStart+E.Key.size());
+        while (Buckets[Bucket & (NumBuckets-1)].Key != HMAP_EmptyBucketKey)
+            ++Bucket;
+
+        HMapBucket &B = Buckets[Bucket & (NumBuckets-1)];
+        B.Key = AddString(E.Key);
+        B.Prefix = AddString(E.Prefix);
+        B.Suffix = AddString(E.Suffix);
+        MaxValueLength = std::max(MaxValueLength,
+                                  unsigned(E.Prefix.size()+E.Suffix.size()));
+    }
+
+    HMapHeader Header;
+    Header.Magic = HMAP_HeaderMagicNumber;
+    Header.Version = HMAP_HeaderVersion;
+    Header.Flags = HMAP_CaseSensitive;
+    Header.StringsOffset = sizeof(HMapHeader) + NumBuckets*sizeof(HMapBucket);
+    Header.NumEntries = Entries.size();
+    Header.NumBuckets = NumBuckets;
+    Header.MaxValueLength = MaxValueLength;
+
+    // Write a private temporary and rename it over the map, so a build reading
+    // the map sees either the old or the new version in full.
+    char Suffix[32];
+    snprintf(Suffix, sizeof(Suffix), ".tmp%d", (int) getpid());
+    std::string TmpPath = Path + Suffix;
+    {
+        std::string Error;
+        llvm::raw_fd_ostream OS(TmpPath.c_str(), true, true, Error);
+        if (!Error.empty()) {
+            if (ErrStr) *ErrStr = Error;
+            return false;
+        }
+        OS.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+        OS.write(reinterpret_cast<const char*>(&Buckets[0]),
+                 NumBuckets*sizeof(HMapBucket));
+        OS << StringData;
+    }
+
+    if (rename(TmpPath.c_str(), Path.c_str())) {
+        if (ErrStr) *ErrStr = "could not replace '" + Path + "'";
+        remove(TmpPath.c_str());
+        return false;
+    }
+    return true;
+}
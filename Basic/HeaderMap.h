@@ -10,7 +10,10 @@
 
 #ifndef CPTOYC_HEADERMAP_H
 #define CPTOYC_HEADERMAP_H
+#include "llvm/StringMap.h"
 #include <cstdint>
+#include <string>
+#include <vector>
 
 namespace CPToyC {
     namespace Compiler {
@@ -28,7 +31,7 @@ namespace CPToyC {
         struct HMapHeader {
             uint32_t Magic;           // Magic word, also indicates byte order.
             uint16_t Version;         // Version number -- currently 1.
-            uint16_t Reserved;        // Reserved for future use - zero for now.
+            uint16_t Flags;           // HMAP_* flags - zero in Apple's maps.
             uint32_t StringsOffset;   // Offset to start of string pool.
             uint32_t NumEntries;      // Number of entries in the string table.
             uint32_t NumBuckets;      // Number of buckets (always a power of 2).
@@ -47,8 +50,13 @@ namespace CPToyC {
             const MemoryBuffer *FileBuffer;
             bool NeedsBSwap;
 
-            HeaderMap(const MemoryBuffer *File, bool BSwap)
-                    : FileBuffer(File), NeedsBSwap(BSwap) {
+            /// CaseSensitive - True if keys must match the #include'd name
+            /// exactly, as in the maps HeaderMapBuilder writes.  Other maps are
+            /// matched without regard to case.
+            bool CaseSensitive;
+
+            HeaderMap(const MemoryBuffer *File, bool BSwap, bool CaseSens)
+                    : FileBuffer(File), NeedsBSwap(BSwap), CaseSensitive(CaseSens) {
             }
         public:
             ~HeaderMap();
@@ -74,6 +82,45 @@ namespace CPToyC {
             HMapBucket getBucket(unsigned BucketNo) const;
             const char *getString(unsigned StrTabIdx) const;
         };
+
+        /// HeaderMapBuilder - Collect the files under a list of include directories
+        /// and write them out as a header map.  The map resolves an #include with one
+        /// hashed lookup where the directories would each have to be probed in turn.
+        /// As with -I, a name found in more than one directory resolves to the
+        /// first.  Names differing only in case are kept apart, and the map is
+        /// flagged case sensitive so LookupFile only takes the exact spelling.
+        class HeaderMapBuilder {
+            struct Entry {
+                std::string Key;        // The #include'd name, relative to the dir.
+                std::string Prefix;     // The directory holding the file, with '/'.
+                std::string Suffix;     // The file name.
+            };
+
+            /// Entries - The files found, in the order they were added.
+            std::vector<Entry> Entries;
+
+            /// KeyIndices - Map from a key to its index in Entries.
+            llvm::StringMap<unsigned> KeyIndices;
+
+            void AddDirectoryContents(const std::string &Dir,
+                                      const std::string &RelDir,
+                                      std::vector<std::pair<uint64_t, uint64_t> > &Visited);
+        public:
+            /// AddDirectory - Add every file under the specified include directory,
+            /// unless an earlier directory already provides its name.  Returns false
+            /// if the directory cannot be read.
+            bool AddDirectory(const std::string &Dir);
+
+            /// AddEntry - Map the specified #include name to Prefix+Suffix, unless
+            /// it is mapped already.
+            void AddEntry(const std::string &Key, const std::string &Prefix,
+                          const std::string &Suffix);
+
+            unsigned size() const { return Entries.size(); }
+
+            /// WriteToFile - Emit the header map.  The file is replaced atomically.
+            bool WriteToFile(const std::string &Path, std::string *ErrStr = 0) const;
+        };
     }
 }
 
@@ -10,9 +10,13 @@
 
 #include "HeaderSearch.h"
 #include "HeaderMap.h"
+#include "HeaderGuardCache.h"
 #include "FileManager.h"
 #include "IdentifierTable.h"
 #include "llvm/SmallString.h"
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <unistd.h>
 using namespace CPToyC::Compiler;
 
@@ -31,11 +35,14 @@ HeaderFileInfo::getControllingMacro(ExternalIdentifierLookup *External) {
 HeaderSearch::HeaderSearch(FileManager &FM) : FileMgr(FM), FrameworkMap(64) {
     SystemDirIdx = 0;
     NoCurDirSearch = false;
+    UseIncludeIndex = IncludeIndexBuilt = false;
 
     ExternalLookup = 0;
+    GuardCache = 0;
     NumIncluded = 0;
-    NumMultiIncludeFileOptzn = 0;
+    NumMultiIncludeFileOptzn = NumGuardCacheOptzn = 0;
     NumFrameworkLookups = NumSubFrameworkLookups = 0;
+    NumIndexLookups = NumIndexDirsSkipped = NumIndexRebuilds = 0;
 }
 
 HeaderSearch::~HeaderSearch() {
@@ -61,9 +68,20 @@ void HeaderSearch::PrintStats() {
     fprintf(stderr, "  %d #include/#include_next/#import.\n", NumIncluded);
     fprintf(stderr, "    %d #includes skipped due to"
                     " the multi-include optimization.\n", NumMultiIncludeFileOptzn);
+    fprintf(stderr, "    %d of them before the file was ever entered,"
+                    " via the include guard cache.\n", NumGuardCacheOptzn);
 
     fprintf(stderr, "%d framework lookups.\n", NumFrameworkLookups);
     fprintf(stderr, "%d subframework lookups.\n", NumSubFrameworkLookups);
+
+    if (UseIncludeIndex) {
+        fprintf(stderr, "%d include index names, %d unindexed search dirs.\n",
+                (int)IncludeIndex.size(), (int)UnindexedDirs.size());
+        fprintf(stderr, "  %d lookups through the index, %d search dirs skipped.\n",
+                NumIndexLookups, NumIndexDirsSkipped);
+        fprintf(stderr, "  %d times rebuilt after a search dir changed.\n",
+                NumIndexRebuilds);
+    }
 }
 
 namespace llvm {
@@ -213,6 +231,98 @@ const FileEntry *DirectoryLookup::DoFrameworkLookup(const char *FilenameStart,
 }
 
 
+//===----------------------------------------------------------------------===//
+// Include Path Index.
+//===----------------------------------------------------------------------===//
+
+/// GetMTime - The modification time of a stat result in nanoseconds.
+static int64_t GetMTime(const struct stat &S) {
+#if defined(__APPLE__)
+    return S.st_mtimespec.tv_sec*1000000000LL + S.st_mtimespec.tv_nsec;
+#else
+    return S.st_mtim.tv_sec*1000000000LL + S.st_mtim.tv_nsec;
+#endif
+}
+
+void HeaderSearch::ClearIncludeIndex() {
+    IncludeIndex.clear();
+    UnindexedDirs.clear();
+    IndexedDirMTimes.clear();
+    IncludeIndexBuilt = false;
+}
+
+/// BuildIncludeIndex - Read the names in each normal directory in SearchDirs.
+void HeaderSearch::BuildIncludeIndex() {
+    ClearIncludeIndex();
+    IndexedDirMTimes.resize(SearchDirs.size(), -1);
+
+    for (unsigned i = 0, e = SearchDirs.size(); i != e; ++i) {
+        if (!SearchDirs[i].isNormalDir()) {
+            UnindexedDirs.push_back(i);
+            continue;
+        }
+
+        // Take the modification time before reading, so that a name added while
+        // the directory is read is caught by the next revalidation.
+        const char *DirName = SearchDirs[i].getDir()->getName();
+        struct stat StatBuf;
+        DIR *D;
+        if (::stat(DirName, &StatBuf) || !(D = opendir(DirName))) {
+            UnindexedDirs.push_back(i);
+            continue;
+        }
+        IndexedDirMTimes[i] = GetMTime(StatBuf);
+
+        while (struct dirent *Ent = readdir(D)) {
+            const char *Name = Ent->d_name;
+            IncludeIndex.GetOrCreateValue(Name, Name+strlen(Name))
+                    .getValue().push_back(i);
+        }
+        closedir(D);
+    }
+    IncludeIndexBuilt = true;
+}
+
+/// RevalidateIncludeIndex - Discard the include index if one of the directories
+/// it was built from has been modified since.
+void HeaderSearch::RevalidateIncludeIndex() {
+    if (!IncludeIndexBuilt)
+        return;
+
+    for (unsigned i = 0, e = IndexedDirMTimes.size(); i != e; ++i) {
+        if (IndexedDirMTimes[i] == -1)
+            continue;
+        struct stat StatBuf;
+        if (::stat(SearchDirs[i].getDir()->getName(), &StatBuf) ||
+            GetMTime(StatBuf) != IndexedDirMTimes[i]) {
+            // The cached lookups may name a directory the index would now skip,
+            // or have missed a file that was added.
+            ClearIncludeIndex();
+            LookupFileCache.clear();
+            ++NumIndexRebuilds;
+            return;
+        }
+    }
+}
+
+/// getNextCandidateDir - Return the first index in SearchDirs at or after i that
+/// may hold a file whose name starts with the component that has the specified
+/// index entry, or the size of SearchDirs if there is none.
+unsigned HeaderSearch::getNextCandidateDir(
+        const llvm::SmallVector<unsigned, 2> *Dirs, unsigned i) const {
+    unsigned Next = SearchDirs.size();
+    if (Dirs) {
+        const unsigned *I = std::lower_bound(Dirs->begin(), Dirs->end(), i);
+        if (I != Dirs->end())
+            Next = *I;
+    }
+    std::vector<unsigned>::const_iterator U =
+            std::lower_bound(UnindexedDirs.begin(), UnindexedDirs.end(), i);
+    if (U != UnindexedDirs.end() && *U < Next)
+        Next = *U;
+    return Next;
+}
+
 //===----------------------------------------------------------------------===//
 // Header File Location.
 //===----------------------------------------------------------------------===//
@@ -295,8 +405,30 @@ const FileEntry *HeaderSearch::LookupFile(const char *FilenameStart,
         CacheLookup.first = i+1;
     }
 
+    // With the include index, only the directories holding the first component
+    // of the name are queried, still in order, so #include_next is unaffected.
+    const llvm::SmallVector<unsigned, 2> *IndexedDirs = 0;
+    if (UseIncludeIndex && i != SearchDirs.size()) {
+        if (!IncludeIndexBuilt)
+            BuildIncludeIndex();
+        ++NumIndexLookups;
+        const char *SlashPos = std::find(FilenameStart, FilenameEnd, '/');
+        llvm::StringMap<llvm::SmallVector<unsigned, 2> >::iterator I =
+                IncludeIndex.find(llvm::StringRef(FilenameStart,
+                                                  SlashPos-FilenameStart));
+        if (I != IncludeIndex.end())
+            IndexedDirs = &I->getValue();
+    }
+
     // Check each directory in sequence to see if it contains this file.
     for (; i != SearchDirs.size(); ++i) {
+        if (UseIncludeIndex) {
+            unsigned Next = getNextCandidateDir(IndexedDirs, i);
+            NumIndexDirsSkipped += Next-i;
+            if ((i = Next) == SearchDirs.size())
+                break;
+        }
+
         const FileEntry *FE =
                 SearchDirs[i].LookupFile(FilenameStart, FilenameEnd, *this);
         if (!FE) continue;
@@ -411,6 +543,21 @@ HeaderFileInfo &HeaderSearch::getFileInfo(const FileEntry *FE) {
     return FileInfo[FE->getUID()];
 }
 
+void HeaderSearch::SetGuardCache(HeaderGuardCache *GC) {
+    GuardCache = GC;
+    ExternalLookup = GC;
+}
+
+/// SetFileControllingMacro - Mark the specified file as having a controlling
+/// macro.  This is used by the multiple-include optimization to eliminate
+/// no-op #includes.
+void HeaderSearch::SetFileControllingMacro(const FileEntry *File,
+                                           const IdentifierInfo *ControllingMacro) {
+    getFileInfo(File).ControllingMacro = ControllingMacro;
+    if (GuardCache)
+        GuardCache->SetControllingMacro(File, ControllingMacro);
+}
+
 void HeaderSearch::setHeaderFileInfoForUID(HeaderFileInfo HFI, unsigned UID) {
     if (UID >= FileInfo.size())
         FileInfo.resize(UID+1);
@@ -441,12 +588,19 @@ bool HeaderSearch::ShouldEnterIncludeFile(const FileEntry *File, bool isImport){
             return false;
     }
 
+    // A file not yet entered may still have a guard recorded by an earlier run.
+    if (GuardCache && !FileInfo.NumIncludes && !FileInfo.ControllingMacro &&
+        !FileInfo.ControllingMacroID)
+        FileInfo.ControllingMacroID = GuardCache->getControllingMacroID(File);
+
     // Next, check to see if the file is wrapped with #ifndef guards.  If so, and
     // if the macro that guards it is defined, we know the #include has no effect.
     if (const IdentifierInfo *ControllingMacro
             = FileInfo.getControllingMacro(ExternalLookup))
         if (ControllingMacro->hasMacroDefinition()) {
             ++NumMultiIncludeFileOptzn;
+            if (!FileInfo.NumIncludes)
+                ++NumGuardCacheOptzn;
             return false;
         }
 
@@ -11,7 +11,9 @@
 #ifndef CPTOYC_HEADERSEARCH_H
 #define CPTOYC_HEADERSEARCH_H
 #include "Lex/DirectoryLookup.h"
+#include "llvm/SmallVector.h"
 #include "llvm/StringMap.h"
+#include <stdint.h>
 #include <vector>
 #include "FileManager.h"
 
@@ -19,6 +21,7 @@ namespace CPToyC {
     namespace Compiler {
 
         class ExternalIdentifierLookup;
+        class HeaderGuardCache;
         class FileEntry;
         class FileManager;
         class IdentifierInfo;
@@ -93,6 +96,26 @@ namespace CPToyC {
             /// query.
             llvm::StringMap<std::pair<unsigned, unsigned> > LookupFileCache;
 
+            /// UseIncludeIndex - If true, each normal directory in SearchDirs is read
+            /// once, and LookupFile only queries the directories that have an entry
+            /// named like the first component of the #include'd name.
+            bool UseIncludeIndex;
+
+            /// IncludeIndexBuilt - True once the directories have been read.  The
+            /// index is built on the first lookup that needs it.
+            bool IncludeIndexBuilt;
+
+            /// IncludeIndex - Map from a name in some search directory to the indices
+            /// in SearchDirs of the directories holding it, in ascending order.
+            llvm::StringMap<llvm::SmallVector<unsigned, 2> > IncludeIndex;
+
+            /// UnindexedDirs - The indices in SearchDirs of the frameworks, header
+            /// maps and unreadable directories.  These are always queried.
+            std::vector<unsigned> UnindexedDirs;
+
+            /// IndexedDirMTimes - The modification time of each directory in
+            /// SearchDirs when it was read, or -1 if it is not indexed.
+            std::vector<int64_t> IndexedDirMTimes;
 
             /// FrameworkMap - This is a collection mapping a framework or subframework
             /// name like "Carbon" to the Carbon.framework directory.
@@ -106,10 +129,14 @@ namespace CPToyC {
             /// macros into IdentifierInfo pointers, as needed.
             ExternalIdentifierLookup *ExternalLookup;
 
+            /// GuardCache - Controlling macros recorded by earlier runs, if any.
+            HeaderGuardCache *GuardCache;
+
             // Various statistics we track for performance analysis.
             unsigned NumIncluded;
-            unsigned NumMultiIncludeFileOptzn;
+            unsigned NumMultiIncludeFileOptzn, NumGuardCacheOptzn;
             unsigned NumFrameworkLookups, NumSubFrameworkLookups;
+            unsigned NumIndexLookups, NumIndexDirsSkipped, NumIndexRebuilds;
 
             // HeaderSearch doesn't support default or copy construction.
             explicit HeaderSearch();
@@ -128,8 +155,23 @@ namespace CPToyC {
                 SearchDirs = dirs;
                 SystemDirIdx = systemDirIdx;
                 NoCurDirSearch = noCurDirSearch;
+                ClearIncludeIndex();
             }
 
+            /// SetUseIncludeIndex - Resolve #includes through an index of the names in
+            /// the search directories instead of trying each directory in turn.
+            void SetUseIncludeIndex(bool Use) {
+                UseIncludeIndex = Use;
+                ClearIncludeIndex();
+            }
+
+            /// RevalidateIncludeIndex - Discard the include index if one of the
+            /// directories it was built from has been modified since, along with
+            /// the lookups made through it.  The directories are assumed not to
+            /// change while a translation unit is preprocessed, so this is called
+            /// between them.
+            void RevalidateIncludeIndex();
+
             /// ClearFileInfo - Forget everything we know about headers so far.
             void ClearFileInfo() {
                 FileInfo.clear();
@@ -139,6 +181,11 @@ namespace CPToyC {
                 ExternalLookup = EIL;
             }
 
+            /// SetGuardCache - Consult and update the specified persistent include
+            /// guard cache.  The cache also resolves the controlling macros it hands
+            /// out, so it becomes the external lookup.
+            void SetGuardCache(HeaderGuardCache *GC);
+
             /// LookupFile - Given a "foo" or <foo> reference, look up the indicated file,
             /// return null on failure.  isAngled indicates whether the file reference is
             /// a <> reference.  If successful, this returns 'UsedDir', the
@@ -211,9 +258,7 @@ namespace CPToyC {
             /// macro.  This is used by the multiple-include optimization to eliminate
             /// no-op #includes.
             void SetFileControllingMacro(const FileEntry *File,
-                                         const IdentifierInfo *ControllingMacro) {
-                getFileInfo(File).ControllingMacro = ControllingMacro;
-            }
+                                         const IdentifierInfo *ControllingMacro);
 
             /// CreateHeaderMap - This method returns a HeaderMap for the specified
             /// FileEntry, uniquing them through the the 'HeaderMaps' datastructure.
@@ -230,6 +275,18 @@ namespace CPToyC {
 
             void PrintStats();
         private:
+            /// BuildIncludeIndex - Read the names in each normal directory in
+            /// SearchDirs.
+            void BuildIncludeIndex();
+
+            void ClearIncludeIndex();
+
+            /// getNextCandidateDir - Return the first index in SearchDirs at or after
+            /// i that may hold a file whose name starts with the component that has
+            /// the specified index entry (null if no directory has it), or the size
+            /// of SearchDirs if there is none.
+            unsigned getNextCandidateDir(const llvm::SmallVector<unsigned, 2> *Dirs,
+                                         unsigned i) const;
 
             /// getFileInfo - Return the HeaderFileInfo structure for the specified
             /// FileEntry.
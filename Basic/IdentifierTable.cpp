@@ -26,7 +26,9 @@ IdentifierInfo::IdentifierInfo() {
     IsExtension = false;
     IsPoisoned = false;
     NeedsHandleIdentifier = false;
+    PPKeywordID = tok::pp_not_keyword;
     FETokenInfo = nullptr;
+    Macro = nullptr;
     Entry = nullptr;
 }
 //===----------------------------------------------------------------------===//
@@ -50,19 +52,6 @@ IdentifierTable::IdentifierTable(const LangOptions &LangOpts, IdentifierInfoLook
 // Language Keyword Implementation
 //===----------------------------------------------------------------------===//
 
-// Constants for TokenKinds.def
-namespace {
-    enum {
-        KEYALL = 1,
-        KEYC99 = 2,
-        KEYCXX = 4,
-        KEYCXX0X = 8,
-        KEYGNU = 16,
-        KEYMS = 32,
-        BOOLSUPPORT = 64
-    };
-}
-
 /// AddKeyword - This method is used to associate a token ID with specific
 /// identifiers because they are language keywords.  This causes the lexer to
 /// automatically map matching identifiers to specialized token codes.
@@ -71,78 +60,40 @@ namespace {
 /// enabled in the specified langauge, set to 1 if it is an extension
 /// in the specified language, and set to 2 if disabled in the
 /// specified language.
-static void AddKeyword(const char *Keyword, unsigned KWLen,
-                       tok::TokenKind TokenCode, unsigned Flags, const LangOptions &LangOpts, IdentifierTable &Table) {
+static void AddKeyword(IdentifierInfo &Info, const tok::KeywordSpelling &KS,
+                       const LangOptions &LangOpts) {
+    if (KS.TokenID == tok::identifier) return;
+
+    unsigned Flags = KS.Flags;
     unsigned AddResult = 0;
-    if (Flags & KEYALL) AddResult = 2;
-    else if (LangOpts.CPlusPlus && (Flags & KEYCXX)) AddResult = 2;
-    else if (LangOpts.CPlusPlus0x && (Flags & KEYCXX0X)) AddResult = 2;
-    else if (LangOpts.C99 && (Flags & KEYC99)) AddResult = 2;
-    else if (LangOpts.GNUMode && (Flags & KEYGNU)) AddResult = 1;
-    else if (LangOpts.Microsoft && (Flags & KEYMS)) AddResult = 1;
-    else if (LangOpts.Bool && (Flags & BOOLSUPPORT)) AddResult = 2;
+    if (Flags & tok::KEYALL) AddResult = 2;
+    else if (LangOpts.CPlusPlus && (Flags & tok::KEYCXX)) AddResult = 2;
+    else if (LangOpts.CPlusPlus0x && (Flags & tok::KEYCXX0X)) AddResult = 2;
+    else if (LangOpts.C99 && (Flags & tok::KEYC99)) AddResult = 2;
+    else if (LangOpts.GNUMode && (Flags & tok::KEYGNU)) AddResult = 1;
+    else if (LangOpts.Microsoft && (Flags & tok::KEYMS)) AddResult = 1;
+    else if (LangOpts.Bool && (Flags & tok::BOOLSUPPORT)) AddResult = 2;
 
     // AddResult == 1 表示扩展字段
     // Don't add this keyword if disabled in this language.
     if (AddResult == 0) return;
-    IdentifierInfo &Info = Table.get(Keyword, Keyword+KWLen);
-    Info.setTokenID(TokenCode);
+    Info.setTokenID((tok::TokenKind)KS.TokenID);
 }
 
-/// AddKeywords - Add all keywords to the symbol table.
-///
+/// AddKeywords - Add all keywords to the symbol table.  Every spelling of the
+/// keyword hash gets its IdentifierInfo now, even if it is not a keyword of
+/// the current language, so that get() never has to fall back to the general
+/// table for one.
 void IdentifierTable::AddKeywords(const LangOptions &LangOpts) {
-    // Add keywords and tokens for the current language.
-#define KEYWORD(NAME, FLAGS) \
-  AddKeyword(#NAME, strlen(#NAME), tok::kw_ ## NAME,  \
-             FLAGS, LangOpts, *this);
-#include "TokenKinds.def"
-}
-
-tok::PPKeywordKind IdentifierInfo::getPPKeywordID() const {
-    // We use a perfect hash function here involving the length of the keyword,
-    // the first and third character.  For preprocessor ID's there are no
-    // collisions (if there were, the switch below would complain about duplicate
-    // case values).  Note that this depends on 'if' being null terminated.
-
-#define HASH(LEN, FIRST, THIRD) \
-  (LEN << 5) + (((FIRST-'a') + (THIRD-'a')) & 31)
-#define CASE(LEN, FIRST, THIRD, NAME) \
-  case HASH(LEN, FIRST, THIRD): \
-    return memcmp(Name, #NAME, LEN) ? tok::pp_not_keyword : tok::pp_ ## NAME
-
-    unsigned Len = getLength();
-    if (Len < 2) return tok::pp_not_keyword;
-    const char *Name = getName();
-    switch (HASH(Len, Name[0], Name[2])) {
-        default: return tok::pp_not_keyword;
-        CASE( 2, 'i', '\0', if);
-        CASE( 4, 'e', 'i', elif);
-        CASE( 4, 'e', 's', else);
-        CASE( 4, 'l', 'n', line);
-        CASE( 4, 's', 'c', sccs);
-        CASE( 5, 'e', 'd', endif);
-        CASE( 5, 'e', 'r', error);
-        CASE( 5, 'i', 'e', ident);
-        CASE( 5, 'i', 'd', ifdef);
-        CASE( 5, 'u', 'd', undef);
-
-        CASE( 6, 'a', 's', assert);
-        CASE( 6, 'd', 'f', define);
-        CASE( 6, 'i', 'n', ifndef);
-        CASE( 6, 'i', 'p', import);
-        CASE( 6, 'p', 'a', pragma);
-
-        CASE( 7, 'd', 'f', defined);
-        CASE( 7, 'i', 'c', include);
-        CASE( 7, 'w', 'r', warning);
-
-        CASE( 8, 'u', 'a', unassert);
-        CASE(12, 'i', 'c', include_next);
-
-        CASE(16, '_', 'i', __include_macros);
-#undef CASE
-#undef HASH
+    KeywordInfos[0] = nullptr;
+    for (unsigned i = 1; i <= tok::NumKeywordSpellings; ++i) {
+        const tok::KeywordSpelling &KS = tok::getKeywordSpelling(i);
+        IdentifierInfo &Info = getFromHashTable(
+                KS.Name, KS.Name+KS.Length,
+                llvm::HashString(KS.Name, KS.Name+KS.Length));
+        Info.PPKeywordID = KS.PPKeywordID;
+        AddKeyword(Info, KS, LangOpts);
+        KeywordInfos[i] = &Info;
     }
 }
 
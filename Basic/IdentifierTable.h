@@ -16,6 +16,7 @@
 #include "llvm/OwningPtr.h"
 #include "llvm/PointerLikeTypeTraits.h"
 #include "TokenKinds.h"
+#include "KeywordHash.h"
 #include <string>
 #include <cassert>
 
@@ -28,6 +29,7 @@ namespace CPToyC {
         class LangOptions;
         class IdentifierInfo;
         class IdentifierTable;
+        class MacroInfo;
         class SourceLocation;
 
         /// IdentifierLocPair - A simple pair of identifier info and location.
@@ -39,10 +41,17 @@ namespace CPToyC {
             bool IsExtension            : 1;        // True if identifier is a lang extension.
             bool IsPoisoned             : 1;        // True if identifier is poisoned.
             bool NeedsHandleIdentifier  : 1;        // See "RecomputeNeedsHandleIdentifier".
+            unsigned PPKeywordID        : 5;        // tok::pp_not_keyword
             void *FETokenInfo;                      // language front-end
+            MacroInfo *Macro;                       // The #define for this, if any.
 
             llvm::StringMapEntry<IdentifierInfo*> *Entry;
 
+            static_assert(tok::NUM_TOKENS <= (1 << 8),
+                          "TokenID is too narrow for the token kinds");
+            static_assert(tok::NUM_PP_KEYWORDS <= (1 << 5),
+                          "PPKeywordID is too narrow for the preprocessor keywords");
+
             IdentifierInfo(const IdentifierInfo&) = delete;  // NONCOPYABLE.
             void operator=(const IdentifierInfo&) = delete;  // NONASSIGNABLE.
 
@@ -90,7 +99,14 @@ namespace CPToyC {
             bool hasMacroDefinition() const {
                 return HasMacro;
             }
-            void setHasMacroDefinition(bool Val) {
+
+            /// getMacroInfo/setMacroInfo - The macro this identifier is #defined to,
+            /// or null.  It is kept here so that the preprocessor finds it without
+            /// a hash table lookup; only the Preprocessor should set it.
+            MacroInfo *getMacroInfo() const { return Macro; }
+            void setMacroInfo(MacroInfo *MI) {
+                Macro = MI;
+                bool Val = MI != nullptr;
                 if (HasMacro == Val) return;
 
                 HasMacro = Val;
@@ -107,8 +123,11 @@ namespace CPToyC {
             void setTokenID(tok::TokenKind ID) { TokenID = ID; }
 
             /// getPPKeywordID - Return the preprocessor keyword ID for this identifier.
-            /// For example, "define" will return tok::pp_define.
-            tok::PPKeywordKind getPPKeywordID() const;
+            /// For example, "define" will return tok::pp_define.  It is set when the
+            /// IdentifierTable pre-builds the keywords.
+            tok::PPKeywordKind getPPKeywordID() const {
+                return (tok::PPKeywordKind)PPKeywordID;
+            }
 
             /// get/setExtension - Initialize information about whether or not this
             /// language token is an extension.  This controls extension warnings, and is
@@ -196,23 +215,18 @@ namespace CPToyC {
 
             IdentifierInfoLookup* ExternalLookup;
 
-        public:
-            IdentifierTable(const LangOptions &LangOpts, IdentifierInfoLookup *externalLookup = nullptr);
-
-            /// \brief Set the external identifier lookup mechanism.
-            void setExternalIdentifierLookup(IdentifierInfoLookup *IILookup) {
-                ExternalLookup = IILookup;
-            }
+            /// KeywordInfos - The IdentifierInfo of every keyword spelling, by
+            /// tok::getKeywordIndex.  They are all built up front by AddKeywords.
+            IdentifierInfo *KeywordInfos[tok::NumKeywordSpellings+1];
 
-            llvm::BumpPtrAllocator& getAllocator() {
-                return HashTable.getAllocator();
-            }
-
-            /// get - Return the identifier token info for the specified named identifier.
-            ///
-            IdentifierInfo &get(const char *NameStart, const char *NameEnd) {
+            /// getFromHashTable - Look up or create the IdentifierInfo for the
+            /// specified name, whose llvm::HashString is FullHash, in the general
+            /// table.
+            IdentifierInfo &getFromHashTable(const char *NameStart, const char *NameEnd,
+                                             unsigned FullHash) {
                 llvm::StringMapEntry<IdentifierInfo*> &Entry =
-                        HashTable.GetOrCreateValue(NameStart, NameEnd);
+                        HashTable.GetOrCreateValueWithHash(
+                                llvm::StringRef(NameStart, NameEnd-NameStart), FullHash);
 
                 IdentifierInfo *II = Entry.getValue();
                 if (II) return *II;
@@ -239,6 +253,38 @@ namespace CPToyC {
                 return *II;
             }
 
+        public:
+            IdentifierTable(const LangOptions &LangOpts, IdentifierInfoLookup *externalLookup = nullptr);
+
+            /// \brief Set the external identifier lookup mechanism.
+            void setExternalIdentifierLookup(IdentifierInfoLookup *IILookup) {
+                ExternalLookup = IILookup;
+            }
+
+            llvm::BumpPtrAllocator& getAllocator() {
+                return HashTable.getAllocator();
+            }
+
+            /// get - Return the identifier token info for the specified named identifier.
+            /// Keywords are found with one probe of their perfect hash, without
+            /// hashing the name for the general table.
+            IdentifierInfo &get(const char *NameStart, const char *NameEnd) {
+                if (unsigned KW = tok::getKeywordIndex(NameStart, NameEnd-NameStart))
+                    return *KeywordInfos[KW];
+                return getFromHashTable(NameStart, NameEnd,
+                                        llvm::HashString(NameStart, NameEnd));
+            }
+
+            /// get - Like the above, for a caller that has already computed the
+            /// llvm::HashString of the name, as the lexer does while the name is
+            /// in cache.
+            IdentifierInfo &get(const char *NameStart, const char *NameEnd,
+                                unsigned FullHash) {
+                if (unsigned KW = tok::getKeywordIndex(NameStart, NameEnd-NameStart))
+                    return *KeywordInfos[KW];
+                return getFromHashTable(NameStart, NameEnd, FullHash);
+            }
+
             /// \brief Creates a new IdentifierInfo from the given string.
             ///
             /// This is a lower-level version of get() that requires that this
@@ -287,8 +333,8 @@ namespace CPToyC {
             /// hashing is doing.
             void PrintStats() const;
 
-            /// PrintStats - Print some statistics to stderr that indicate how well the
-            /// hashing is doing.
+            /// AddKeywords - Build the IdentifierInfo of every keyword and
+            /// preprocessor keyword, marking those of the current language.
             void AddKeywords(const LangOptions &LangOpts);
         };
     }
@@ -0,0 +1,183 @@
+/**********************************
+* File:     KeywordHash.h
+*
+* Author:   agent
+*
+* Email:    agent@local
+*
+* Date:     2026/10/17
+***********************************/
+
+#ifndef CPTOYC_KEYWORDHASH_H
+#define CPTOYC_KEYWORDHASH_H
+
+#include "TokenKinds.h"
+#include <cstring>
+#include <stdint.h>
+
+namespace CPToyC {
+    namespace Compiler {
+        namespace tok {
+            /// Flags for the KEYWORD entries of TokenKinds.def.
+            enum KeywordFlags {
+                KEYALL = 1,
+                KEYC99 = 2,
+                KEYCXX = 4,
+                KEYCXX0X = 8,
+                KEYGNU = 16,
+                KEYMS = 32,
+                BOOLSUPPORT = 64
+            };
+
+            /// KeywordSpelling - A spelling that is a language keyword, a
+            /// preprocessor keyword or both (like "if").
+            struct KeywordSpelling {
+                const char *Name;
+                unsigned char Length;
+                unsigned char TokenID;      // tok::identifier if not a keyword.
+                unsigned char Flags;        // KeywordFlags of the keyword.
+                unsigned char PPKeywordID;  // tok::pp_not_keyword if not one.
+            };
+
+            static_assert(tok::NUM_TOKENS <= 256 && tok::NUM_PP_KEYWORDS <= 256,
+                          "KeywordSpelling is too narrow for the token kinds");
+
+            namespace keywordhash {
+                enum {
+                    HashBits = 8,
+                    NumSlots = 1 << HashBits
+                };
+
+                /// Entries - Every KEYWORD and PPKEYWORD, in TokenKinds.def
+                /// order.  Spellings that are both appear twice.
+                constexpr KeywordSpelling Entries[] = {
+#define KEYWORD(NAME, FLAGS) \
+  { #NAME, 0, tok::kw_ ## NAME, FLAGS, tok::pp_not_keyword },
+#define PPKEYWORD(NAME) \
+  { #NAME, 0, tok::identifier, 0, tok::pp_ ## NAME },
+#include "TokenKinds.def"
+                };
+                enum { NumEntries = sizeof(Entries) / sizeof(Entries[0]) };
+
+                /// Hash - Hash a spelling of at least two characters by its
+                /// length and its first, second and last characters.
+                constexpr unsigned Hash(const char *Name, unsigned Len,
+                                        uint32_t Seed) {
+                    uint32_t H = Seed;
+                    H = (H ^ (unsigned char)Name[0]) * 0x01000193u;
+                    H = (H ^ (unsigned char)Name[1]) * 0x01000193u;
+                    H = (H ^ (unsigned char)Name[Len-1]) * 0x01000193u;
+                    H = (H ^ Len) * 0x01000193u;
+                    return H >> (32 - HashBits);
+                }
+
+                constexpr unsigned Length(const char *Name) {
+                    unsigned Len = 0;
+                    while (Name[Len]) ++Len;
+                    return Len;
+                }
+
+                constexpr bool Equal(const char *LHS, const char *RHS) {
+                    for (; *LHS == *RHS; ++LHS, ++RHS)
+                        if (!*LHS) return true;
+                    return false;
+                }
+
+                /// Table - The distinct spellings and the slots they hash to.
+                /// Spellings[0] is unused so that a zero slot means empty.
+                struct Table {
+                    KeywordSpelling Spellings[NumEntries+1];
+                    unsigned char Slots[NumSlots];
+                    unsigned NumSpellings;
+                    unsigned MaxLength;
+                    uint32_t Seed;  // 0 if no perfect hash was found.
+                };
+
+                /// BuildTable - Merge the entries by spelling, then search for
+                /// a seed under which no two spellings share a slot.
+                constexpr Table BuildTable() {
+                    Table T{};
+                    T.NumSpellings = 0;
+                    T.MaxLength = 0;
+                    for (unsigned i = 0; i != NumEntries; ++i) {
+                        const KeywordSpelling &E = Entries[i];
+                        if (E.PPKeywordID == tok::pp_not_keyword &&
+                            E.TokenID == tok::identifier)
+                            continue;  // PPKEYWORD(not_keyword)
+
+                        unsigned j = 1;
+                        while (j <= T.NumSpellings &&
+                               !Equal(T.Spellings[j].Name, E.Name))
+                            ++j;
+                        if (j > T.NumSpellings) {
+                            T.NumSpellings = j;
+                            T.Spellings[j] = E;
+                            T.Spellings[j].Length = Length(E.Name);
+                            if (T.Spellings[j].Length > T.MaxLength)
+                                T.MaxLength = T.Spellings[j].Length;
+                        } else if (E.TokenID != tok::identifier) {
+                            T.Spellings[j].TokenID = E.TokenID;
+                            T.Spellings[j].Flags = E.Flags;
+                        } else {
+                            T.Spellings[j].PPKeywordID = E.PPKeywordID;
+                        }
+                    }
+
+                    for (uint32_t Seed = 1; Seed != 1 << 16; ++Seed) {
+                        for (unsigned s = 0; s != NumSlots; ++s)
+                            T.Slots[s] = 0;
+                        unsigned i = 1;
+                        for (; i <= T.NumSpellings; ++i) {
+                            const KeywordSpelling &KS = T.Spellings[i];
+                            unsigned Slot = Hash(KS.Name, KS.Length, Seed);
+                            if (T.Slots[Slot]) break;
+                            T.Slots[Slot] = i;
+                        }
+                        if (i > T.NumSpellings) {
+                            T.Seed = Seed;
+                            return T;
+                        }
+                    }
+                    T.Seed = 0;
+                    return T;
+                }
+
+                inline constexpr Table KeywordTable = BuildTable();
+                static_assert(KeywordTable.Seed != 0,
+                              "no perfect hash for the keywords of TokenKinds.def");
+                static_assert(KeywordTable.NumSpellings < NumSlots,
+                              "too many keywords for the keyword hash");
+            }
+
+            enum { NumKeywordSpellings = keywordhash::KeywordTable.NumSpellings };
+
+            /// getKeywordIndex - Return the index, from 1 to NumKeywordSpellings,
+            /// of the keyword spelled by [Name, Name+Len), or 0 if it isn't one.
+            /// This takes a single probe of a perfect hash.
+            inline unsigned getKeywordIndex(const char *Name, unsigned Len) {
+                using namespace keywordhash;
+                if (Len < 2 || Len > KeywordTable.MaxLength)
+                    return 0;
+                unsigned Idx = KeywordTable.Slots[Hash(Name, Len, KeywordTable.Seed)];
+                const KeywordSpelling &KS = KeywordTable.Spellings[Idx];
+                if (!Idx || KS.Length != Len || memcmp(KS.Name, Name, Len))
+                    return 0;
+                return Idx;
+            }
+
+            /// getKeywordSpelling - Return the keyword with the specified index.
+            inline const KeywordSpelling &getKeywordSpelling(unsigned Idx) {
+                return keywordhash::KeywordTable.Spellings[Idx];
+            }
+
+            /// getPPKeywordID - Classify a directive name spelled by
+            /// [Name, Name+Len) without looking up its IdentifierInfo.
+            inline PPKeywordKind getPPKeywordID(const char *Name, unsigned Len) {
+                unsigned Idx = getKeywordIndex(Name, Len);
+                return (PPKeywordKind)keywordhash::KeywordTable.Spellings[Idx].PPKeywordID;
+            }
+        }
+    }
+}
+
+#endif //CPTOYC_KEYWORDHASH_H
@@ -13,6 +13,7 @@
 
 #include <utility>
 #include <cassert>
+#include <stdint.h>
 #include "llvm/MemoryBuffer.h"
 
 namespace CPToyC {
@@ -52,12 +53,22 @@ namespace CPToyC {
         /// SourceLocation - This is a carefully crafted 32-bit identifier that encodes
         /// a full include stack, line and column number information for a position in
         /// an input translation unit.
+        ///
+        /// A build configured with CPTOYC_64BIT_SOURCE_LOCATIONS uses 64-bit
+        /// identifiers instead, for translation units that need more than the 2GB of
+        /// location space the 32-bit encoding leaves after the macro bit.
         class SourceLocation {
-            unsigned ID;
+        public:
+            /// UIntTy - The integer type of the encoding.
+#ifdef CPTOYC_64BIT_SOURCE_LOCATIONS
+            typedef uint64_t UIntTy;
+#else
+            typedef uint32_t UIntTy;
+#endif
+        private:
+            UIntTy ID;
             friend class SourceManager;
-            enum {
-                MacroIDBit = 1U << 31
-            };
+            static const UIntTy MacroIDBit = UIntTy(1) << (8*sizeof(UIntTy)-1);
         public:
 
             SourceLocation() : ID(0) {}  // 0 is an invalid FileID.
@@ -75,18 +86,18 @@ namespace CPToyC {
         private:
             /// getOffset - Return the index for SourceManager's SLocEntryTable table,
             /// note that this is not an index *into* it though.
-            unsigned getOffset() const {
+            UIntTy getOffset() const {
                 return ID & ~MacroIDBit;
             }
 
-            static SourceLocation getFileLoc(unsigned ID) {
+            static SourceLocation getFileLoc(UIntTy ID) {
                 assert((ID & MacroIDBit) == 0 && "Ran out of source locations!");
                 SourceLocation L;
                 L.ID = ID;
                 return L;
             }
 
-            static SourceLocation getMacroLoc(unsigned ID) {
+            static SourceLocation getMacroLoc(UIntTy ID) {
                 assert((ID & MacroIDBit) == 0 && "Ran out of source locations!");
                 SourceLocation L;
                 L.ID = MacroIDBit | ID;
@@ -104,15 +115,15 @@ namespace CPToyC {
             }
 
             /// getRawEncoding - When a SourceLocation itself cannot be used, this returns
-            /// an (opaque) 32-bit integer encoding for it.  This should only be passed
-            /// to SourceLocation::getFromRawEncoding, it should not be inspected
+            /// an (opaque) integer encoding for it.  This should only be passed to
+            /// SourceLocation::getFromRawEncoding, it should not be inspected
             /// directly.
-            unsigned getRawEncoding() const { return ID; }
+            UIntTy getRawEncoding() const { return ID; }
 
 
             /// getFromRawEncoding - Turn a raw encoding of a SourceLocation object into
             /// a real SourceLocation.
-            static SourceLocation getFromRawEncoding(unsigned Encoding) {
+            static SourceLocation getFromRawEncoding(UIntTy Encoding) {
                 SourceLocation X;
                 X.ID = Encoding;
                 return X;
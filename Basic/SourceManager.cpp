@@ -10,7 +10,18 @@
 
 #include "SourceManager.h"
 #include "FileManager.h"
+#include "FileContentStore.h"
+#include <algorithm>
 #include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define SOURCEMANAGER_HAVE_X86_KERNELS 1
+#else
+#define SOURCEMANAGER_HAVE_X86_KERNELS 0
+#endif
 
 using namespace CPToyC::Compiler;
 
@@ -19,7 +30,10 @@ using namespace CPToyC::Compiler;
 //===----------------------------------------------------------------------===//
 
 ContentCache::~ContentCache() {
-    delete Buffer;
+    if (!Store) {
+        delete Buffer;
+        delete Directives;
+    }
 }
 
 /// getSizeBytesMapped - Returns the number of bytes actually mapped for
@@ -42,7 +56,10 @@ const MemoryBuffer *ContentCache::getBuffer() const {
     if (!Buffer && Entry) {
         // FIXME: Should we support a way to not have to do this check over
         //   and over if we cannot open the file?
-        Buffer = MemoryBuffer::getFile(Entry->getName(), 0, Entry->getSize());
+        if (Store)
+            Buffer = Store->getBuffer(Entry);
+        else
+            Buffer = MemoryBuffer::getFile(Entry->getName(), 0, Entry->getSize());
     }
     return Buffer;
 }
@@ -249,6 +266,8 @@ SourceManager::~SourceManager() {
 void SourceManager::clearIDTables() {
     MainFileID = FileID();
     SLocEntryTable.clear();
+    SLocEntryOffsets.clear();
+    SLocBlockOffsets.clear();
     LastLineNoFileIDQuery = FileID();
     LastLineNoContentCache = 0;
     LastFileIDLookup = FileID();
@@ -256,6 +275,16 @@ void SourceManager::clearIDTables() {
     if (LineTable)
         LineTable->clear();
 
+    // Memory buffers (predefines, scratch space) belong to the translation unit
+    // being forgotten.  File contents stay cached for the next one, but their
+    // FileIDs are gone with the SLocEntryTable.
+    for (unsigned i = 0, e = MemBufferInfos.size(); i != e; ++i)
+        delete MemBufferInfos[i];
+    MemBufferInfos.clear();
+    for (llvm::DenseMap<const FileEntry*, ContentCache*>::iterator
+                 I = FileInfos.begin(), E = FileInfos.end(); I != E; ++I)
+        I->second->FirstFID = FileID();
+
     // Use up FileID #0 as an invalid instantiation.
     NextOffset = 0;
     createInstantiationLoc(SourceLocation(),SourceLocation(),SourceLocation(), 1);
@@ -276,7 +305,7 @@ SourceManager::getOrCreateContentCache(const FileEntry *FileEnt) {
     // so that FileInfo can use the low 3 bits of the pointer for its own
     // nefarious purposes.
 
-    FileInfos.insert(std::make_pair(FileEnt, new ContentCache(FileEnt)));
+    FileInfos.insert(std::make_pair(FileEnt, new ContentCache(FileEnt, Contents)));
     return FileInfos[FileEnt];
 }
 
@@ -290,13 +319,25 @@ SourceManager::createMemBufferContentCache(const MemoryBuffer *Buffer) {
     // the pointer for its own nefarious purposes.
     auto Entry = new ContentCache();
     MemBufferInfos.push_back(Entry);
+
+    // The lexer relies on MemoryBuffer::TailPadding after every buffer it scans.
+    // A buffer wrapping client memory doesn't have it, so take a padded copy and
+    // drop the original, which we own from here on.
+    if (!Buffer->hasTailPadding()) {
+        const MemoryBuffer *Copy =
+            MemoryBuffer::getMemBufferCopy(Buffer->getBufferStart(),
+                                           Buffer->getBufferEnd(),
+                                           Buffer->getBufferIdentifier());
+        delete Buffer;
+        Buffer = Copy;
+    }
     Entry->setBuffer(Buffer);
     return Entry;
 }
 
 void SourceManager::PreallocateSLocEntries(ExternalSLocEntrySource *Source,
                                            unsigned NumSLocEntries,
-                                           unsigned NextOffset) {
+                                           SourceLocation::UIntTy NextOffset) {
     ExternalSLocEntries = Source;
     this->NextOffset = NextOffset;
     SLocEntryLoaded.resize(NumSLocEntries + 1);
@@ -318,6 +359,13 @@ void SourceManager::ClearPreallocatedSLocEntries() {
     SLocEntryTable.resize(I);
     SLocEntryLoaded.clear();
     ExternalSLocEntries = 0;
+
+    // The offsets of the remaining entries are all known now: index them.
+    SLocEntryOffsets.clear();
+    SLocBlockOffsets.clear();
+    for (unsigned i = 0; i != I; ++i)
+        addSLocEntryOffset(SLocEntryTable[i].getOffset(),
+                           SLocEntryTable[i].isInstantiation());
 }
 
 
@@ -332,7 +380,7 @@ FileID SourceManager::createFileID(const ContentCache *File,
                                    SourceLocation IncludePos,
                                    CharacteristicKind FileCharacter,
                                    unsigned PreallocatedID,
-                                   unsigned Offset) {
+                                   SourceLocation::UIntTy Offset) {
     if (PreallocatedID) {
         // If we're filling in a preallocated ID, just load in the file
         // entry and return.
@@ -353,6 +401,7 @@ FileID SourceManager::createFileID(const ContentCache *File,
     SLocEntryTable.push_back(SLocEntry::get(NextOffset,
                                             FileInfo::get(IncludePos, File,
                                                           FileCharacter)));
+    addSLocEntryOffset(NextOffset, false);
     unsigned FileSize = File->getSize();
     assert(NextOffset+FileSize+1 > NextOffset && "Ran out of source locations!");
     NextOffset += FileSize+1;
@@ -373,7 +422,7 @@ SourceLocation SourceManager::createInstantiationLoc(SourceLocation SpellingLoc,
                                                      SourceLocation ILocEnd,
                                                      unsigned TokLength,
                                                      unsigned PreallocatedID,
-                                                     unsigned Offset) {
+                                                     SourceLocation::UIntTy Offset) {
     InstantiationInfo II = InstantiationInfo::get(ILocStart,ILocEnd, SpellingLoc);
     if (PreallocatedID) {
         // If we're filling in a preallocated ID, just load in the
@@ -388,6 +437,7 @@ SourceLocation SourceManager::createInstantiationLoc(SourceLocation SpellingLoc,
         return SourceLocation::getMacroLoc(Offset);
     }
     SLocEntryTable.push_back(SLocEntry::get(NextOffset, II));
+    addSLocEntryOffset(NextOffset, true);
     assert(NextOffset+TokLength+1 > NextOffset && "Ran out of source locations!");
     NextOffset += TokLength+1;
     return SourceLocation::getMacroLoc(NextOffset-(TokLength+1));
@@ -409,11 +459,78 @@ SourceManager::getBufferData(FileID FID) const {
 /// getFileIDSlow - Return the FileID for a SourceLocation.  This is a very hot
 /// method that is used for all SourceManager queries that start with a
 /// SourceLocation object.  It is responsible for finding the entry in
-/// SLocEntryTable which contains the specified location.
+/// SLocEntryTable which contains the specified location, which it does by
+/// searching SLocEntryOffsets.
 ///
-FileID SourceManager::getFileIDSlow(unsigned SLocOffset) const {
+FileID SourceManager::getFileIDSlow(SourceLocation::UIntTy SLocOffset) const {
     assert(SLocOffset && "Invalid FileID");
 
+    // Entries loaded lazily from an external source have no offsets until they
+    // are read in: search the entries, loading them as we go.
+    if (ExternalSLocEntries)
+        return getFileIDLoaded(SLocOffset);
+
+    // The same strategy as getFileIDLoaded, on the dense array of offsets: a
+    // linear scan of up to 8 entries down from the cached file, then a search
+    // of the block index and a scan of a single block.  An entry starts at or
+    // before SLocOffset iff its encoded offset is at most Key, whatever its
+    // instantiation bit.
+    const SourceLocation::UIntTy *Offsets = &SLocEntryOffsets[0];
+    SourceLocation::UIntTy Key = SLocOffset << 1 | 1;
+    unsigned I;
+    if ((Offsets[LastFileIDLookup.ID] >> 1) < SLocOffset)
+        I = SLocEntryOffsets.size();
+    else
+        I = LastFileIDLookup.ID;
+
+    unsigned NumProbes = 0;
+    while (1) {
+        --I;
+        if (Offsets[I] <= Key) {
+            FileID Res = FileID::get(I);
+
+            // If this isn't an instantiation, remember it.  We have good locality
+            // across FileID lookups.
+            if (!(Offsets[I] & 1))
+                LastFileIDLookup = Res;
+            NumLinearScans += NumProbes+1;
+            return Res;
+        }
+        if (++NumProbes == 8)
+            break;
+    }
+
+    // Entry I starts after SLocOffset, so the entry we want is below it.  Find
+    // the last block that starts at or before SLocOffset.  Block 0 starts at
+    // offset 0, so it always qualifies.
+    unsigned LessBlock = 0, GreaterBlock = (I-1)/SLocBlockSize+1;
+    NumProbes = 0;
+    while (GreaterBlock-LessBlock > 1) {
+        unsigned MiddleBlock = (GreaterBlock-LessBlock)/2+LessBlock;
+        ++NumProbes;
+        if (SLocBlockOffsets[MiddleBlock] <= SLocOffset)
+            LessBlock = MiddleBlock;
+        else
+            GreaterBlock = MiddleBlock;
+    }
+
+    // Then the last entry of the block that starts at or before SLocOffset.
+    unsigned Index = LessBlock*SLocBlockSize;
+    unsigned End = std::min(Index+SLocBlockSize, I);
+    while (Index+1 < End && Offsets[Index+1] <= Key) {
+        ++Index;
+        ++NumProbes;
+    }
+    FileID Res = FileID::get(Index);
+    if (!(Offsets[Index] & 1))
+        LastFileIDLookup = Res;
+    NumBinaryProbes += NumProbes+1;
+    return Res;
+}
+
+/// getFileIDLoaded - getFileIDSlow for a table with entries that are loaded
+/// lazily from an external source.
+FileID SourceManager::getFileIDLoaded(SourceLocation::UIntTy SLocOffset) const {
     // After the first and second level caches, I see two common sorts of
     // behavior: 1) a lot of searched FileID's are "near" the cached file location
     // or are "near" the cached instantiation location.  2) others are just
@@ -472,7 +589,8 @@ FileID SourceManager::getFileIDSlow(unsigned SLocOffset) const {
     NumProbes = 0;
     while (1) {
         unsigned MiddleIndex = (GreaterIndex-LessIndex)/2+LessIndex;
-        unsigned MidOffset = getSLocEntry(FileID::get(MiddleIndex)).getOffset();
+        SourceLocation::UIntTy MidOffset =
+                getSLocEntry(FileID::get(MiddleIndex)).getOffset();
 
         ++NumProbes;
 
@@ -509,10 +627,11 @@ FileID SourceManager::getFileIDSlow(unsigned SLocOffset) const {
 SourceLocation SourceManager::
 getInstantiationLocSlowCase(SourceLocation Loc) const {
     do {
-        std::pair<FileID, unsigned> LocInfo = getDecomposedLoc(Loc);
-        Loc = getSLocEntry(LocInfo.first).getInstantiation()
+        // An instantiation entry may cover a whole macro body, so the offset of
+        // Loc in it says where the token was spelled, not where in the
+        // instantiation it lies: it is not carried over to the instantiation loc.
+        Loc = getSLocEntry(getFileID(Loc)).getInstantiation()
                 .getInstantiationLocStart();
-        Loc = Loc.getFileLocWithOffset(LocInfo.second);
     } while (!Loc.isFileID());
 
     return Loc;
@@ -540,7 +659,7 @@ SourceManager::getDecomposedInstantiationLocSlowCase(const SLocEntry *E,
 
         FID = getFileID(Loc);
         E = &getSLocEntry(FID);
-        Offset += Loc.getOffset()-E->getOffset();
+        Offset = Loc.getOffset()-E->getOffset();
     } while (!Loc.isFileID());
 
     return std::make_pair(FID, Offset);
@@ -646,48 +765,348 @@ unsigned SourceManager::getInstantiationColumnNumber(SourceLocation Loc) const {
 }
 
 
-static void ComputeLineNumbers(ContentCache* FI){
-    // Note that calling 'getBuffer()' may lazily page in the file.
-    const MemoryBuffer *Buffer = FI->getBuffer();
-
-    // Find the file offsets of all of the *physical* source lines.  This does
-    // not look at trigraphs, escaped newlines, or anything else tricky.
-    std::vector<unsigned> LineOffsets;
+//===----------------------------------------------------------------------===//
+// Line offset tables
+//===----------------------------------------------------------------------===//
 
-    // Line #1 starts at char 0.
-    LineOffsets.push_back(0);
+// The line scanners below find the physical line breaks of a buffer.  They may
+// read up to 31 bytes past the nul that ends the buffer, which is covered by
+// MemoryBuffer::TailPadding.
+
+/// CountLineBreakCharsScalar - Return the number of '\n' and '\r' characters
+/// in [Buf, End).  A "\r\n" or "\n\r" pair ends a single line, so this is an
+/// upper bound on the number of lines after the first.
+static unsigned CountLineBreakCharsScalar(const unsigned char *Buf,
+                                          const unsigned char *End) {
+    unsigned Count = 0;
+    for (; Buf != End; ++Buf)
+        Count += *Buf == '\n' || *Buf == '\r';
+    return Count;
+}
 
-    const unsigned char *Buf = (const unsigned char *)Buffer->getBufferStart();
-    const unsigned char *End = (const unsigned char *)Buffer->getBufferEnd();
-    unsigned Offs = 0;
+/// FindLineStartsScalar - Store the offset of the start of every physical line
+/// after the first into LineStarts, and return how many there are.  This does
+/// not look at trigraphs, escaped newlines, or anything else tricky.  Embedded
+/// nuls are skipped; the one at End stops the scan.
+static unsigned FindLineStartsScalar(const unsigned char *Start,
+                                     const unsigned char *End,
+                                     unsigned *LineStarts) {
+    unsigned *Out = LineStarts;
+    const unsigned char *Buf = Start;
     while (1) {
         // Skip over the contents of the line.
-        // TODO: Vectorize this?  This is very performance sensitive for programs
-        // with lots of diagnostics and in -E mode.
-        const unsigned char *NextBuf = (const unsigned char *)Buf;
-        while (*NextBuf != '\n' && *NextBuf != '\r' && *NextBuf != '\0')
-            ++NextBuf;
-        Offs += NextBuf-Buf;
-        Buf = NextBuf;
+        while (*Buf != '\n' && *Buf != '\r' && *Buf != '\0')
+            ++Buf;
 
         if (Buf[0] == '\n' || Buf[0] == '\r') {
             // If this is \n\r or \r\n, skip both characters.
             if ((Buf[1] == '\n' || Buf[1] == '\r') && Buf[0] != Buf[1])
-                ++Offs, ++Buf;
-            ++Offs, ++Buf;
-            LineOffsets.push_back(Offs);
+                ++Buf;
+            ++Buf;
+            *Out++ = Buf-Start;
         } else {
             // Otherwise, this is a null.  If end of file, exit.
             if (Buf == End) break;
             // Otherwise, skip the null.
-            ++Offs, ++Buf;
+            ++Buf;
         }
     }
+    return Out-LineStarts;
+}
+
+#if SOURCEMANAGER_HAVE_X86_KERNELS
+/// The vector scanners build a mask of the '\n', '\r' and nul bytes of each
+/// block and walk its bits, so a block holding several short lines is examined
+/// once rather than once per line.
+static inline unsigned LineStopMask16(const unsigned char *Ptr) {
+    __m128i V = _mm_loadu_si128((const __m128i*)Ptr);
+    return _mm_movemask_epi8(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8('\n')),
+                                      _mm_cmpeq_epi8(V, _mm_set1_epi8('\r'))),
+                         _mm_cmpeq_epi8(V, _mm_setzero_si128())));
+}
+
+static inline unsigned LineBreakMask16(const unsigned char *Ptr) {
+    __m128i V = _mm_loadu_si128((const __m128i*)Ptr);
+    return _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8('\n')),
+                         _mm_cmpeq_epi8(V, _mm_set1_epi8('\r'))));
+}
 
-    // Copy the offsets into the FileInfo structure.
-    FI->NumLines = LineOffsets.size();
-    FI->SourceLineCache = (unsigned *)malloc(LineOffsets.size() * sizeof(unsigned));
-    std::copy(LineOffsets.begin(), LineOffsets.end(), FI->SourceLineCache);
+static unsigned CountLineBreakCharsSSE2(const unsigned char *Buf,
+                                        const unsigned char *End) {
+    unsigned Count = 0;
+    for (; End-Buf >= 16; Buf += 16)
+        Count += __builtin_popcount(LineBreakMask16(Buf));
+    return Count + CountLineBreakCharsScalar(Buf, End);
+}
+
+static unsigned FindLineStartsSSE2(const unsigned char *Start,
+                                   const unsigned char *End,
+                                   unsigned *LineStarts) {
+    unsigned *Out = LineStarts;
+    const unsigned char *Block = Start;
+    while (1) {
+        unsigned Mask = LineStopMask16(Block);
+        while (Mask) {
+            const unsigned char *Buf = Block + __builtin_ctz(Mask);
+            if (Buf[0] == '\0') {
+                // If end of file, exit.  Otherwise, skip the null.
+                if (Buf == End)
+                    return Out-LineStarts;
+                Mask &= Mask-1;
+                continue;
+            }
+
+            // If this is \n\r or \r\n, skip both characters.
+            if ((Buf[1] == '\n' || Buf[1] == '\r') && Buf[0] != Buf[1])
+                ++Buf;
+            ++Buf;
+            *Out++ = Buf-Start;
+
+            unsigned Consumed = Buf-Block;
+            if (Consumed >= 16) {
+                // The pair straddled the block; go on right after it.
+                Block = Buf-16;
+                Mask = 0;
+            } else {
+                Mask &= ~0U << Consumed;
+            }
+        }
+        Block += 16;
+    }
+}
+
+/// The AVX2 scanners run the same loops 32 bytes at a time.
+#define SOURCEMANAGER_AVX2 __attribute__((target("avx2,popcnt")))
+
+SOURCEMANAGER_AVX2 static unsigned CountLineBreakCharsAVX2(
+        const unsigned char *Buf, const unsigned char *End) {
+    unsigned Count = 0;
+    for (; End-Buf >= 32; Buf += 32) {
+        __m256i V = _mm256_loadu_si256((const __m256i*)Buf);
+        Count += __builtin_popcount(_mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_cmpeq_epi8(V, _mm256_set1_epi8('\n')),
+                                _mm256_cmpeq_epi8(V, _mm256_set1_epi8('\r')))));
+    }
+    return Count + CountLineBreakCharsScalar(Buf, End);
+}
+
+SOURCEMANAGER_AVX2 static unsigned FindLineStartsAVX2(
+        const unsigned char *Start, const unsigned char *End,
+        unsigned *LineStarts) {
+    unsigned *Out = LineStarts;
+    const unsigned char *Block = Start;
+    while (1) {
+        __m256i V = _mm256_loadu_si256((const __m256i*)Block);
+        unsigned Mask = _mm256_movemask_epi8(
+                _mm256_or_si256(
+                        _mm256_or_si256(_mm256_cmpeq_epi8(V, _mm256_set1_epi8('\n')),
+                                        _mm256_cmpeq_epi8(V, _mm256_set1_epi8('\r'))),
+                        _mm256_cmpeq_epi8(V, _mm256_setzero_si256())));
+        while (Mask) {
+            const unsigned char *Buf = Block + __builtin_ctz(Mask);
+            if (Buf[0] == '\0') {
+                // If end of file, exit.  Otherwise, skip the null.
+                if (Buf == End)
+                    return Out-LineStarts;
+                Mask &= Mask-1;
+                continue;
+            }
+
+            // If this is \n\r or \r\n, skip both characters.
+            if ((Buf[1] == '\n' || Buf[1] == '\r') && Buf[0] != Buf[1])
+                ++Buf;
+            ++Buf;
+            *Out++ = Buf-Start;
+
+            unsigned Consumed = Buf-Block;
+            if (Consumed >= 32) {
+                // The pair straddled the block; go on right after it.
+                Block = Buf-32;
+                Mask = 0;
+            } else {
+                Mask &= ~0U << Consumed;
+            }
+        }
+        Block += 32;
+    }
+}
+
+#undef SOURCEMANAGER_AVX2
+#endif // SOURCEMANAGER_HAVE_X86_KERNELS
+
+namespace {
+    /// LineScanKernels - The line scanners picked for this host.
+    struct LineScanKernels {
+        unsigned (*CountLineBreakChars)(const unsigned char *Buf,
+                                        const unsigned char *End);
+        unsigned (*FindLineStarts)(const unsigned char *Start,
+                                   const unsigned char *End,
+                                   unsigned *LineStarts);
+    };
+}
+
+/// SelectLineScanKernels - Pick the widest scanners the running CPU supports.
+/// CPTOYC_LEXER_SIMD caps the selection the same way it caps the lexer's.
+static LineScanKernels SelectLineScanKernels() {
+    LineScanKernels K = { CountLineBreakCharsScalar, FindLineStartsScalar };
+#if SOURCEMANAGER_HAVE_X86_KERNELS
+    const char *Cap = getenv("CPTOYC_LEXER_SIMD");
+    if (Cap && strcmp(Cap, "scalar") == 0)
+        return K;
+
+    K.CountLineBreakChars = CountLineBreakCharsSSE2;
+    K.FindLineStarts = FindLineStartsSSE2;
+    if (Cap && strcmp(Cap, "sse2") == 0)
+        return K;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        K.CountLineBreakChars = CountLineBreakCharsAVX2;
+        K.FindLineStarts = FindLineStartsAVX2;
+    }
+#endif
+    return K;
+}
+
+static const LineScanKernels TheLineScanKernels = SelectLineScanKernels();
+
+//===----------------------------------------------------------------------===//
+// Directive index
+//===----------------------------------------------------------------------===//
+
+static inline bool isHorizontalSpace(unsigned char C) {
+    return C == ' ' || C == '\t' || C == '\f' || C == '\v';
+}
+
+/// ClassifyDirectiveStop - Record the character at Ptr, one of '#', '/', '\\',
+/// '?', '%' or nul, in the DirectiveIndex if it is a line-leading '#' or a
+/// hazard.  Returns false at the nul that ends the buffer.
+static inline bool ClassifyDirectiveStop(const unsigned char *Start,
+                                         const unsigned char *End,
+                                         const unsigned char *Ptr,
+                                         DirectiveIndex &DI) {
+    switch (*Ptr) {
+        case '#': {
+            const unsigned char *P = Ptr;
+            while (P != Start && isHorizontalSpace(P[-1]))
+                --P;
+            if (P == Start || P[-1] == '\n' || P[-1] == '\r')
+                DI.Hashes.push_back(Ptr-Start);
+            return true;
+        }
+        case '/':
+            if (Ptr[1] == '*')
+                DI.Hazards.push_back(Ptr-Start);
+            return true;
+        case '\\': {
+            // The lexer takes a backslash and whitespace before a newline as an
+            // escaped newline too.
+            const unsigned char *P = Ptr+1;
+            while (isHorizontalSpace(*P))
+                ++P;
+            if (*P == '\n' || *P == '\r')
+                DI.Hazards.push_back(Ptr-Start);
+            return true;
+        }
+        case '?':
+            if (Ptr[1] == '?')
+                DI.Hazards.push_back(Ptr-Start);
+            return true;
+        case '%':
+            if (Ptr[1] == ':')
+                DI.Hazards.push_back(Ptr-Start);
+            return true;
+        default:
+            assert(*Ptr == '\0' && "Not a directive stop");
+            if (Ptr == End)
+                return false;
+            DI.Hazards.push_back(Ptr-Start);
+            return true;
+    }
+}
+
+#if !SOURCEMANAGER_HAVE_X86_KERNELS
+/// BuildDirectiveIndex - Classify every directive stop in the buffer.
+static void BuildDirectiveIndex(const unsigned char *Start,
+                                const unsigned char *End,
+                                DirectiveIndex &DI) {
+    for (const unsigned char *Ptr = Start; ; ++Ptr) {
+        unsigned char C = *Ptr;
+        if ((C == '#' || C == '/' || C == '\\' || C == '?' || C == '%' ||
+             C == '\0') && !ClassifyDirectiveStop(Start, End, Ptr, DI))
+            return;
+    }
+}
+#else
+/// BuildDirectiveIndex - Find the directive stops 16 bytes at a time.  Most
+/// blocks hold none, and are passed over with a single test.
+static void BuildDirectiveIndex(const unsigned char *Start,
+                                const unsigned char *End,
+                                DirectiveIndex &DI) {
+    for (const unsigned char *Block = Start; ; Block += 16) {
+        __m128i V = _mm_loadu_si128((const __m128i*)Block);
+        __m128i Stops = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8('#')),
+                             _mm_cmpeq_epi8(V, _mm_set1_epi8('/'))),
+                _mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8('\\')),
+                             _mm_cmpeq_epi8(V, _mm_set1_epi8('?'))));
+        Stops = _mm_or_si128(Stops,
+                _mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8('%')),
+                             _mm_cmpeq_epi8(V, _mm_setzero_si128())));
+        for (unsigned Mask = _mm_movemask_epi8(Stops); Mask; Mask &= Mask-1)
+            if (!ClassifyDirectiveStop(Start, End, Block + __builtin_ctz(Mask), DI))
+                return;
+    }
+}
+#endif
+
+/// getDirectiveIndex - Returns the DirectiveIndex of the buffer.  A buffer
+/// taken from a FileContentStore is indexed once for all the workers.
+const DirectiveIndex &ContentCache::getDirectiveIndex() const {
+    if (Directives)
+        return *Directives;
+
+    if (Store && (Directives = Store->getDirectiveIndex(Entry)))
+        return *Directives;
+
+    const MemoryBuffer *Buffer = getBuffer();
+    assert(Buffer->hasTailPadding() && "Directive prescan reads past the end");
+    const unsigned char *Start = (const unsigned char *)Buffer->getBufferStart();
+    const unsigned char *End = (const unsigned char *)Buffer->getBufferEnd();
+
+    DirectiveIndex *DI = new DirectiveIndex();
+    BuildDirectiveIndex(Start, End, *DI);
+    Directives = Store ? Store->addDirectiveIndex(Entry, DI) : DI;
+    return *Directives;
+}
+
+/// ComputeLineNumbers - Build the table of the file offsets of all of the
+/// *physical* source lines of the specified content.  The table is sized once
+/// from a count of the line break characters, and trimmed if some of them
+/// came in \r\n or \n\r pairs.
+static void ComputeLineNumbers(ContentCache* FI){
+    // Note that calling 'getBuffer()' may lazily page in the file.
+    const MemoryBuffer *Buffer = FI->getBuffer();
+    assert(Buffer->hasTailPadding() && "Line scanners read past the buffer end");
+
+    const unsigned char *Buf = (const unsigned char *)Buffer->getBufferStart();
+    const unsigned char *End = (const unsigned char *)Buffer->getBufferEnd();
+
+    unsigned MaxLines = TheLineScanKernels.CountLineBreakChars(Buf, End) + 1;
+    unsigned *LineOffsets = (unsigned *)malloc(MaxLines * sizeof(unsigned));
+
+    // Line #1 starts at char 0.
+    LineOffsets[0] = 0;
+    unsigned NumLines = 1 + TheLineScanKernels.FindLineStarts(Buf, End,
+                                                              LineOffsets+1);
+    assert(NumLines <= MaxLines && "Miscounted line breaks");
+    if (NumLines != MaxLines)
+        LineOffsets = (unsigned *)realloc(LineOffsets, NumLines * sizeof(unsigned));
+
+    FI->NumLines = NumLines;
+    FI->SourceLineCache = LineOffsets;
 }
 
 /// getLineNumber - Given a SourceLocation, return the spelling line number
@@ -850,7 +1269,8 @@ const char *SourceManager::getBufferName(SourceLocation Loc) const {
 ///
 /// Note that a presumed location is always given as the instantiation point
 /// of an instantiation location, not at the spelling location.
-PresumedLoc SourceManager::getPresumedLoc(SourceLocation Loc) const {
+PresumedLoc SourceManager::getPresumedLoc(SourceLocation Loc,
+                                          bool WithLineAndColumn) const {
     if (Loc.isInvalid()) return PresumedLoc();
 
     // Presumed locations are always for instantiation points.
@@ -864,8 +1284,11 @@ PresumedLoc SourceManager::getPresumedLoc(SourceLocation Loc) const {
     // MemBuffer.
     const char *Filename =
             C->Entry ? C->Entry->getName() : C->getBuffer()->getBufferIdentifier();
-    unsigned LineNo = getLineNumber(LocInfo.first, LocInfo.second);
-    unsigned ColNo  = getColumnNumber(LocInfo.first, LocInfo.second);
+    unsigned LineNo = 0, ColNo = 0;
+    if (WithLineAndColumn) {
+        LineNo = getLineNumber(LocInfo.first, LocInfo.second);
+        ColNo  = getColumnNumber(LocInfo.first, LocInfo.second);
+    }
     SourceLocation IncludeLoc = FI.getIncludeLoc();
 
     // If we have #line directives in this file, update and overwrite the physical
@@ -883,8 +1306,10 @@ PresumedLoc SourceManager::getPresumedLoc(SourceLocation Loc) const {
             // be multiple lines down from the line entry.  Add the difference in
             // physical line numbers from the query point and the line marker to the
             // total.
-            unsigned MarkerLineNo = getLineNumber(LocInfo.first, Entry->FileOffset);
-            LineNo = Entry->LineNo + (LineNo-MarkerLineNo-1);
+            if (WithLineAndColumn) {
+                unsigned MarkerLineNo = getLineNumber(LocInfo.first, Entry->FileOffset);
+                LineNo = Entry->LineNo + (LineNo-MarkerLineNo-1);
+            }
 
             // Note that column numbers are not molested by line markers.
 
@@ -1050,6 +1475,10 @@ void SourceManager::PrintStats() const {
               << " mem buffers mapped.\n";
     std::cerr << SLocEntryTable.size() << " SLocEntry's allocated, "
               << NextOffset << "B of Sloc address space used.\n";
+    std::cerr << sizeof(SourceLocation)*8 << "-bit source locations: "
+              << SLocEntryTable.capacity()*sizeof(SLocEntry) << "B of SLocEntry's, "
+              << SLocEntryOffsets.capacity()*sizeof(SourceLocation::UIntTy)
+              << "B of FileID index.\n";
 
     unsigned NumLineNumsComputed = 0;
     unsigned NumFileBytesMapped = 0;
@@ -1062,6 +1491,13 @@ void SourceManager::PrintStats() const {
               << NumLineNumsComputed << " files with line #'s computed.\n";
     std::cerr << "FileID scans: " << NumLinearScans << " linear, "
               << NumBinaryProbes << " binary.\n";
+
+    const MemoryBuffer::LoadStats &LS = MemoryBuffer::getLoadStats();
+    std::cerr << "File loading: " << LS.NumMapped << " mmapped, "
+              << LS.NumMappedOverlay << " mmapped over a zero page ("
+              << LS.BytesMapped << "B), " << LS.NumPooled << " pooled reads ("
+              << LS.BytesPooled << "B in " << LS.NumSlabs << " slabs), "
+              << LS.NumRead << " plain reads (" << LS.BytesRead << "B).\n";
 }
 
 ExternalSLocEntrySource::~ExternalSLocEntrySource() { }
\ No newline at end of file
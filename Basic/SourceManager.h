@@ -29,18 +29,38 @@ namespace CPToyC {
         class FileEntry;
         class IdentifierTokenInfo;
         class LineTableInfo;
+        class FileContentStore;
 
         enum CharacteristicKind {
             C_User, C_System, C_ExternCSystem
         };
 
+        /// DirectiveIndex - Where the lines of a buffer that may be preprocessor
+        /// directives are, found by one vectorized pass over the buffer.  Hashes
+        /// holds the offset of the '#' of every line that starts with one after
+        /// horizontal whitespace.  Hazards holds the offset of everything that can
+        /// tie a line to the ones before it or spell a directive without a '#' at
+        /// the start of a line: a "/*", a backslash before a newline, a "??"
+        /// (trigraph), a "%:" (digraph) and an embedded nul.  Between a token
+        /// boundary and the next hazard, the directives are exactly the entries
+        /// of Hashes, so the text up to one can be skipped without lexing it.
+        struct DirectiveIndex {
+            std::vector<unsigned> Hashes;
+            std::vector<unsigned> Hazards;
+        };
+
         /// ContentCache - Once instance of this struct is kept for every file
-        /// loaded or used.  This object owns the MemoryBuffer object.
+        /// loaded or used.  This object owns the MemoryBuffer object, unless it
+        /// was taken from a FileContentStore.
         class ContentCache {
             /// Buffer - The actual buffer containing the characters from the input
-            /// file.  This is owned by the ContentCache object.
+            /// file.  This is owned by the ContentCache object, or by Store if set.
             mutable const MemoryBuffer *Buffer;
 
+            /// Store - The store shared with other SourceManagers that file contents
+            /// are taken from, or null to load them privately.
+            FileContentStore *Store;
+
         public:
             /// Reference to the file entry.  This reference does not own
             /// the FileEntry object.  It is possible for this to be NULL if
@@ -56,6 +76,11 @@ namespace CPToyC {
             /// if SourceLineCache is non-null.
             unsigned NumLines;
 
+            /// Directives - The DirectiveIndex of the buffer, built the first time
+            /// it is asked for and kept for every later inclusion of the file.  It
+            /// is owned by Store if set, which shares it with the other workers.
+            mutable const DirectiveIndex *Directives;
+
             /// FirstFID - First FileID that was created for this ContentCache.
             /// Represents the first source inclusion of the file associated with this
             /// ContentCache.
@@ -64,6 +89,9 @@ namespace CPToyC {
             /// getBuffer - Returns the memory buffer for the associated content.
             const MemoryBuffer *getBuffer() const;
 
+            /// getDirectiveIndex - Returns the DirectiveIndex of the buffer.
+            const DirectiveIndex &getDirectiveIndex() const;
+
             /// getSize - Returns the size of the content encapsulated by this
             ///  ContentCache. This can be the size of the source file or the size of an
             ///  arbitrary scratch buffer.  If the ContentCache encapsulates a source
@@ -80,16 +108,19 @@ namespace CPToyC {
                 Buffer = B;
             }
 
-            ContentCache(const FileEntry *Ent = 0)
-                    : Buffer(0), Entry(Ent), SourceLineCache(0), NumLines(0) {}
+            ContentCache(const FileEntry *Ent = 0, FileContentStore *store = 0)
+                    : Buffer(0), Store(store), Entry(Ent), SourceLineCache(0),
+                      NumLines(0), Directives(0) {}
 
             ~ContentCache();
 
             /// The copy ctor does not allow copies where source object has either
             ///  a non-NULL Buffer or SourceLineCache.  Ownership of allocated memory
             ///  is not transfered, so this is a logical error.
-            ContentCache(const ContentCache &RHS) : Buffer(0), SourceLineCache(0) {
+            ContentCache(const ContentCache &RHS)
+                    : Buffer(0), SourceLineCache(0), Directives(0) {
                 Entry = RHS.Entry;
+                Store = RHS.Store;
 
                 assert (RHS.Buffer == 0 && RHS.SourceLineCache == 0
                         && "Passed ContentCache object cannot own a buffer.");
@@ -114,7 +145,7 @@ namespace CPToyC {
         class FileInfo {
             /// IncludeLoc - The location of the #include that brought in this file.
             /// This is an invalid SLOC for the main file (top of the #include chain).
-            unsigned IncludeLoc;  // Really a SourceLocation
+            SourceLocation::UIntTy IncludeLoc;  // Really a SourceLocation
 
             /// Data - This contains the ContentCache* and the bits indicating the
             /// characteristic of the file and whether it has #line info, all bitmangled
@@ -163,13 +194,13 @@ namespace CPToyC {
             // Really these are all SourceLocations.
 
             /// SpellingLoc - Where the spelling for the token can be found.
-            unsigned SpellingLoc;
+            SourceLocation::UIntTy SpellingLoc;
 
             /// InstantiationLocStart/InstantiationLocEnd - In a macro expansion, these
             /// indicate the start and end of the instantiation.  In object-like macros,
             /// these will be the same.  In a function-like macro instantiation, the
             /// start will be the identifier and the end will be the ')'.
-            unsigned InstantiationLocStart, InstantiationLocEnd;
+            SourceLocation::UIntTy InstantiationLocStart, InstantiationLocEnd;
         public:
             SourceLocation getSpellingLoc() const {
                 return SourceLocation::getFromRawEncoding(SpellingLoc);
@@ -205,13 +236,13 @@ namespace CPToyC {
         /// InstantiationInfo.  SourceManager keeps an array of these objects, and
         /// they are uniquely identified by the FileID datatype.
         class SLocEntry {
-            unsigned Offset;   // low bit is set for instantiation info.
+            SourceLocation::UIntTy Offset;   // low bit is set for instantiation info.
             union {
                 FileInfo File;
                 InstantiationInfo Instantiation;
             };
         public:
-            unsigned getOffset() const { return Offset >> 1; }
+            SourceLocation::UIntTy getOffset() const { return Offset >> 1; }
 
             bool isInstantiation() const { return Offset & 1; }
             bool isFile() const { return !isInstantiation(); }
@@ -226,14 +257,15 @@ namespace CPToyC {
                 return Instantiation;
             }
 
-            static SLocEntry get(unsigned Offset, const FileInfo &FI) {
+            static SLocEntry get(SourceLocation::UIntTy Offset, const FileInfo &FI) {
                 SLocEntry E;
                 E.Offset = Offset << 1;
                 E.File = FI;
                 return E;
             }
 
-            static SLocEntry get(unsigned Offset, const InstantiationInfo &II) {
+            static SLocEntry get(SourceLocation::UIntTy Offset,
+                                 const InstantiationInfo &II) {
                 SLocEntry E;
                 E.Offset = (Offset << 1) | 1;
                 E.Instantiation = II;
@@ -378,12 +410,30 @@ namespace CPToyC {
             /// as they do not refer to a file.
             std::vector<ContentCache*> MemBufferInfos;
 
+            /// Contents - If set, file contents are taken from this store, shared with
+            /// the SourceManagers of other threads, instead of being loaded here.
+            FileContentStore *Contents;
+
             /// SLocEntryTable - This is an array of SLocEntry's that we have created.
             /// FileID is an index into this vector.  This array is sorted by the offset.
             std::vector<SLocEntry> SLocEntryTable;
+            /// SLocEntryOffsets - The start offset of each entry of SLocEntryTable,
+            /// shifted left by one with the entry's isInstantiation bit below it.  They
+            /// are kept apart so that getFileIDSlow can search them without touching
+            /// the entries themselves.  Offsets stay below MacroIDBit, so the shift
+            /// can't overflow.
+            std::vector<SourceLocation::UIntTy> SLocEntryOffsets;
+
+            /// SLocBlockOffsets - The start offset of every SLocBlockSize'th entry.
+            /// getFileIDSlow binary searches this small array for the block holding
+            /// an offset, then scans the block, which spans a cache line or two of
+            /// SLocEntryOffsets.
+            std::vector<SourceLocation::UIntTy> SLocBlockOffsets;
+            enum { SLocBlockSize = 16 };
+
             /// NextOffset - This is the next available offset that a new SLocEntry can
             /// start at.  It is SLocEntryTable.back().getOffset()+size of back() entry.
-            unsigned NextOffset;
+            SourceLocation::UIntTy NextOffset;
 
             /// \brief If source location entries are being lazily loaded from
             /// an external source, this vector indicates whether the Ith source
@@ -425,12 +475,23 @@ namespace CPToyC {
             void operator=(const SourceManager&);
         public:
             SourceManager()
-                    : ExternalSLocEntries(0), LineTable(0), NumLinearScans(0),
-                      NumBinaryProbes(0) {
+                    : Contents(0), ExternalSLocEntries(0), LineTable(0),
+                      NumLinearScans(0), NumBinaryProbes(0) {
                 clearIDTables();
             }
             ~SourceManager();
 
+            /// setFileContentStore - Take the contents of files from the specified
+            /// store from now on.  The store must outlive this SourceManager.
+            void setFileContentStore(FileContentStore *Store) {
+                assert(FileInfos.empty() && "Files already loaded privately");
+                Contents = Store;
+            }
+
+            /// clearIDTables - Forget the FileIDs and source locations handed out
+            /// for the current translation unit.  The contents of files stay cached,
+            /// so a driver preprocessing several translation units reads each file
+            /// once.
             void clearIDTables();
 
             //===--------------------------------------------------------------------===//
@@ -460,7 +521,7 @@ namespace CPToyC {
             FileID createFileID(const FileEntry *SourceFile, SourceLocation IncludePos,
                                 CharacteristicKind FileCharacter,
                                 unsigned PreallocatedID = 0,
-                                unsigned Offset = 0) {
+                                SourceLocation::UIntTy Offset = 0) {
                 const ContentCache *IR = getOrCreateContentCache(SourceFile);
                 if (IR == nullptr) return FileID();    // Error opening file?
                 return createFileID(IR, IncludePos, FileCharacter, PreallocatedID, Offset);
@@ -471,7 +532,7 @@ namespace CPToyC {
             /// ownership of the MemoryBuffer, so only pass a MemoryBuffer to this once.
             FileID createFileIDForMemBuffer(const MemoryBuffer *Buffer,
                                             unsigned PreallocatedID = 0,
-                                            unsigned Offset = 0) {
+                                            SourceLocation::UIntTy Offset = 0) {
                 return createFileID(createMemBufferContentCache(Buffer), SourceLocation(),
                                     C_User, PreallocatedID, Offset);
             }
@@ -493,7 +554,7 @@ namespace CPToyC {
                                                   SourceLocation InstantiationLocEnd,
                                                   unsigned TokLength,
                                                   unsigned PreallocatedID = 0,
-                                                  unsigned Offset = 0);
+                                                  SourceLocation::UIntTy Offset = 0);
 
             //===--------------------------------------------------------------------===//
             // FileID manipulation methods.
@@ -505,6 +566,12 @@ namespace CPToyC {
                 return getSLocEntry(FID).getFile().getContentCache()->getBuffer();
             }
 
+            /// getDirectiveIndex - Return the DirectiveIndex of the buffer of the
+            /// specified FileID.
+            const DirectiveIndex &getDirectiveIndex(FileID FID) const {
+                return getSLocEntry(FID).getFile().getContentCache()->getDirectiveIndex();
+            }
+
             /// getFileEntryForID - Returns the FileEntry record for the provided FileID.
             const FileEntry *getFileEntryForID(FileID FID) const {
                 return getSLocEntry(FID).getFile().getContentCache()->Entry;
@@ -525,7 +592,7 @@ namespace CPToyC {
             /// SLocEntryTable which contains the specified location.
             ///
             FileID getFileID(SourceLocation SpellingLoc) const {
-                unsigned SLocOffset = SpellingLoc.getOffset();
+                SourceLocation::UIntTy SLocOffset = SpellingLoc.getOffset();
 
                 // If our one-entry cache covers this offset, just return it.
                 if (isOffsetInFileID(LastFileIDLookup, SLocOffset))
@@ -539,7 +606,7 @@ namespace CPToyC {
             SourceLocation getLocForStartOfFile(FileID FID) const {
                 assert(FID.ID < SLocEntryTable.size() && "FileID out of range");
                 assert(getSLocEntry(FID).isFile() && "FileID is not a file");
-                unsigned FileOffset = getSLocEntry(FID).getOffset();
+                SourceLocation::UIntTy FileOffset = getSLocEntry(FID).getOffset();
                 return SourceLocation::getFileLoc(FileOffset);
             }
 
@@ -673,7 +740,11 @@ namespace CPToyC {
             ///
             /// Note that a presumed location is always given as the instantiation point
             /// of an instantiation location, not at the spelling location.
-            PresumedLoc getPresumedLoc(SourceLocation Loc) const;
+            ///
+            /// If WithLineAndColumn is false, only the filename and include location
+            /// are computed and the line table of the file is left alone.
+            PresumedLoc getPresumedLoc(SourceLocation Loc,
+                                       bool WithLineAndColumn = true) const;
 
             /// isFromSameFile - Returns true if both SourceLocations correspond to
             ///  the same file.
@@ -768,13 +839,13 @@ namespace CPToyC {
                 return SLocEntryTable[FID.ID];
             }
 
-            unsigned getNextOffset() const { return NextOffset; }
+            SourceLocation::UIntTy getNextOffset() const { return NextOffset; }
 
             /// \brief Preallocate some number of source location entries, which
             /// will be loaded as needed from the given external source.
             void PreallocateSLocEntries(ExternalSLocEntrySource *Source,
                                         unsigned NumSLocEntries,
-                                        unsigned NextOffset);
+                                        SourceLocation::UIntTy NextOffset);
 
             /// \brief Clear out any preallocated source location entries that
             /// haven't already been loaded.
@@ -783,7 +854,8 @@ namespace CPToyC {
         private:
             /// isOffsetInFileID - Return true if the specified FileID contains the
             /// specified SourceLocation offset.  This is a very hot method.
-            inline bool isOffsetInFileID(FileID FID, unsigned SLocOffset) const {
+            inline bool isOffsetInFileID(FileID FID,
+                                         SourceLocation::UIntTy SLocOffset) const {
                 const SLocEntry &Entry = getSLocEntry(FID);
                 // If the entry is after the offset, it can't contain it.
                 if (SLocOffset < Entry.getOffset()) return false;
@@ -802,7 +874,7 @@ namespace CPToyC {
                                 SourceLocation IncludePos,
                                 CharacteristicKind DirCharacter,
                                 unsigned PreallocatedID = 0,
-                                unsigned Offset = 0);
+                                SourceLocation::UIntTy Offset = 0);
 
             const ContentCache *
             getOrCreateContentCache(const FileEntry *SourceFile);
@@ -812,7 +884,17 @@ namespace CPToyC {
             const ContentCache*
             createMemBufferContentCache(const MemoryBuffer *Buf);
 
-            FileID getFileIDSlow(unsigned SLocOffset) const;
+            FileID getFileIDSlow(SourceLocation::UIntTy SLocOffset) const;
+            FileID getFileIDLoaded(SourceLocation::UIntTy SLocOffset) const;
+
+            /// addSLocEntryOffset - Record the start offset of the entry just added to
+            /// SLocEntryTable in the getFileIDSlow index.
+            void addSLocEntryOffset(SourceLocation::UIntTy Offset,
+                                    bool IsInstantiation) {
+                if (SLocEntryOffsets.size() % SLocBlockSize == 0)
+                    SLocBlockOffsets.push_back(Offset);
+                SLocEntryOffsets.push_back(Offset << 1 | IsInstantiation);
+            }
 
             SourceLocation getInstantiationLocSlowCase(SourceLocation Loc) const;
             SourceLocation getSpellingLocSlowCase(SourceLocation Loc) const;
@@ -0,0 +1,367 @@
+/***********************************
+* File:     StatCache.cpp
+*
+* Author:   agent
+*
+* Email:    agent@local
+*
+* Date:     2026/10/16
+***********************************/
+
+#include "StatCache.h"
+#include "llvm/MemoryBuffer.h"
+#include "llvm/raw_ostream.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace CPToyC::Compiler;
+using namespace CPToyC::Compiler::statcache;
+
+const char statcache::Magic[8] = { 'C', 'P', 'T', 'O', 'Y', 'S', 'T', 'C' };
+
+static uint32_t ReadLE32(const unsigned char *&Data) {
+    uint32_t V = ((uint32_t) Data[0]) |
+                 ((uint32_t) Data[1] << 8) |
+                 ((uint32_t) Data[2] << 16) |
+                 ((uint32_t) Data[3] << 24);
+    Data += 4;
+    return V;
+}
+
+static uint64_t ReadLE64(const unsigned char *&Data) {
+    uint64_t Lo = ReadLE32(Data);
+    uint64_t Hi = ReadLE32(Data);
+    return Lo | (Hi << 32);
+}
+
+static void Emit32(std::string &Out, uint32_t V) {
+    Out += (char) (V & 0xFF);
+    Out += (char) ((V >> 8) & 0xFF);
+    Out += (char) ((V >> 16) & 0xFF);
+    Out += (char) ((V >> 24) & 0xFF);
+}
+
+static void Emit64(std::string &Out, uint64_t V) {
+    Emit32(Out, (uint32_t) V);
+    Emit32(Out, (uint32_t) (V >> 32));
+}
+
+/// HashPath - The FNV-1a hash of a path, which picks its bucket.
+static unsigned HashPath(const char *Path, unsigned Len) {
+    unsigned Hash = 2166136261U;
+    for (unsigned i = 0; i != Len; ++i)
+        Hash = (Hash ^ (unsigned char) Path[i]) * 16777619U;
+    return Hash;
+}
+
+/// GetParentDir - Return the directory holding the specified path: "." for a
+/// name without a slash, and "/" for the root.
+static llvm::StringRef GetParentDir(const char *Path) {
+    const char *End = Path + strlen(Path);
+    // "a/b/" lives in "a", like "a/b".
+    while (End-Path > 1 && End[-1] == '/')
+        --End;
+    while (End != Path && End[-1] != '/')
+        --End;
+    if (End == Path)
+        return llvm::StringRef(".", 1);
+    while (End-Path > 1 && End[-1] == '/')
+        --End;
+    return llvm::StringRef(Path, End-Path);
+}
+
+/// GetMTime - The modification time of a stat result in nanoseconds.  A file
+/// created in the same second a directory was stat'ed still changes it.
+static int64_t GetMTime(const struct stat &S) {
+#if defined(__APPLE__)
+    return S.st_mtimespec.tv_sec*1000000000LL + S.st_mtimespec.tv_nsec;
+#else
+    return S.st_mtim.tv_sec*1000000000LL + S.st_mtim.tv_nsec;
+#endif
+}
+
+static std::string GetCwd() {
+    char Buf[4096];
+    return getcwd(Buf, sizeof(Buf)) ? std::string(Buf) : std::string();
+}
+
+PersistentStatCache::PersistentStatCache()
+    : BufStart(0), BufEnd(0), DirTable(0), Buckets(0), Strings(0),
+      NumDirs(0), NumBuckets(0), SameCwd(false) {
+    NumHits = NumMisses = NumStale = 0;
+}
+
+PersistentStatCache::~PersistentStatCache() {}
+
+const char *PersistentStatCache::getString(uint32_t Offset) const {
+    // The file ends with a NUL, so a string in range is terminated.
+    if (Offset >= (uint64_t) (BufEnd-Strings))
+        return 0;
+    return (const char*) Strings + Offset;
+}
+
+bool PersistentStatCache::ReadFromFile(const std::string &Path,
+                                       std::string *ErrStr) {
+    llvm::OwningPtr<const MemoryBuffer> File(MemoryBuffer::getFile(Path.c_str()));
+    if (!File)
+        return true;   // No cache yet.
+
+    const unsigned char *Start = (const unsigned char*) File->getBufferStart();
+    uint64_t Size = File->getBufferSize();
+    if (Size < HeaderSize || memcmp(Start, Magic, sizeof(Magic)) != 0) {
+        if (ErrStr) *ErrStr = "'" + Path + "' is not a stat cache";
+        return false;
+    }
+
+    const unsigned char *p = Start + sizeof(Magic);
+    if (ReadLE32(p) != Version) {
+        if (ErrStr) *ErrStr = "'" + Path + "' has an unsupported version";
+        return false;
+    }
+    uint32_t Dirs = ReadLE32(p);
+    uint32_t DirTableOffset = ReadLE32(p);
+    uint32_t Bkts = ReadLE32(p);
+    uint32_t BucketsOffset = ReadLE32(p);
+    uint32_t CwdOffset = ReadLE32(p);
+    uint32_t StringsOffset = ReadLE32(p);
+
+    if (DirTableOffset + (uint64_t) Dirs*DirEntrySize > Size ||
+        BucketsOffset + (uint64_t) Bkts*4 > Size ||
+        (Bkts & (Bkts-1)) != 0 ||
+        StringsOffset + (uint64_t) CwdOffset >= Size ||
+        Start[Size-1] != '\0') {
+        if (ErrStr) *ErrStr = "malformed stat cache '" + Path + "'";
+        return false;
+    }
+
+    BufStart = Start;
+    BufEnd = Start + Size;
+    DirTable = Start + DirTableOffset;
+    NumDirs = Dirs;
+    Buckets = Start + BucketsOffset;
+    NumBuckets = Bkts;
+    Strings = Start + StringsOffset;
+    SameCwd = GetCwd() == getString(CwdOffset);
+    Buf.reset(File.take());
+    return true;
+}
+
+/// getDirInfo - Return the state of the specified directory, stat'ing it the
+/// first time it is asked for.
+const PersistentStatCache::DirInfo &
+PersistentStatCache::getDirInfo(const char *Start, const char *End) {
+    llvm::StringMapEntry<DirInfo> &Entry = Dirs.GetOrCreateValue(Start, End);
+    DirInfo &DI = Entry.getValue();
+    if (!DI.Checked) {
+        struct stat StatBuf;
+        DI.Checked = true;
+        DI.Exists = ::stat(Entry.getKeyData(), &StatBuf) == 0;
+        DI.MTime = DI.Exists ? GetMTime(StatBuf) : 0;
+    }
+    return DI;
+}
+
+/// FindRecord - Probe the on-disk hash table for the specified path.
+const unsigned char *PersistentStatCache::FindRecord(const char *Path,
+                                                     unsigned Len) const {
+    if (NumBuckets == 0 || (Path[0] != '/' && !SameCwd))
+        return 0;
+
+    unsigned Mask = NumBuckets-1;
+    unsigned Bucket = HashPath(Path, Len) & Mask;
+    for (unsigned Probes = 0; Probes != NumBuckets; ++Probes) {
+        const unsigned char *p = Buckets + Bucket*4;
+        uint32_t RecordOffset = ReadLE32(p);
+        if (RecordOffset == 0 ||
+            RecordOffset + (uint64_t) RecordSize > (uint64_t) (BufEnd-BufStart))
+            return 0;
+
+        const unsigned char *Record = BufStart + RecordOffset;
+        p = Record;
+        const char *Name = getString(ReadLE32(p));
+        if (!Name)
+            return 0;
+        if (strcmp(Name, Path) == 0)
+            return Record;
+        Bucket = (Bucket+1) & Mask;
+    }
+    return 0;
+}
+
+int PersistentStatCache::stat(const char *path, struct stat *buf) {
+    llvm::StringRef Dir = GetParentDir(path);
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        // The directory is looked at before the path, so that a file created
+        // in it after this point changes the mtime we save.
+        const DirInfo &DI = getDirInfo(Dir.data(), Dir.data()+Dir.size());
+        if (const unsigned char *Record = FindRecord(path, strlen(path))) {
+            const unsigned char *p = Record+4;
+            uint32_t DirIndex = ReadLE32(p);
+            int Result = (int) ReadLE32(p);
+            uint32_t Mode = ReadLE32(p);
+
+            bool Valid = false;
+            if (DirIndex < NumDirs) {
+                const unsigned char *D = DirTable + DirIndex*DirEntrySize + 4;
+                bool Exists = ReadLE32(D) != 0;
+                int64_t MTime = (int64_t) ReadLE64(D);
+                Valid = Exists == DI.Exists && MTime == DI.MTime;
+            }
+
+            if (Valid) {
+                memset(buf, 0, sizeof(*buf));
+                if (Result == 0) {
+                    buf->st_mode = Mode;
+                    buf->st_dev = ReadLE64(p);
+                    buf->st_ino = ReadLE64(p);
+                    buf->st_size = ReadLE64(p);
+                    buf->st_mtime = ReadLE64(p);
+                }
+                ++NumHits;
+                Memorize(path, Result, buf);
+                if (Result != 0)
+                    errno = ENOENT;
+                return Result;
+            }
+            ++NumStale;
+        }
+        ++NumMisses;
+    }
+
+    int Result = ::stat(path, buf);
+    std::lock_guard<std::mutex> Guard(Lock);
+    Memorize(path, Result, buf);
+    return Result;
+}
+
+bool PersistentStatCache::WriteToFile(const std::string &Path,
+                                      std::string *ErrStr) {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    // The string pool starts with an empty string, so no name is at offset 0.
+    std::string StringData(1, '\0');
+    llvm::StringMap<uint32_t> StringOffsets;
+    auto AddString = [&](const char *Start, const char *End) {
+        llvm::StringMapEntry<uint32_t> &Entry =
+                StringOffsets.GetOrCreateValue(Start, End, ~0U);
+        if (Entry.getValue() == ~0U) {
+            Entry.setValue(StringData.size());
+            StringData.append(Start, End);
+            StringData += '\0';
+        }
+        return Entry.getValue();
+    };
+
+    struct Record {
+        const char *Name;
+        unsigned NameLen;
+        uint32_t DirIndex;
+        const StatResult *Result;
+    };
+    std::vector<Record> Records;
+    std::string DirTableData;
+    llvm::StringMap<uint32_t> DirIndices;
+
+    for (iterator I = begin(), E = end(); I != E; ++I) {
+        const StatResult &R = I->getValue();
+        // Existing files are always stat'ed again; see the class comment.
+        if (R.first == 0 && !S_ISDIR(R.second.st_mode))
+            continue;
+
+        llvm::StringRef Dir = GetParentDir(I->getKeyData());
+        llvm::StringMap<DirInfo>::iterator DI = Dirs.find(Dir);
+        if (DI == Dirs.end())
+            continue;
+
+        llvm::StringMapEntry<uint32_t> &Index =
+                DirIndices.GetOrCreateValue(Dir.data(), Dir.data()+Dir.size(), ~0U);
+        if (Index.getValue() == ~0U) {
+            Index.setValue(DirIndices.size()-1);
+            Emit32(DirTableData, AddString(Dir.data(), Dir.data()+Dir.size()));
+            Emit32(DirTableData, DI->getValue().Exists);
+            Emit64(DirTableData, DI->getValue().MTime);
+        }
+
+        Record Rec = { I->getKeyData(), I->getKeyLength(), Index.getValue(), &R };
+        Records.push_back(Rec);
+    }
+
+    unsigned Bkts = 16;
+    while (Bkts < Records.size()*2)
+        Bkts *= 2;
+
+    std::string Cwd = GetCwd();
+    uint32_t CwdOffset = AddString(Cwd.data(), Cwd.data()+Cwd.size());
+
+    uint32_t DirTableOffset = HeaderSize;
+    uint32_t BucketsOffset = DirTableOffset + DirTableData.size();
+    uint32_t RecordsOffset = BucketsOffset + Bkts*4;
+    uint32_t StringsOffset = RecordsOffset + Records.size()*RecordSize;
+
+    std::vector<uint32_t> BucketTable(Bkts);
+    std::string RecordData;
+    for (unsigned i = 0, e = Records.size(); i != e; ++i) {
+        const Record &Rec = Records[i];
+        unsigned Bucket = HashPath(Rec.Name, Rec.NameLen) & (Bkts-1);
+        while (BucketTable[Bucket])
+            Bucket = (Bucket+1) & (Bkts-1);
+        BucketTable[Bucket] = RecordsOffset + RecordData.size();
+
+        const struct stat &S = Rec.Result->second;
+        Emit32(RecordData, AddString(Rec.Name, Rec.Name+Rec.NameLen));
+        Emit32(RecordData, Rec.DirIndex);
+        Emit32(RecordData, (uint32_t) Rec.Result->first);
+        Emit32(RecordData, S.st_mode);
+        Emit64(RecordData, S.st_dev);
+        Emit64(RecordData, S.st_ino);
+        Emit64(RecordData, S.st_size);
+        Emit64(RecordData, S.st_mtime);
+    }
+
+    std::string Header(Magic, sizeof(Magic));
+    Emit32(Header, Version);
+    Emit32(Header, DirIndices.size());
+    Emit32(Header, DirTableOffset);
+    Emit32(Header, Bkts);
+    Emit32(Header, BucketsOffset);
+    Emit32(Header, CwdOffset);
+    Emit32(Header, StringsOffset);
+    assert(Header.size() == HeaderSize && "Header size mismatch");
+
+    std::string BucketData;
+    for (unsigned i = 0; i != Bkts; ++i)
+        Emit32(BucketData, BucketTable[i]);
+
+    // Write a private temporary and rename it over the cache, so another run
+    // reading the cache sees either the old or the new version in full.
+    char Suffix[32];
+    snprintf(Suffix, sizeof(Suffix), ".tmp%d", (int) getpid());
+    std::string TmpPath = Path + Suffix;
+    {
+        std::string Error;
+        llvm::raw_fd_ostream OS(TmpPath.c_str(), true, true, Error);
+        if (!Error.empty()) {
+            if (ErrStr) *ErrStr = Error;
+            return false;
+        }
+        OS << Header << DirTableData << BucketData << RecordData << StringData;
+    }
+
+    if (rename(TmpPath.c_str(), Path.c_str())) {
+        if (ErrStr) *ErrStr = "could not replace '" + Path + "'";
+        remove(TmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+void PersistentStatCache::PrintStats() const {
+    fprintf(stderr, "\n*** Stat Cache Stats:\n");
+    fprintf(stderr, "%u stat calls answered from the cache, %u stat'ed "
+                    "(%u stale).\n", NumHits, NumMisses, NumStale);
+    fprintf(stderr, "%u directories checked.\n", (unsigned) Dirs.size());
+}
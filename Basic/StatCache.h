@@ -0,0 +1,117 @@
+/***********************************
+* File:     StatCache.h
+*
+* Author:   agent
+*
+* Email:    agent@local
+*
+* Date:     2026/10/16
+***********************************/
+
+#ifndef CPTOYC_STATCACHE_H
+#define CPTOYC_STATCACHE_H
+
+#include "FileManager.h"
+#include "llvm/OwningPtr.h"
+#include "llvm/StringMap.h"
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+namespace CPToyC {
+    namespace Compiler {
+        class MemoryBuffer;
+
+        /// Stat cache file layout.  Every integer is stored little-endian.
+        ///
+        ///   Header:  Magic[8], Version, NumDirs, DirTableOffset, NumBuckets,
+        ///            BucketsOffset, CwdOffset, StringsOffset
+        ///   Dirs:    NameOffset, Exists, MTime (u64)  -- one entry per directory
+        ///            holding a recorded path, as it was when the path was stat'ed
+        ///   Buckets: offset of a record, 0 if empty -- open addressed by the hash
+        ///            of the path
+        ///   Records: NameOffset, DirIndex, Result, Mode, Device (u64),
+        ///            Inode (u64), Size (u64), MTime (u64)
+        ///   Strings: NUL terminated paths
+        namespace statcache {
+            enum {
+                Version = 1,
+                HeaderSize = 8 + 4*7,
+                DirEntrySize = 4*2 + 8,
+                RecordSize = 4*4 + 8*4
+            };
+
+            extern const char Magic[8];
+        }
+
+        /// PersistentStatCache - A MemorizeStatCalls that is saved at the end of a
+        /// run and mapped back in by the next one, so that a cold process starts
+        /// with the stat results of the last.  The file is an on-disk hash table,
+        /// probed in place; nothing is loaded up front.
+        ///
+        /// Paths that do not exist and directories are answered from the file.
+        /// Every record carries the modification time of the directory holding
+        /// the path when it was stat'ed, and is only trusted while that is
+        /// unchanged, which costs one stat per directory per process.  Regular
+        /// files that exist are not saved: editing a file in place doesn't touch
+        /// its directory, so their size and mtime must come from a fresh stat.
+        /// Relative paths are only trusted in the working directory they were
+        /// recorded in.
+        ///
+        /// The cache may be shared by FileManager lookups from several threads.
+        class PersistentStatCache : public MemorizeStatCalls {
+            /// DirInfo - The state of a directory: whether it exists and its
+            /// modification time in nanoseconds.  Checked is false until the
+            /// directory has been stat'ed.
+            struct DirInfo {
+                bool Checked;
+                bool Exists;
+                int64_t MTime;
+            };
+
+            /// Buf - The stat cache file read in, if any.
+            llvm::OwningPtr<const MemoryBuffer> Buf;
+            const unsigned char *BufStart, *BufEnd;
+            const unsigned char *DirTable, *Buckets, *Strings;
+            unsigned NumDirs, NumBuckets;
+
+            /// SameCwd - True if the file was written in the current working
+            /// directory, so its relative paths mean the same thing.
+            bool SameCwd;
+
+            /// Lock - Guards Dirs, StatCalls and the statistics.
+            std::mutex Lock;
+
+            /// Dirs - The directories stat'ed by this process, by name.
+            llvm::StringMap<DirInfo> Dirs;
+
+            // Statistics.
+            unsigned NumHits, NumMisses, NumStale;
+
+            const DirInfo &getDirInfo(const char *Start, const char *End);
+            const unsigned char *FindRecord(const char *Path, unsigned Len) const;
+            const char *getString(uint32_t Offset) const;
+
+            PersistentStatCache(const PersistentStatCache&); // DO NOT IMPLEMENT
+            void operator=(const PersistentStatCache&);      // DO NOT IMPLEMENT
+        public:
+            PersistentStatCache();
+            virtual ~PersistentStatCache();
+
+            /// ReadFromFile - Map in the cache written by an earlier run.  A missing
+            /// file is an empty cache; a malformed one is reported through ErrStr
+            /// and otherwise ignored.
+            bool ReadFromFile(const std::string &Path, std::string *ErrStr = 0);
+
+            /// WriteToFile - Save the results of this run.  The file is replaced
+            /// atomically, so concurrent runs never see a partial cache.
+            bool WriteToFile(const std::string &Path, std::string *ErrStr = 0);
+
+            virtual int stat(const char *path, struct stat *buf);
+
+            void PrintStats() const;
+        };
+    }
+}
+
+#endif //CPTOYC_STATCACHE_H
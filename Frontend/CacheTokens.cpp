@@ -0,0 +1,293 @@
+/***********************************
+* File:     CacheTokens.cpp
+*
+* Author:   agent
+*
+* Email:    agent@local
+*
+* Date:     2026/10/16
+***********************************/
+
+#include "Utils.h"
+#include "../Lex/Preprocessor.h"
+#include "../Lex/PTHManager.h"
+#include "../Basic/FileManager.h"
+#include "../Basic/IdentifierTable.h"
+#include "../Basic/SourceManager.h"
+#include "../llvm/MemoryBuffer.h"
+#include "../llvm/StringMap.h"
+#include "../llvm/raw_ostream.h"
+#include <string.h>
+#include <utility>
+#include <vector>
+
+using namespace CPToyC::Compiler;
+
+namespace {
+    /// PTHWriter - Lexes every file the preprocessor touched and serializes the
+    /// raw token streams, together with their conditional directive tables, into
+    /// the format read by PTHManager.
+    class PTHWriter {
+        Preprocessor &PP;
+
+        /// IDMap - Maps an identifier name to its persistent ID.
+        llvm::StringMap<unsigned> IDMap;
+        std::vector<uint32_t> IdOffsets;
+
+        /// SpellingMap - Uniques the strings in the spelling pool.
+        llvm::StringMap<uint32_t> SpellingMap;
+        std::string Spellings;
+
+        /// TokenData - The token streams and PPCond tables of all files.  Offsets
+        ///  recorded in FileTable are relative to the start of the PTH file.
+        std::string TokenData;
+        std::string FileTable;
+        unsigned NumFiles;
+
+        static void Emit32(std::string &Out, uint32_t V) {
+            Out += (char) (V & 0xFF);
+            Out += (char) ((V >> 8) & 0xFF);
+            Out += (char) ((V >> 16) & 0xFF);
+            Out += (char) ((V >> 24) & 0xFF);
+        }
+
+        static void Emit64(std::string &Out, uint64_t V) {
+            Emit32(Out, (uint32_t) V);
+            Emit32(Out, (uint32_t) (V >> 32));
+        }
+
+        uint32_t GetSpelling(const char *Start, unsigned Len);
+        uint32_t ResolveID(const Token &Tok, std::string &Name);
+        void EmitToken(std::string &Out, const Token &Tok, uint32_t IdOrSpelling);
+        bool LexTokens(FileID FID, std::string &Out,
+                       std::vector<std::pair<uint32_t, uint32_t> > &PPCond);
+
+    public:
+        PTHWriter(Preprocessor &pp) : PP(pp), NumFiles(0) {}
+
+        void GeneratePTH(llvm::raw_ostream &OS);
+    };
+}
+
+/// GetSpelling - Add the string to the spelling pool (once) and return its
+/// offset.
+uint32_t PTHWriter::GetSpelling(const char *Start, unsigned Len) {
+    llvm::StringMapEntry<uint32_t> &E = SpellingMap.GetOrCreateValue(
+            llvm::StringRef(Start, Len), ~0U);
+    if (E.getValue() != ~0U)
+        return E.getValue();
+
+    uint32_t Offset = Spellings.size();
+    Spellings.append(Start, Len);
+    Spellings += '\0';
+    E.setValue(Offset);
+    return Offset;
+}
+
+/// ResolveID - Return the persistent ID of the identifier spelled by Tok, plus
+/// one so that zero can mean "no identifier".
+uint32_t PTHWriter::ResolveID(const Token &Tok, std::string &Name) {
+    Name = PP.getSpelling(Tok);
+    llvm::StringMapEntry<unsigned> &E = IDMap.GetOrCreateValue(
+            llvm::StringRef(Name.data(), Name.size()), 0);
+    if (E.getValue() == 0) {
+        IdOffsets.push_back(GetSpelling(Name.data(), Name.size()));
+        E.setValue(IdOffsets.size());
+    }
+    return E.getValue();
+}
+
+void PTHWriter::EmitToken(std::string &Out, const Token &Tok,
+                          uint32_t IdOrSpelling) {
+    Emit32(Out, ((uint32_t) Tok.getKind()) | ((Tok.getFlags() & 0xFF) << 8) |
+                (Tok.getLength() << 16));
+    Emit32(Out, IdOrSpelling);
+    Emit32(Out, PP.getSourceManager().getFileOffset(Tok.getLocation()));
+}
+
+/// LexTokens - Raw lex the file, mirroring the token stream Lexer would hand
+/// the preprocessor: directives are lexed in directive mode so they end with an
+/// eom, and #include operands are lexed as filenames.  Returns false if the file
+/// cannot be represented (unbalanced conditionals or an oversized token).
+bool PTHWriter::LexTokens(FileID FID, std::string &Out,
+                          std::vector<std::pair<uint32_t, uint32_t> > &PPCond) {
+    SourceManager &SM = PP.getSourceManager();
+    Lexer L(FID, SM, PP.getLangOptions());
+
+    // PPStartCond - The PPCond entry of the innermost open #if/#elif/#else.
+    std::vector<unsigned> PPStartCond;
+    unsigned NumToks = 0;
+    std::string Name;
+    Token Tok;
+
+    while (1) {
+        L.LexFromRawLexer(Tok);
+        if (Tok.is(tok::eof))
+            break;
+        if (Tok.getLength() > 0xFFFF)
+            return false;
+
+        if (Tok.is(tok::identifier)) {
+            EmitToken(Out, Tok, ResolveID(Tok, Name));
+        } else if (Tok.isLiteral()) {
+            const char *Start = SM.getCharacterData(Tok.getLocation());
+            EmitToken(Out, Tok, GetSpelling(Start, Tok.getLength()));
+        } else {
+            EmitToken(Out, Tok, 0);
+        }
+        ++NumToks;
+
+        if (Tok.isNot(tok::hash) || !Tok.isAtStartOfLine())
+            continue;
+
+        // A '#' at the start of a line: lex the directive name in directive mode.
+        unsigned HashIdx = NumToks - 1;
+        L.setParsingPreprocessorDirective(true);
+        L.LexFromRawLexer(Tok);
+        if (Tok.isNot(tok::identifier)) {
+            // "#\n", "# 1 ..." and the like.  The line is lexed as usual.
+            EmitToken(Out, Tok, 0);
+            ++NumToks;
+            continue;
+        }
+        EmitToken(Out, Tok, ResolveID(Tok, Name));
+        ++NumToks;
+
+        switch (PP.getIdentifierInfo(Name.c_str())->getPPKeywordID()) {
+            default:
+                break;
+            case tok::pp_include:
+            case tok::pp_include_next:
+            case tok::pp_import:
+            case tok::pp___include_macros:
+                L.LexIncludeFilename(Tok);
+                if (Tok.getLength() > 0xFFFF)
+                    return false;
+                if (Tok.is(tok::identifier))
+                    EmitToken(Out, Tok, ResolveID(Tok, Name));
+                else if (Tok.isLiteral())
+                    EmitToken(Out, Tok, GetSpelling(SM.getCharacterData(Tok.getLocation()),
+                                                    Tok.getLength()));
+                else
+                    EmitToken(Out, Tok, 0);
+                ++NumToks;
+                break;
+            case tok::pp_if:
+            case tok::pp_ifdef:
+            case tok::pp_ifndef:
+                PPStartCond.push_back(PPCond.size());
+                PPCond.push_back(std::make_pair(HashIdx, 0U));
+                break;
+            case tok::pp_elif:
+            case tok::pp_else:
+                if (PPStartCond.empty())
+                    return false;
+                // Link the previous block of this conditional to this one.
+                PPCond[PPStartCond.back()].second = PPCond.size();
+                PPStartCond.back() = PPCond.size();
+                PPCond.push_back(std::make_pair(HashIdx, 0U));
+                break;
+            case tok::pp_endif:
+                if (PPStartCond.empty())
+                    return false;
+                PPCond[PPStartCond.back()].second = PPCond.size();
+                PPStartCond.pop_back();
+                // #endif entries have a target of zero.
+                PPCond.push_back(std::make_pair(HashIdx, 0U));
+                break;
+        }
+    }
+
+    if (!PPStartCond.empty())
+        return false;
+
+    // Place the eof where Preprocessor::HandleEndOfFile puts it: on the final
+    // newline, rather than on the line following it.
+    const MemoryBuffer *Buf = SM.getBuffer(FID);
+    const char *BufStart = Buf->getBufferStart();
+    const char *EndPos = Buf->getBufferEnd();
+    if (EndPos != BufStart && (EndPos[-1] == '\n' || EndPos[-1] == '\r')) {
+        --EndPos;
+
+        // Handle \n\r and \r\n:
+        if (EndPos != BufStart && (EndPos[-1] == '\n' || EndPos[-1] == '\r') &&
+            EndPos[-1] != EndPos[0])
+            --EndPos;
+    }
+    Emit32(Out, (uint32_t) tok::eof);
+    Emit32(Out, 0);
+    Emit32(Out, EndPos - BufStart);
+    return true;
+}
+
+void PTHWriter::GeneratePTH(llvm::raw_ostream &OS) {
+    SourceManager &SM = PP.getSourceManager();
+    std::vector<std::pair<uint32_t, uint32_t> > PPCond;
+    std::string Toks;
+
+    for (SourceManager::fileinfo_iterator I = SM.fileinfo_begin(),
+                 E = SM.fileinfo_end(); I != E; ++I) {
+        const ContentCache *C = I->second;
+        const FileEntry *FE = C->Entry;
+        if (!FE || C->FirstFID.isInvalid() || !C->getBuffer())
+            continue;
+
+        // Record the file as it is on disk, with its mtime in nanoseconds.
+        uint64_t Size, ModTime;
+        if (!pth::StatFile(FE->getName(), Size, ModTime))
+            continue;
+
+        Toks.clear();
+        PPCond.clear();
+        if (!LexTokens(C->FirstFID, Toks, PPCond))
+            continue;
+
+        uint32_t TokenOffset = pth::HeaderSize + TokenData.size();
+        TokenData += Toks;
+        uint32_t PPCondOffset = pth::HeaderSize + TokenData.size();
+        for (unsigned i = 0, e = PPCond.size(); i != e; ++i) {
+            Emit32(TokenData, PPCond[i].first);
+            Emit32(TokenData, PPCond[i].second);
+        }
+
+        Emit32(FileTable, GetSpelling(FE->getName(), strlen(FE->getName())));
+        Emit32(FileTable, TokenOffset);
+        Emit32(FileTable, PPCondOffset);
+        Emit32(FileTable, PPCond.size());
+        Emit64(FileTable, Size);
+        Emit64(FileTable, ModTime);
+        ++NumFiles;
+    }
+
+    uint32_t FileTableOffset = pth::HeaderSize + TokenData.size();
+    uint32_t IdTableOffset = FileTableOffset + FileTable.size();
+    uint32_t SpellingsOffset = IdTableOffset + IdOffsets.size()*4;
+
+    std::string Header(pth::Magic, sizeof(pth::Magic));
+    Emit32(Header, pth::Version);
+    Emit32(Header, NumFiles);
+    Emit32(Header, FileTableOffset);
+    Emit32(Header, IdOffsets.size());
+    Emit32(Header, IdTableOffset);
+    Emit32(Header, SpellingsOffset);
+    assert(Header.size() == pth::HeaderSize && "Header size mismatch");
+
+    std::string IdTable;
+    for (unsigned i = 0, e = IdOffsets.size(); i != e; ++i)
+        Emit32(IdTable, IdOffsets[i]);
+
+    OS << Header << TokenData << FileTable << IdTable << Spellings;
+}
+
+/// CacheTokens - Preprocess the main file, then write the tokens of every file
+/// it touched to OS as a pre-tokenized header.
+void CPToyC::Compiler::CacheTokens(Preprocessor &PP, llvm::raw_fd_ostream *OS) {
+    // Lex through the entire file.  This will populate SourceManager with
+    // all of the header information.
+    Token Tok;
+    PP.EnterMainSourceFile();
+    do { PP.Lex(Tok); } while (Tok.isNot(tok::eof));
+
+    PTHWriter PW(PP);
+    PW.GeneratePTH(*OS);
+}
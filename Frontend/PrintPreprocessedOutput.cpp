@@ -16,6 +16,7 @@
 #include "../Basic/Diagnostic.h"
 #include "../Lex/MacroInfo.h"
 #include "../Lex/PPCallbacks.h"
+#include "../Lex/Pragma.h"
 #include "../Lex/TokenConcatenation.h"
 
 using namespace CPToyC::Compiler;
@@ -101,6 +102,16 @@ namespace {
         }
 
         void SetEmittedTokensOnThisLine() { EmittedTokensOnThisLine = true; }
+
+        /// StartNewLineIfNeeded - Terminate the current output line if anything
+        /// has been printed on it, e.g. before emitting a directive.
+        void StartNewLineIfNeeded() {
+            if (EmittedTokensOnThisLine || EmittedMacroOnThisLine) {
+                OS << '\n';
+                EmittedTokensOnThisLine = false;
+                EmittedMacroOnThisLine = false;
+            }
+        }
         bool hasEmittedTokensOnThisLine() const { return EmittedTokensOnThisLine; }
 
         virtual void FileChanged(SourceLocation Loc, FileChangeReason Reason,
@@ -152,7 +163,7 @@ void PrintPPOutputPPCallbacks::WriteLineInfo(unsigned LineNo,
 /// #line directive.  This returns false if already at the specified line, true
 /// if some newlines were emitted.
 bool PrintPPOutputPPCallbacks::MoveToLine(SourceLocation Loc) {
-    unsigned LineNo = PP.getSourceManager().getInstantiationLineNumber(Loc);
+    unsigned LineNo = PP.getInstantiationLineNumber(Loc);
 
     if (DisableLineMarkers) {
         if (LineNo == CurLine) return false;
@@ -198,7 +209,8 @@ void PrintPPOutputPPCallbacks::FileChanged(SourceLocation Loc,
     // #include directive was at.
     SourceManager &SourceMgr = PP.getSourceManager();
     if (Reason == PPCallbacks::EnterFile) {
-        SourceLocation IncludeLoc = SourceMgr.getPresumedLoc(Loc).getIncludeLoc();
+        SourceLocation IncludeLoc =
+                SourceMgr.getPresumedLoc(Loc, false).getIncludeLoc();
         if (IncludeLoc.isValid())
             MoveToLine(IncludeLoc);
     } else if (Reason == PPCallbacks::SystemHeaderPragma) {
@@ -211,12 +223,12 @@ void PrintPPOutputPPCallbacks::FileChanged(SourceLocation Loc,
 
     Loc = SourceMgr.getInstantiationLoc(Loc);
     // FIXME: Should use presumed line #!
-    CurLine = SourceMgr.getInstantiationLineNumber(Loc);
+    CurLine = PP.getInstantiationLineNumber(Loc);
 
     if (DisableLineMarkers) return;
 
     CurFilename.clear();
-    CurFilename += SourceMgr.getPresumedLoc(Loc).getFilename();
+    CurFilename += SourceMgr.getPresumedLoc(Loc, false).getFilename();
     Lexer::Stringify(CurFilename);
     FileType = NewFileType;
 
@@ -317,6 +329,35 @@ void PrintPPOutputPPCallbacks::HandleNewlinesInToken(const char *TokStr,
     CurLine += NumNewlines;
 }
 
+namespace {
+    /// UnknownPragmaHandler - Pragmas the preprocessor doesn't consume itself are
+    /// passed through to the output unchanged.
+    struct UnknownPragmaHandler : public PragmaHandler {
+        const char *Prefix;
+        PrintPPOutputPPCallbacks *Callbacks;
+
+        UnknownPragmaHandler(const char *prefix, PrintPPOutputPPCallbacks *callbacks)
+                : PragmaHandler(0), Prefix(prefix), Callbacks(callbacks) {}
+        virtual void HandlePragma(Preprocessor &PP, Token &PragmaTok) {
+            // Figure out what line we went to and insert the appropriate number of
+            // newline characters.
+            Callbacks->MoveToLine(PragmaTok.getLocation());
+            Callbacks->StartNewLineIfNeeded();
+            Callbacks->OS.write(Prefix, strlen(Prefix));
+
+            // Read and print all of the pragma tokens.
+            while (PragmaTok.isNot(tok::eom)) {
+                if (PragmaTok.hasLeadingSpace())
+                    Callbacks->OS << ' ';
+                std::string TokSpell = PP.getSpelling(PragmaTok);
+                Callbacks->OS.write(&TokSpell[0], TokSpell.size());
+                PP.LexUnexpandedToken(PragmaTok);
+            }
+            Callbacks->OS << '\n';
+        }
+    };
+} // end anonymous namespace
+
 static void PrintPreprocessedTokens(Preprocessor &PP, Token &Tok,
                                     PrintPPOutputPPCallbacks *Callbacks,
                                     llvm::raw_ostream &OS) {
@@ -418,10 +459,8 @@ void CPToyC::Compiler::DoPrintPreprocessedInput(Preprocessor &PP, llvm::raw_ostr
     PrintPPOutputPPCallbacks *Callbacks =
             new PrintPPOutputPPCallbacks(PP, *OS, DisableLineMarkers, DumpDefines);
 
-#if 0
     PP.AddPragmaHandler(0, new UnknownPragmaHandler("#pragma", Callbacks));
     PP.AddPragmaHandler("GCC", new UnknownPragmaHandler("#pragma GCC",Callbacks));
-#endif
 
     PP.setPPCallbacks(Callbacks);
 
@@ -435,7 +474,7 @@ void CPToyC::Compiler::DoPrintPreprocessedInput(Preprocessor &PP, llvm::raw_ostr
     Token Tok;
     do PP.Lex(Tok);
     while (Tok.isNot(tok::eof) && Tok.getLocation().isFileID() &&
-           !strcmp(SourceMgr.getPresumedLoc(Tok.getLocation()).getFilename(),
+           !strcmp(SourceMgr.getPresumedLoc(Tok.getLocation(), false).getFilename(),
                    "<built-in>"));
 
     // Read all the preprocessed tokens, printing them out to the stream.
@@ -13,6 +13,7 @@
 
 namespace llvm {
     class raw_ostream;
+    class raw_fd_ostream;
 }
 
 namespace CPToyC {
@@ -27,6 +28,10 @@ namespace CPToyC {
                                       bool EnableMacroCommentOutput,
                                       bool DisableLineMarkers,
                                       bool DumpDefines);
+
+        /// CacheTokens - Implement -emit-pth: write the tokens of every file the
+        /// main file pulls in as a pre-tokenized header.
+        void CacheTokens(Preprocessor &PP, llvm::raw_fd_ostream* OS);
     }
 }
 
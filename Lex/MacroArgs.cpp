@@ -20,15 +20,44 @@ using namespace CPToyC::Compiler;
 /// MacroArgs ctor function - This destroys the vector passed in.
 MacroArgs *MacroArgs::create(const MacroInfo *MI,
                              const Token *UnexpArgTokens,
-                             unsigned NumToks, bool VarargsElided) {
+                             unsigned NumToks, bool VarargsElided,
+                             Preprocessor &PP) {
     assert(MI->isFunctionLike() &&
            "Can't have args for an object-like macro!");
 
-    // Allocate memory for the MacroArgs object with the lexer tokens at the end.
-    MacroArgs *Result = (MacroArgs*)malloc(sizeof(MacroArgs) +
-                                           NumToks*sizeof(Token));
-    // Construct the macroargs object.
-    new (Result) MacroArgs(NumToks, VarargsElided);
+    // See if we have an entry with a big enough argument list to reuse on the
+    // free list.  If so, reuse it.  Take the smallest one that fits.
+    MacroArgs **ResultEnt = 0;
+    unsigned ClosestMatch = ~0U;
+    for (MacroArgs **Entry = &PP.MacroArgCache; *Entry;
+         Entry = &(*Entry)->ArgCache) {
+        unsigned Size = (*Entry)->NumTokensAllocated;
+        if (Size >= NumToks && Size < ClosestMatch) {
+            ResultEnt = Entry;
+            // If we have an exact match, use it.
+            if (Size == NumToks)
+                break;
+            ClosestMatch = Size;
+        }
+    }
+
+    MacroArgs *Result;
+    if (ResultEnt == 0) {
+        // Allocate memory for the MacroArgs object with the lexer tokens at the
+        // end.
+        Result = (MacroArgs*)malloc(sizeof(MacroArgs) + NumToks*sizeof(Token));
+        // Construct the macroargs object.
+        new (Result) MacroArgs(NumToks, VarargsElided);
+        ++PP.NumMacroArgsAllocated;
+    } else {
+        Result = *ResultEnt;
+        // Unlink this node from the preprocessors singly linked list.
+        *ResultEnt = Result->ArgCache;
+        Result->ArgCache = 0;
+        Result->NumUnexpArgTokens = NumToks;
+        Result->VarargsElided = VarargsElided;
+        ++PP.NumMacroArgsReused;
+    }
 
     // Copy the actual unexpanded tokens to immediately after the result ptr.
     if (NumToks)
@@ -40,11 +69,30 @@ MacroArgs *MacroArgs::create(const MacroInfo *MI,
 
 /// destroy - Destroy and deallocate the memory for this object.
 ///
-void MacroArgs::destroy() {
+void MacroArgs::destroy(Preprocessor &PP) {
+    StringifiedArgs.clear();
+
+    // Don't clear PreExpArgTokens, just clear the entries.  Clearing the entries
+    // would deallocate the element vectors.
+    for (unsigned i = 0, e = PreExpArgTokens.size(); i != e; ++i)
+        PreExpArgTokens[i].clear();
+
+    // Add this to the preprocessor's free list.
+    ArgCache = PP.MacroArgCache;
+    PP.MacroArgCache = this;
+}
+
+/// deallocate - This should only be called by the Preprocessor when managing
+/// its freelist.
+MacroArgs *MacroArgs::deallocate() {
+    MacroArgs *Next = ArgCache;
+
     // Run the dtor to deallocate the vectors.
     this->~MacroArgs();
     // Release the memory for the object.
     free(this);
+
+    return Next;
 }
 
 
@@ -99,8 +147,9 @@ const std::vector<Token> &
 MacroArgs::getPreExpArgument(unsigned Arg, Preprocessor &PP) {
     assert(Arg < NumUnexpArgTokens && "Invalid argument number!");
 
-    // If we have already computed this, return it.
-    if (PreExpArgTokens.empty())
+    // If we have already computed this, return it.  A MacroArgs taken from the
+    // free list may have room for fewer arguments than this expansion has.
+    if (PreExpArgTokens.size() < NumUnexpArgTokens)
         PreExpArgTokens.resize(NumUnexpArgTokens);
 
     std::vector<Token> &Result = PreExpArgTokens[Arg];
@@ -28,6 +28,11 @@ namespace CPToyC {
             /// concatenated together, with 'EOF' markers at the end of each argument.
             unsigned NumUnexpArgTokens;
 
+            /// NumTokensAllocated - The number of tokens there is room for after the
+            /// object.  A MacroArgs reused from the preprocessor's free list may hold
+            /// fewer arguments than it was allocated for.
+            unsigned NumTokensAllocated;
+
             /// PreExpArgTokens - Pre-expanded tokens for arguments that need them.  Empty
             /// if not yet computed.  This includes the EOF marker at the end of the
             /// stream.
@@ -44,19 +49,32 @@ namespace CPToyC {
             /// is false.
             bool VarargsElided;
 
+            /// ArgCache - This is a linked list of MacroArgs objects that the
+            /// Preprocessor owns which we use to avoid thrashing malloc/free.
+            MacroArgs *ArgCache;
+
             MacroArgs(unsigned NumToks, bool varargsElided)
-                    : NumUnexpArgTokens(NumToks), VarargsElided(varargsElided) {}
+                    : NumUnexpArgTokens(NumToks), NumTokensAllocated(NumToks),
+                      VarargsElided(varargsElided), ArgCache(0) {}
             ~MacroArgs() {}
         public:
             /// MacroArgs ctor function - Create a new MacroArgs object with the specified
             /// macro and argument info.
             static MacroArgs *create(const MacroInfo *MI,
                                      const Token *UnexpArgTokens,
-                                     unsigned NumArgTokens, bool VarargsElided);
+                                     unsigned NumArgTokens, bool VarargsElided,
+                                     Preprocessor &PP);
 
-            /// destroy - Destroy and deallocate the memory for this object.
+            /// destroy - Destroy and deallocate the memory for this object.  The
+            /// object is put on the preprocessor's free list, keeping the storage of
+            /// its pre-expanded and stringified arguments for the next expansion.
             ///
-            void destroy();
+            void destroy(Preprocessor &PP);
+
+            /// deallocate - This should only be called by the Preprocessor when
+            /// managing its cache of MacroArgs objects.  It returns the next object
+            /// on the free list.
+            MacroArgs *deallocate();
 
             /// ArgNeedsPreexpansion - If we can prove that the argument won't be affected
             /// by pre-expansion, return false.  Otherwise, conservatively return true.
@@ -20,6 +20,7 @@ MacroInfo::MacroInfo(SourceLocation DefLoc) : Location(DefLoc) {
     IsBuiltinMacro = false;
     IsDisabled = false;
     IsUsed = true;
+    Generation = 0;
 
     ArgumentList = nullptr;
     NumArguments = 0;
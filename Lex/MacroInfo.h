@@ -59,6 +59,12 @@ namespace CPToyC {
             /// it has not yet been redefined or undefined.
             bool IsBuiltinMacro : 1;
 
+            /// Generation - The value of the preprocessor's macro generation counter
+            /// when this definition was installed.  It changes whenever the macro is
+            /// defined or undefined, so a user that remembers it can tell whether the
+            /// definition it saw is still the one in effect.
+            unsigned Generation;
+
         private:
             //===--------------------------------------------------------------------===//
             // State that changes as the macro is used.
@@ -110,6 +116,11 @@ namespace CPToyC {
             /// duplicate definition warnings.  This implements the rules in C99 6.10.3.
             bool isIdenticalTo(const MacroInfo &Other, Preprocessor &PP) const;
 
+            /// setGeneration/getGeneration - The generation of this definition.
+            ///
+            void setGeneration(unsigned Gen) { Generation = Gen; }
+            unsigned getGeneration() const { return Generation; }
+
             /// setIsBuiltinMacro - Set or clear the isBuiltinMacro flag.
             ///
             void setIsBuiltinMacro(bool Val = true) {
@@ -15,6 +15,7 @@
 #include "LiteralSupport.h"
 #include "LexDiagnostic.h"
 #include "llvm/APInt.h"
+#include <algorithm>
 
 using namespace CPToyC::Compiler;
 
@@ -142,11 +143,58 @@ void Preprocessor::SkipExcludedConditionalBlock(SourceLocation IfTokenLoc,
     CurPPLexer->pushConditionalLevel(IfTokenLoc, /*isSkipping*/false,
                                      FoundNonSkipPortion, FoundElse);
 
+    if (CurPTHLexer) {
+        PTHSkipExcludedConditionalBlock();
+        return;
+    }
+
+    // The stretches between the directives of this conditional are looked up in,
+    // and recorded into, SkipRanges.  Only files have a stable identity.
+    const FileEntry *SkipFile = 0;
+    if (CurLexer && !CurLexer->isPragmaLexer())
+        SkipFile = SourceMgr.getFileEntryForID(CurLexer->getFileID());
+    unsigned OuterDepth = CurPPLexer->getConditionalStackDepth();
+    bool AtStretchStart = SkipFile != 0;
+    unsigned StretchStart = ~0U, StretchDiags = 0;
+
+    // Between directives, the lexer is moved along the lines that start with
+    // '#'.  When a hazard is in the way, the text up to it is lexed as usual,
+    // and the index is looked at again once the lexer is past it.
+    const DirectiveIndex *Directives = 0;
+    const char *NextIndexCheck = 0;
+    if (CurLexer && !CurLexer->isPragmaLexer()) {
+        Directives = &SourceMgr.getDirectiveIndex(CurLexer->getFileID());
+        NextIndexCheck = CurLexer->BufferPtr;
+    }
+
     // Enter raw mode to disable identifier lookup (and thus macro expansion),
     // disabling warnings, etc.
     CurPPLexer->LexingRawMode = true;
     Token Tok;
     while (1) {
+        if (AtStretchStart) {
+            AtStretchStart = false;
+            unsigned Offset = CurLexer->BufferPtr - CurLexer->BufferStart;
+            llvm::DenseMap<std::pair<const FileEntry*, unsigned>, unsigned>::iterator
+                    I = SkipRanges.find(std::make_pair(SkipFile, Offset));
+            if (I != SkipRanges.end()) {
+                // Skipped before: resume at the '#' of the directive that ended it.
+                ++NumSkipRangeHits;
+                CurLexer->BufferPtr = CurLexer->BufferStart + I->second;
+                CurLexer->IsAtStartOfLine = true;
+
+                // The directive may follow a comment on its line, so it need not
+                // be in the directive index: lex it before consulting the index.
+                NextIndexCheck = CurLexer->BufferPtr + 1;
+            } else {
+                StretchStart = Offset;
+                StretchDiags = Diags->getNumDiagnostics();
+            }
+        }
+
+        if (Directives && CurLexer->BufferPtr >= NextIndexCheck)
+            NextIndexCheck = SkipToNextDirectiveLine(*Directives);
+
         if (CurLexer)
             CurLexer->Lex(Tok);
 
@@ -167,6 +215,7 @@ void Preprocessor::SkipExcludedConditionalBlock(SourceLocation IfTokenLoc,
         // If this token is not a preprocessor directive, just skip it.
         if (Tok.isNot(tok::hash) || !Tok.isAtStartOfLine())
             continue;
+        SourceLocation HashLoc = Tok.getLocation();
 
         // We just parsed a # character at the start of a line, so we're in
         // directive mode.  Tell the lexer this so any newlines we see will be
@@ -202,100 +251,94 @@ void Preprocessor::SkipExcludedConditionalBlock(SourceLocation IfTokenLoc,
             continue;
         }
 
-        // Get the identifier name without trigraphs or embedded newlines.  Note
-        // that we can't use Tok.getIdentifierInfo() because its lookup is disabled
-        // when skipping.
-        // TODO: could do this with zero copies in the no-clean case by using
-        // strncmp below.
-        char Directive[20];
-        unsigned IdLen;
-        if (!Tok.needsCleaning() && Tok.getLength() < 20) {
-            IdLen = Tok.getLength();
-            memcpy(Directive, RawCharData, IdLen);
-            Directive[IdLen] = 0;
+        // Classify the directive name without trigraphs or embedded newlines.
+        // Note that we can't use Tok.getIdentifierInfo() because its lookup is
+        // disabled when skipping; the keyword hash needs no table lookup.
+        tok::PPKeywordKind K;
+        if (!Tok.needsCleaning()) {
+            K = tok::getPPKeywordID(RawCharData, Tok.getLength());
         } else {
             std::string DirectiveStr = getSpelling(Tok);
-            IdLen = DirectiveStr.size();
-            if (IdLen >= 20) {
-                CurPPLexer->ParsingPreprocessorDirective = false;
-                // Restore comment saving mode.
-                if (CurLexer) CurLexer->SetCommentRetentionState(KeepComments);
-                continue;
+            K = tok::getPPKeywordID(DirectiveStr.data(), DirectiveStr.size());
+        }
+
+        // An #elif, #else or #endif of this conditional ends the stretch being
+        // skipped.  If skipping goes on past it, the next stretch starts after it.
+        if ((K == tok::pp_endif || K == tok::pp_else || K == tok::pp_elif) &&
+            SkipFile && CurPPLexer->getConditionalStackDepth() == OuterDepth) {
+            if (StretchStart != ~0U &&
+                StretchDiags == Diags->getNumDiagnostics()) {
+                SkipRanges[std::make_pair(SkipFile, StretchStart)] =
+                        SourceMgr.getFileOffset(HashLoc);
+                ++NumSkipRangesRecorded;
             }
-            memcpy(Directive, &DirectiveStr[0], IdLen);
-            Directive[IdLen] = 0;
-            FirstChar = Directive[0];
+            StretchStart = ~0U;
+            AtStretchStart = true;
         }
 
-        if (FirstChar == 'i' && Directive[1] == 'f') {
-            if ((IdLen == 2) ||   // "if"
-                (IdLen == 5 && !strcmp(Directive+2, "def")) ||   // "ifdef"
-                (IdLen == 6 && !strcmp(Directive+2, "ndef"))) {  // "ifndef"
-                // We know the entire #if/#ifdef/#ifndef block will be skipped, don't
-                // bother parsing the condition.
+        if (K == tok::pp_if || K == tok::pp_ifdef || K == tok::pp_ifndef) {
+            // We know the entire #if/#ifdef/#ifndef block will be skipped, don't
+            // bother parsing the condition.
+            DiscardUntilEndOfDirective();
+            CurPPLexer->pushConditionalLevel(Tok.getLocation(), /*wasskipping*/true,
+                    /*foundnonskip*/false,
+                    /*fnddelse*/false);
+        } else if (K == tok::pp_endif) {
+            CheckEndOfDirective("endif");
+            PPConditionalInfo CondInfo;
+            CondInfo.WasSkipping = true; // Silence bogus warning.
+            bool InCond = CurPPLexer->popConditionalLevel(CondInfo);
+            InCond = InCond;  // Silence warning in no-asserts mode.
+            assert(!InCond && "Can't be skipping if not in a conditional!");
+
+            // If we popped the outermost skipping block, we're done skipping!
+            if (!CondInfo.WasSkipping)
+                break;
+        } else if (K == tok::pp_else) {
+            // #else directive in a skipping conditional.  If not in some other
+            // skipping conditional, and if #else hasn't already been seen, enter it
+            // as a non-skipping conditional.
+            DiscardUntilEndOfDirective();  // C99 6.10p4.
+            PPConditionalInfo &CondInfo = CurPPLexer->peekConditionalLevel();
+
+            // If this is a #else with a #else before it, report the error.
+            if (CondInfo.FoundElse) Diag(Tok, diag::pp_err_else_after_else);
+
+            // Note that we've seen a #else in this conditional.
+            CondInfo.FoundElse = true;
+
+            // If the conditional is at the top level, and the #if block wasn't
+            // entered, enter the #else block now.
+            if (!CondInfo.WasSkipping && !CondInfo.FoundNonSkip) {
+                CondInfo.FoundNonSkip = true;
+                break;
+            }
+        } else if (K == tok::pp_elif) {
+            PPConditionalInfo &CondInfo = CurPPLexer->peekConditionalLevel();
+
+            bool ShouldEnter;
+            // If this is in a skipping block or if we're already handled this #if
+            // block, don't bother parsing the condition.
+            if (CondInfo.WasSkipping || CondInfo.FoundNonSkip) {
                 DiscardUntilEndOfDirective();
-                CurPPLexer->pushConditionalLevel(Tok.getLocation(), /*wasskipping*/true,
-                        /*foundnonskip*/false,
-                        /*fnddelse*/false);
+                ShouldEnter = false;
+            } else {
+                // Restore the value of LexingRawMode so that identifiers are
+                // looked up, etc, inside the #elif expression.
+                assert(CurPPLexer->LexingRawMode && "We have to be skipping here!");
+                CurPPLexer->LexingRawMode = false;
+                IdentifierInfo *IfNDefMacro = 0;
+                ShouldEnter = EvaluateDirectiveExpression(IfNDefMacro);
+                CurPPLexer->LexingRawMode = true;
             }
-        } else if (FirstChar == 'e') {
-            if (IdLen == 5 && !strcmp(Directive+1, "ndif")) {  // "endif"
-                CheckEndOfDirective("endif");
-                PPConditionalInfo CondInfo;
-                CondInfo.WasSkipping = true; // Silence bogus warning.
-                bool InCond = CurPPLexer->popConditionalLevel(CondInfo);
-                InCond = InCond;  // Silence warning in no-asserts mode.
-                assert(!InCond && "Can't be skipping if not in a conditional!");
-
-                // If we popped the outermost skipping block, we're done skipping!
-                if (!CondInfo.WasSkipping)
-                    break;
-            } else if (IdLen == 4 && !strcmp(Directive+1, "lse")) { // "else".
-                // #else directive in a skipping conditional.  If not in some other
-                // skipping conditional, and if #else hasn't already been seen, enter it
-                // as a non-skipping conditional.
-                DiscardUntilEndOfDirective();  // C99 6.10p4.
-                PPConditionalInfo &CondInfo = CurPPLexer->peekConditionalLevel();
-
-                // If this is a #else with a #else before it, report the error.
-                if (CondInfo.FoundElse) Diag(Tok, diag::pp_err_else_after_else);
-
-                // Note that we've seen a #else in this conditional.
-                CondInfo.FoundElse = true;
-
-                // If the conditional is at the top level, and the #if block wasn't
-                // entered, enter the #else block now.
-                if (!CondInfo.WasSkipping && !CondInfo.FoundNonSkip) {
-                    CondInfo.FoundNonSkip = true;
-                    break;
-                }
-            } else if (IdLen == 4 && !strcmp(Directive+1, "lif")) {  // "elif".
-                PPConditionalInfo &CondInfo = CurPPLexer->peekConditionalLevel();
-
-                bool ShouldEnter;
-                // If this is in a skipping block or if we're already handled this #if
-                // block, don't bother parsing the condition.
-                if (CondInfo.WasSkipping || CondInfo.FoundNonSkip) {
-                    DiscardUntilEndOfDirective();
-                    ShouldEnter = false;
-                } else {
-                    // Restore the value of LexingRawMode so that identifiers are
-                    // looked up, etc, inside the #elif expression.
-                    assert(CurPPLexer->LexingRawMode && "We have to be skipping here!");
-                    CurPPLexer->LexingRawMode = false;
-                    IdentifierInfo *IfNDefMacro = 0;
-                    ShouldEnter = EvaluateDirectiveExpression(IfNDefMacro);
-                    CurPPLexer->LexingRawMode = true;
-                }
 
-                // If this is a #elif with a #else before it, report the error.
-                if (CondInfo.FoundElse) Diag(Tok, diag::pp_err_elif_after_else);
+            // If this is a #elif with a #else before it, report the error.
+            if (CondInfo.FoundElse) Diag(Tok, diag::pp_err_elif_after_else);
 
-                // If this condition is true, enter it!
-                if (ShouldEnter) {
-                    CondInfo.FoundNonSkip = true;
-                    break;
-                }
+            // If this condition is true, enter it!
+            if (ShouldEnter) {
+                CondInfo.FoundNonSkip = true;
+                break;
             }
         }
 
@@ -310,6 +353,126 @@ void Preprocessor::SkipExcludedConditionalBlock(SourceLocation IfTokenLoc,
     CurPPLexer->LexingRawMode = false;
 }
 
+/// SkipToNextDirectiveLine - Move the lexer, which is skipping and between
+/// tokens, to the next line starting with '#', or to the line of the next
+/// hazard if that comes first.  Either way, everything passed over is known to
+/// be free of directives.  Returns the position the lexer must have passed
+/// before this is worth calling again.
+const char *Preprocessor::SkipToNextDirectiveLine(const DirectiveIndex &DI) {
+    const char *BufferStart = CurLexer->BufferStart;
+    unsigned Pos = CurLexer->BufferPtr - BufferStart;
+
+    std::vector<unsigned>::const_iterator Hazard =
+            std::lower_bound(DI.Hazards.begin(), DI.Hazards.end(), Pos);
+    std::vector<unsigned>::const_iterator Hash =
+            std::lower_bound(DI.Hashes.begin(), DI.Hashes.end(), Pos);
+    unsigned HashOffset = Hash != DI.Hashes.end()
+            ? *Hash : CurLexer->BufferEnd - BufferStart;
+
+    if (Hazard == DI.Hazards.end() || HashOffset < *Hazard) {
+        // Nothing can hide the next directive line (or the end of the buffer).
+        if (HashOffset != Pos) {
+            CurLexer->BufferPtr = BufferStart + HashOffset;
+            CurLexer->IsAtStartOfLine = true;
+            ++NumDirectiveIndexJumps;
+        }
+        return CurLexer->BufferPtr;
+    }
+
+    // Lex the line of the hazard normally.  The lines before it are plain: no
+    // comment or escaped newline runs into it.
+    unsigned LineStart = *Hazard;
+    while (LineStart > Pos && BufferStart[LineStart-1] != '\n' &&
+           BufferStart[LineStart-1] != '\r')
+        --LineStart;
+    if (LineStart > Pos) {
+        CurLexer->BufferPtr = BufferStart + LineStart;
+        CurLexer->IsAtStartOfLine = true;
+        ++NumDirectiveIndexJumps;
+    }
+    return BufferStart + *Hazard + 1;
+}
+
+/// PTHSkipExcludedConditionalBlock - A fast PTH version of
+///  SkipExcludedConditionalBlock.  The token cache records where each #if, #elif,
+///  #else and #endif is, so whole blocks are jumped over without reading their
+///  tokens.
+void Preprocessor::PTHSkipExcludedConditionalBlock() {
+    while (1) {
+        assert(CurPTHLexer);
+        assert(CurPTHLexer->LexingRawMode == false);
+
+        // Skip to the next '#else', '#elif', or #endif.
+        if (CurPTHLexer->SkipBlock()) {
+            // We have reached an #endif.  Its whole line has been consumed by the
+            // PTHLexer.  Just pop off the condition level.
+            PPConditionalInfo CondInfo;
+            bool InCond = CurPTHLexer->popConditionalLevel(CondInfo);
+            InCond = InCond;  // Silence warning in no-asserts mode.
+            assert(!InCond && "Can't be skipping if not in a conditional!");
+            break;
+        }
+
+        // We have reached a '#else' or '#elif'.  Lex the next token to get
+        // the directive flavor.
+        CurPTHLexer->ParsingPreprocessorDirective = true;
+        Token Tok;
+        LexUnexpandedToken(Tok);
+
+        // We can actually look up the IdentifierInfo here since we aren't in
+        // raw mode.
+        tok::PPKeywordKind K = Tok.getIdentifierInfo()->getPPKeywordID();
+
+        if (K == tok::pp_else) {
+            // #else: Enter the else condition.  We aren't in a nested condition
+            //  since we skip those. We're always in the one matching the last
+            //  blocked we skipped.
+            PPConditionalInfo &CondInfo = CurPTHLexer->peekConditionalLevel();
+            // If this is a #else with a #else before it, report the error.
+            if (CondInfo.FoundElse) Diag(Tok, diag::pp_err_else_after_else);
+
+            // Note that we've seen a #else in this conditional.
+            CondInfo.FoundElse = true;
+
+            // If the #if block wasn't entered then enter the #else block now.
+            if (!CondInfo.FoundNonSkip) {
+                CondInfo.FoundNonSkip = true;
+
+                // Scan until the eom token.
+                DiscardUntilEndOfDirective();
+                break;
+            }
+
+            // Otherwise skip this block.
+            continue;
+        }
+
+        assert(K == tok::pp_elif);
+        PPConditionalInfo &CondInfo = CurPTHLexer->peekConditionalLevel();
+
+        // If this is a #elif with a #else before it, report the error.
+        if (CondInfo.FoundElse)
+            Diag(Tok, diag::pp_err_elif_after_else);
+
+        // If this is in a skipping block or if we're already handled this #if
+        // block, don't bother parsing the condition.  We just skip this block.
+        if (CondInfo.FoundNonSkip)
+            continue;
+
+        // Evaluate the condition of the #elif.
+        IdentifierInfo *IfNDefMacro = 0;
+        bool ShouldEnter = EvaluateDirectiveExpression(IfNDefMacro);
+
+        // If this condition is true, enter it!
+        if (ShouldEnter) {
+            CondInfo.FoundNonSkip = true;
+            break;
+        }
+
+        // Otherwise, skip this block and go to the next one.
+    }
+}
+
 /// LookupFile - Given a "foo" or <foo> reference, look up the indicated file,
 /// return null on failure.  isAngled indicates whether the file reference is
 /// for system #include's or not (i.e. using <> instead of "").
@@ -462,10 +625,11 @@ void Preprocessor::HandleDirective(Token &Result) {
                     // C99 6.10.5 - Error Directive.
                 case tok::pp_error:
                     return HandleUserDiagnosticDirective(Result, false);
-#if 0
+
                     // C99 6.10.6 - Pragma Directive.
                 case tok::pp_pragma:
                     return HandlePragmaDirective();
+#if 0
                     // GNU Extensions.
                 case tok::pp_import:
                     return HandleImportDirective(Result);
@@ -784,7 +948,8 @@ void Preprocessor::HandleUserDiagnosticDirective(Token &Tok,
     // tokens.  For example, this is allowed: "#warning `   'foo".  GCC does
     // collapse multiple consequtive white space between tokens, but this isn't
     // specified by the standard.
-    std::string Message = CurLexer->ReadToEndOfLine();
+    std::string Message = CurLexer ? CurLexer->ReadToEndOfLine()
+                                   : CurPTHLexer->ReadToEndOfLine();
     if (isWarning) {
         Diag(Tok, diag::pp_hash_warning) << Message;
     }
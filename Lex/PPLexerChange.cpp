@@ -12,6 +12,7 @@
 #include "Basic/IdentifierTable.h"
 #include "Preprocessor.h"
 #include "PreprocessorLexer.h"
+#include "PTHManager.h"
 #include "Basic/SourceManager.h"
 #include "Basic/HeaderSearch.h"
 #include "LexDiagnostic.h"
@@ -71,6 +72,15 @@ void Preprocessor::EnterSourceFile(FileID FID, const DirectoryLookup *CurDir) {
     if (MaxIncludeStackDepth < IncludeMacroStack.size())
         MaxIncludeStackDepth = IncludeMacroStack.size();
 
+    // Use the token cache when it has up-to-date tokens for this file.  Cached
+    // tokens carry no comments, so -C/-CC always lexes the source.
+    if (PTH && !KeepComments) {
+        if (PTHLexer *PL = PTH->CreateLexer(FID)) {
+            EnterSourceFileWithPTH(PL, CurDir);
+            return;
+        }
+    }
+
     EnterSourceFileWithLexer(new Lexer(FID, *this), CurDir);
 }
 
@@ -87,7 +97,7 @@ void Preprocessor::EnterSourceFileWithLexer(Lexer *TheLexer, const DirectoryLook
     CurDirLookup = CurDir;
 
     // Notify the client, if desired, that we are in a new source file.
-    if (Callbacks) {
+    if (Callbacks && !CurLexer->isPragmaLexer()) {
         CharacteristicKind FileType =
                 SourceMgr.getFileCharacteristic(CurLexer->getFileLoc());
 
@@ -96,6 +106,28 @@ void Preprocessor::EnterSourceFileWithLexer(Lexer *TheLexer, const DirectoryLook
     }
 }
 
+/// EnterSourceFileWithPTH - Add a source file to the top of the include stack and
+/// start getting tokens from it using the PTH cache.
+void Preprocessor::EnterSourceFileWithPTH(PTHLexer *PL,
+                                          const DirectoryLookup *CurDir) {
+
+    if (CurPPLexer || CurTokenLexer)
+        PushIncludeMacroStack();
+
+    CurDirLookup = CurDir;
+    CurPTHLexer.reset(PL);
+    CurPPLexer = CurPTHLexer.get();
+
+    // Notify the client, if desired, that we are in a new source file.
+    if (Callbacks) {
+        FileID FID = CurPPLexer->getFileID();
+        SourceLocation EnterLoc = SourceMgr.getLocForStartOfFile(FID);
+        CharacteristicKind FileType =
+                SourceMgr.getFileCharacteristic(EnterLoc);
+        Callbacks->FileChanged(EnterLoc, PPCallbacks::EnterFile, FileType);
+    }
+}
+
 /// EnterMacro - Add a Macro to the top of the include stack and start lexing
 /// tokens from it instead of the current buffer.
 void Preprocessor::EnterMacro(Token &Tok, SourceLocation ILEnd,
@@ -161,11 +193,14 @@ bool Preprocessor::HandleEndOfFile(Token &Result, bool isEndOfMacro) {
     // If this is a #include'd file, pop it off the include stack and continue
     // lexing the #includer file.
     if (!IncludeMacroStack.empty()) {
+        // A _Pragma lexer never announced itself, so don't announce leaving it.
+        bool ExitingPragmaLexer = CurLexer && CurLexer->isPragmaLexer();
+
         // We're done with the #included file.
         RemoveTopOfLexerStack();
 
         // Notify the client, if desired, that we are in a new source file.
-        if (Callbacks && !isEndOfMacro && CurPPLexer) {
+        if (Callbacks && !isEndOfMacro && !ExitingPragmaLexer && CurPPLexer) {
             CharacteristicKind FileType =
                     SourceMgr.getFileCharacteristic(CurPPLexer->getSourceLocation());
             Callbacks->FileChanged(CurPPLexer->getSourceLocation(),
@@ -199,6 +234,9 @@ bool Preprocessor::HandleEndOfFile(Token &Result, bool isEndOfMacro) {
 
         // We're done with the #included file.
         CurLexer.reset();
+    } else if (CurPTHLexer) {
+        CurPTHLexer->getEOF(Result);
+        CurPTHLexer.reset();
     }
 
     CurPPLexer = nullptr;
@@ -14,19 +14,21 @@
 #include "Preprocessor.h"
 #include "Basic/IdentifierTable.h"
 #include "LexDiagnostic.h"
+#include <algorithm>
 
 using namespace CPToyC::Compiler;
 
 /// setMacroInfo - Specify a macro for this identifier.
 ///
 void Preprocessor::setMacroInfo(IdentifierInfo *II, MacroInfo *MI) {
+    ++MacroGeneration;
     if (MI) {
+        MI->setGeneration(MacroGeneration);
         Macros[II] = MI;
-        II->setHasMacroDefinition(true);
     } else if (II->hasMacroDefinition()) {
         Macros.erase(II);
-        II->setHasMacroDefinition(false);
     }
+    II->setMacroInfo(MI);
 }
 
 /// RegisterBuiltinMacro - Register the specified identifier in the identifier
@@ -52,7 +54,7 @@ void Preprocessor::RegisterBuiltinMacros() {
     Ident__DATE__ = RegisterBuiltinMacro(*this, "__DATE__");
     Ident__TIME__ = RegisterBuiltinMacro(*this, "__TIME__");
     Ident__COUNTER__ = RegisterBuiltinMacro(*this, "__COUNTER__");
-//    Ident_Pragma  = RegisterBuiltinMacro(*this, "_Pragma");
+    Ident_Pragma  = RegisterBuiltinMacro(*this, "_Pragma");
 
     // GCC Extensions.
     Ident__BASE_FILE__     = RegisterBuiltinMacro(*this, "__BASE_FILE__");
@@ -105,6 +107,8 @@ bool Preprocessor::isNextPPTokenLParen() {
     unsigned Val;
     if (CurLexer)
         Val = CurLexer->isNextPPTokenLParen();
+    else if (CurPTHLexer)
+        Val = CurPTHLexer->isNextPPTokenLParen();
     else
         Val = CurTokenLexer->isNextTokenLParen();
 
@@ -118,9 +122,16 @@ bool Preprocessor::isNextPPTokenLParen() {
             IncludeStackInfo &Entry = IncludeMacroStack[i-1];
             if (Entry.TheLexer)
                 Val = Entry.TheLexer->isNextPPTokenLParen();
+            else if (Entry.ThePTHLexer)
+                Val = Entry.ThePTHLexer->isNextPPTokenLParen();
             else
                 Val = Entry.TheTokenLexer->isNextTokenLParen();
 
+            // A lookahead that reaches the end of an expansion being recorded
+            // depends on what follows the macro name.
+            if (CurRecording && Entry.TheTokenLexer == RecordingEnd)
+                RecordingFailed = true;
+
             if (Val != 2)
                 break;
 
@@ -147,6 +158,13 @@ bool Preprocessor::HandleMacroExpandedIdentifier(Token &Identifier,
     // to disable the optimization in this case.
     if (CurPPLexer) CurPPLexer->MIOpt.ExpandedMacro();
 
+    // A recorded expansion must not depend on where it happens, so give up on
+    // recording one that uses a builtin macro; the tokens are thrown away.
+    if (CurRecording && MI->isBuiltinMacro()) {
+        RecordingFailed = true;
+        return false;
+    }
+
     // If this is a builtin macro, like __LINE__ or _Pragma, handle it specially.
     if (MI->isBuiltinMacro()) {
         ExpandBuiltinMacro(Identifier);
@@ -181,9 +199,19 @@ bool Preprocessor::HandleMacroExpandedIdentifier(Token &Identifier,
         // If there was an error parsing the arguments, bail out.
         if (Args == nullptr) return false;
 
+        if (CurRecording)
+            CurRecording->Macros.push_back(
+                    std::make_pair(Identifier.getIdentifierInfo(),
+                                   MI->getGeneration()));
+
         ++NumFnMacroExpanded;
     } else {
         ++NumMacroExpanded;
+
+        if (CurRecording)
+            CurRecording->Macros.push_back(
+                    std::make_pair(Identifier.getIdentifierInfo(),
+                                   MI->getGeneration()));
     }
 
     // Notice that this macro has been used.
@@ -195,7 +223,7 @@ bool Preprocessor::HandleMacroExpandedIdentifier(Token &Identifier,
     // expansion stack, only to take it right back off.
     if (MI->getNumTokens() == 0) {
         // No need for arg info.
-        if (Args) Args->destroy();
+        if (Args) Args->destroy(*this);
 
         // Ignore this macro use, just return the next token in the current
         // buffer.
@@ -223,7 +251,7 @@ bool Preprocessor::HandleMacroExpandedIdentifier(Token &Identifier,
         // "#define VAL 42".
 
         // No need for arg info.
-        if (Args) Args->destroy();
+        if (Args) Args->destroy(*this);
 
         // Propagate the isAtStartOfLine/hasLeadingSpace markers of the macro
         // identifier to the expanded token.
@@ -258,6 +286,11 @@ bool Preprocessor::HandleMacroExpandedIdentifier(Token &Identifier,
         return false;
     }
 
+    // An object-like macro whose expansion goes through other macros is
+    // expanded once and its tokens reused.
+    if (MI->isObjectLike() && ExpandCachedMacro(Identifier, MI))
+        return false;
+
     // Start expanding the macro.
     EnterMacro(Identifier, InstantiationEnd, Args);
 
@@ -267,6 +300,225 @@ bool Preprocessor::HandleMacroExpandedIdentifier(Token &Identifier,
     return false;
 }
 
+/// isMacroExpansionCurrent - Return true if every identifier CE depends on
+/// still has the definition it was recorded with.  If CheckEnabled, the macros
+/// must also be free to expand here.
+bool Preprocessor::isMacroExpansionCurrent(const CachedMacroExpansion &CE,
+                                           bool CheckEnabled) const {
+    for (unsigned i = 0, e = CE.Macros.size(); i != e; ++i) {
+        MacroInfo *MI = getMacroInfo(CE.Macros[i].first);
+        if (CE.Macros[i].second == 0) {
+            if (MI)
+                return false;
+        } else if (!MI || MI->getGeneration() != CE.Macros[i].second ||
+                   (CheckEnabled && !MI->isEnabled())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// ExpandCachedMacro - Expand the object-like macro named by Identifier from its
+/// recorded expansion, recording it first if it has none.
+bool Preprocessor::ExpandCachedMacro(Token &Identifier, MacroInfo *MI) {
+    IdentifierInfo *II = Identifier.getIdentifierInfo();
+    CachedMacroExpansion *CE = MacroExpansionCache.lookup(II);
+
+    if (CE && isMacroExpansionCurrent(*CE, false)) {
+        // Inside the expansion of one of the macros involved, that macro must not
+        // expand again, which the recorded tokens don't know.
+        if (!CE->Cacheable || !isMacroExpansionCurrent(*CE, true))
+            return false;
+
+        if (CurRecording)
+            CurRecording->Macros.append(CE->Macros.begin(), CE->Macros.end());
+
+        // Give the tokens instantiation locations for this use.  Each run of
+        // spellings gets one entry.
+        SourceLocation Loc = Identifier.getLocation();
+        llvm::SmallVector<SourceLocation, 4> RunLocs;
+        for (unsigned i = 0, e = CE->Runs.size(); i != e; ++i)
+            RunLocs.push_back(SourceMgr.createInstantiationLoc(
+                    CE->Runs[i].first, Loc, Loc, CE->Runs[i].second));
+
+        unsigned NumToks = CE->Tokens.size();
+        Token *Toks = new Token[NumToks];
+        for (unsigned i = 0; i != NumToks; ++i) {
+            Toks[i] = CE->Tokens[i];
+            Toks[i].setLocation(RunLocs[CE->TokenLocs[i].first]
+                                        .getFileLocWithOffset(CE->TokenLocs[i].second));
+        }
+
+        ++NumMacroExpansionsReplayed;
+        EnterExpandedTokens(Identifier, Toks, NumToks);
+        return true;
+    }
+
+    // Only record outside of other macros.  There no macro is disabled, so
+    // the expansion depends on nothing but the macro definitions.
+    if (CurTokenLexer || CurRecording)
+        return false;
+
+    if (!CE) {
+        CE = new CachedMacroExpansion();
+        MacroExpansionCache[II] = CE;
+    }
+    return RecordMacroExpansion(Identifier, MI, *CE);
+}
+
+/// RecordMacroExpansion - Fully expand the object-like macro named by
+/// Identifier into CE, and return its tokens for this use.  Return false if the
+/// expansion can't be done ahead of time, in which case the macro must be
+/// expanded the normal way.
+bool Preprocessor::RecordMacroExpansion(Token &Identifier, MacroInfo *MI,
+                                        CachedMacroExpansion &CE) {
+    CE.Macros.clear();
+    CE.Tokens.clear();
+    CE.Runs.clear();
+    CE.TokenLocs.clear();
+    CE.Cacheable = false;
+    CE.Macros.push_back(std::make_pair(Identifier.getIdentifierInfo(),
+                                       MI->getGeneration()));
+
+    // Expand the macro in front of an EOF, like a pre-expanded argument, so that
+    // nothing after the macro name is read.  A function-like macro name at the
+    // end that looks for its '(' reaches the EOF, and the recording is given up.
+    Token EOFTok;
+    EOFTok.startToken();
+    EOFTok.setKind(tok::eof);
+    EOFTok.setLocation(Identifier.getLocation());
+    EOFTok.setLength(0);
+    EnterTokenStream(&EOFTok, 1, false /*disable expand*/, false /*owns tokens*/);
+    RecordingEnd = CurTokenLexer.get();
+
+    // Expand with no leading space, so that the first token only carries the
+    // spacing that comes from the macro body.
+    Token MacroTok = Identifier;
+    MacroTok.clearFlag(Token::StartOfLine);
+    MacroTok.clearFlag(Token::LeadingSpace);
+
+    CurRecording = &CE;
+    RecordingFailed = false;
+    EnterMacro(MacroTok, Identifier.getLocation(), 0);
+
+    llvm::SmallVector<Token, 64> Result;
+    Token Tok;
+    for (Lex(Tok); Tok.isNot(tok::eof); Lex(Tok)) {
+        // A token stream pastes around '##', and "defined" reads the next token
+        // unexpanded in #if, so such tokens can't be passed on expanded.
+        if (Tok.is(tok::hashhash) ||
+            (Tok.getIdentifierInfo() &&
+             Tok.getIdentifierInfo()->getPPKeywordID() == tok::pp_defined))
+            RecordingFailed = true;
+        Result.push_back(Tok);
+    }
+
+    // An empty macro at the end passes its spacing on to the token after it,
+    // which is the EOF here.
+    if (Tok.hasLeadingSpace() || Tok.isAtStartOfLine())
+        RecordingFailed = true;
+    RemoveTopOfLexerStack();
+    CurRecording = 0;
+    RecordingEnd = 0;
+
+    // A lookahead or arguments that ran into the EOF, or a diagnostic, mean the
+    // tokens are not what this use expands to.  An empty expansion takes the
+    // spacing of the macro name, which is left to EnterMacro.
+    if (RecordingFailed || Result.empty())
+        return false;
+
+    // The tokens are returned without being looked at again, so they also
+    // depend on the identifiers among them staying what they are: not macros,
+    // or function-like macros that can expand here.
+    unsigned NumToks = Result.size();
+    bool ExpandsMacros = CE.Macros.size() > 1;
+    for (unsigned i = 0; i != NumToks; ++i) {
+        IdentifierInfo *TokII = Result[i].getIdentifierInfo();
+        if (!TokII || Result[i].isExpandDisabled())
+            continue;
+        MacroInfo *TokMI = getMacroInfo(TokII);
+        CE.Macros.push_back(std::make_pair(TokII,
+                                           TokMI ? TokMI->getGeneration() : 0));
+    }
+
+    // Each identifier only needs checking once.
+    std::sort(CE.Macros.begin()+1, CE.Macros.end());
+    CE.Macros.erase(std::unique(CE.Macros.begin()+1, CE.Macros.end()),
+                    CE.Macros.end());
+
+    ++NumMacroExpansionsRecorded;
+
+    Token *Toks = new Token[NumToks];
+    std::copy(Result.begin(), Result.end(), Toks);
+
+    // Keep the tokens if they went through other macros; otherwise they are no
+    // faster than expanding the body.
+    if (ExpandsMacros) {
+        CE.Cacheable = true;
+        CE.Tokens.assign(Result.begin(), Result.end());
+
+        // Group the spellings into runs within a single buffer, small enough
+        // that creating an entry for each run doesn't eat up the location space.
+        enum { MaxRunLength = 4096 };
+        llvm::SmallVector<std::pair<SourceLocation::UIntTy,
+                                    SourceLocation::UIntTy>, 4> Ranges;
+        llvm::SmallVector<SourceLocation, 64> Spellings;
+        llvm::SmallVector<unsigned, 64> TokenRuns;
+        for (unsigned i = 0; i != NumToks; ++i) {
+            SourceLocation Spelling = SourceMgr.getSpellingLoc(Result[i].getLocation());
+            SourceLocation::UIntTy Begin = Spelling.getRawEncoding();
+            SourceLocation::UIntTy End = Begin + Result[i].getLength();
+            unsigned Run = 0, NumRuns = Ranges.size();
+            for (; Run != NumRuns; ++Run) {
+                SourceLocation::UIntTy RunBegin = std::min(Ranges[Run].first, Begin);
+                SourceLocation::UIntTy RunEnd = std::max(Ranges[Run].second, End);
+                if (RunEnd - RunBegin <= MaxRunLength &&
+                    SourceMgr.isFromSameFile(
+                            SourceLocation::getFromRawEncoding(Ranges[Run].first),
+                            Spelling)) {
+                    Ranges[Run] = std::make_pair(RunBegin, RunEnd);
+                    break;
+                }
+            }
+            if (Run == NumRuns)
+                Ranges.push_back(std::make_pair(Begin, End));
+            Spellings.push_back(Spelling);
+            TokenRuns.push_back(Run);
+        }
+
+        for (unsigned i = 0, e = Ranges.size(); i != e; ++i)
+            CE.Runs.push_back(std::make_pair(
+                    SourceLocation::getFromRawEncoding(Ranges[i].first),
+                    // An empty token still needs a character to map to.
+                    std::max<unsigned>(Ranges[i].second - Ranges[i].first, 1)));
+        for (unsigned i = 0; i != NumToks; ++i)
+            CE.TokenLocs.push_back(std::make_pair(
+                    TokenRuns[i],
+                    unsigned(Spellings[i].getRawEncoding() -
+                             Ranges[TokenRuns[i]].first)));
+    }
+
+    EnterExpandedTokens(Identifier, Toks, NumToks);
+    return true;
+}
+
+/// EnterExpandedTokens - Return NumToks fully expanded tokens as the expansion
+/// of the macro named by Identifier, and lex the first of them into it.
+void Preprocessor::EnterExpandedTokens(Token &Identifier, Token *Toks,
+                                       unsigned NumToks) {
+    // The first token gets the spacing of the macro name on top of its own, as
+    // it would from the TokenLexer.
+    if (Identifier.isAtStartOfLine())
+        Toks[0].setFlag(Token::StartOfLine);
+    if (Identifier.hasLeadingSpace())
+        Toks[0].setFlag(Token::LeadingSpace);
+
+    // A function-like macro name among the tokens already looked for its '('
+    // when they were recorded; nothing is expanded again.
+    EnterTokenStream(Toks, NumToks, true /*disable expand*/, true /*owns tokens*/);
+    Lex(Identifier);
+}
+
 /// ReadFunctionLikeMacroArgs - After reading "MACRO" and knowing that the next
 /// token is the '(' of the macro, this method is invoked to read all of the
 /// actual arguments specified for the macro invocation.  This returns null on
@@ -437,7 +689,7 @@ MacroArgs *Preprocessor::ReadFunctionLikeMacroArgs(Token &MacroName,
     }
 
     return MacroArgs::create(MI, ArgTokens.data(), ArgTokens.size(),
-                             isVarargsElided);
+                             isVarargsElided, *this);
 }
 
 /// ComputeDATE_TIME - Compute the current time, enter it into the specified
@@ -477,8 +729,8 @@ void Preprocessor::ExpandBuiltinMacro(Token &Tok) {
 
     // If this is an _Pragma directive, expand it, invoke the pragma handler, then
     // lex the token after it.
-//    if (II == Ident_Pragma)
-//        return Handle_Pragma(Tok);
+    if (II == Ident_Pragma)
+        return Handle_Pragma(Tok);
 
     ++NumBuiltinMacroExpanded;
 
@@ -504,10 +756,18 @@ void Preprocessor::ExpandBuiltinMacro(Token &Tok) {
         // Skip down through instantiation points until we find a file loc for the
         // end of the instantiation history.
         Loc = SourceMgr.getInstantiationRange(Loc).second;
-        PresumedLoc PLoc = SourceMgr.getPresumedLoc(Loc);
+
+        // Without #line directives in the file the presumed line is the physical
+        // one, which the lexer counts as it goes.
+        unsigned LineNo;
+        FileID FID = SourceMgr.getDecomposedInstantiationLoc(Loc).first;
+        if (!SourceMgr.getSLocEntry(FID).getFile().hasLineDirectives())
+            LineNo = getInstantiationLineNumber(Loc);
+        else
+            LineNo = SourceMgr.getPresumedLoc(Loc).getLine();
 
         // __LINE__ expands to a simple numeric value.
-        sprintf(TmpBuffer, "%u", PLoc.getLine());
+        sprintf(TmpBuffer, "%u", LineNo);
         Tok.setKind(tok::numeric_constant);
         CreateString(TmpBuffer, strlen(TmpBuffer), Tok, Tok.getLocation());
     } else if (II == Ident__FILE__ || II == Ident__BASE_FILE__) {
@@ -0,0 +1,487 @@
+/***********************************
+* File:     PTHLexer.cpp
+*
+* Author:   agent
+*
+* Email:    agent@local
+*
+* Date:     2026/10/16
+***********************************/
+
+#include "PTHLexer.h"
+#include "PTHManager.h"
+#include "Preprocessor.h"
+#include "Basic/FileManager.h"
+#include "Basic/IdentifierTable.h"
+#include "Basic/KeywordHash.h"
+#include "Basic/SourceManager.h"
+#include "llvm/MemoryBuffer.h"
+#include <iostream>
+#include <string.h>
+#include <sys/stat.h>
+
+using namespace CPToyC::Compiler;
+using namespace CPToyC::Compiler::pth;
+
+const char pth::Magic[8] = { 'C', 'P', 'T', 'O', 'Y', 'P', 'T', 'H' };
+
+//===----------------------------------------------------------------------===//
+// PTHLexer methods.
+//===----------------------------------------------------------------------===//
+
+PTHLexer::PTHLexer(Preprocessor &PP, FileID FID, const unsigned char *D,
+                   const unsigned char *ppcond, unsigned numppcond,
+                   PTHManager &PM)
+    : PreprocessorLexer(&PP, FID), TokBuf(D), CurPtr(D), LastHashTokPtr(0),
+      PPCond(ppcond), NumPPCond(numppcond), PTHMgr(PM) {
+
+    FileStartLoc = PP.getSourceManager().getLocForStartOfFile(FID);
+}
+
+uint32_t PTHLexer::ReadToken(const unsigned char *Ptr, Token &Tok) {
+    uint32_t Word0 = ReadLE32(Ptr);
+    uint32_t IdOrSpelling = ReadLE32(Ptr);
+    uint32_t FileOffset = ReadLE32(Ptr);
+
+    Tok.startToken();
+    Tok.setKind((tok::TokenKind) (Word0 & 0xFF));
+    Tok.setFlag((Token::TokenFlags) ((Word0 >> 8) & 0xFF));
+    Tok.setLocation(FileStartLoc.getFileLocWithOffset(FileOffset));
+    Tok.setLength(Word0 >> 16);
+
+    // Literals carry an offset into the spelling pool, so their characters can
+    // be read without touching the source buffer.
+    if (Tok.isLiteral()) {
+        Tok.setLiteralData((const char*) PTHMgr.File.SpellingBase + IdOrSpelling);
+        return 0;
+    }
+    return IdOrSpelling;
+}
+
+void PTHLexer::Lex(Token &Tok) {
+LexNextToken:
+    uint32_t IdentifierID = ReadToken(CurPtr, Tok);
+    tok::TokenKind TKind = Tok.getKind();
+
+    if (TKind == tok::eof) {
+        // Leave CurPtr on the eof record so getEOF can hand it back.
+        Preprocessor *PPCache = PP;
+        if (PP->HandleEndOfFile(Tok))
+            return;
+
+        // HandleEndOfFile has deleted this lexer; ask the preprocessor for the
+        // next token of the includer.
+        return PPCache->Lex(Tok);
+    }
+
+    CurPtr += TokenSize;
+
+    if (IdentifierID) {
+        // Notify MIOpt that we read a non-whitespace/non-comment token.
+        MIOpt.ReadToken();
+
+        // Like Lexer, raw mode (e.g. #pragma GCC poison) leaves identifiers
+        // unresolved.
+        if (LexingRawMode)
+            return;
+
+        IdentifierInfo *II = PTHMgr.GetIdentifierInfo(IdentifierID-1);
+        Tok.setIdentifierInfo(II);
+
+        // Change the kind of this identifier to the appropriate token kind, e.g.
+        // turning "for" into a keyword.
+        Tok.setKind(II->getTokenID());
+
+        if (II->isHandleIdentifierCase())
+            PP->HandleIdentifier(Tok);
+        return;
+    }
+
+    if (TKind == tok::hash && Tok.isAtStartOfLine()) {
+        LastHashTokPtr = CurPtr - TokenSize;
+        PP->HandleDirective(Tok);
+
+        if (PP->isCurrentLexer(this))
+            goto LexNextToken;
+
+        return PP->Lex(Tok);
+    }
+
+    if (TKind == tok::eom)
+        ParsingPreprocessorDirective = false;
+
+    // Notify MIOpt that we read a non-whitespace/non-comment token.
+    MIOpt.ReadToken();
+}
+
+void PTHLexer::getEOF(Token &Tok) {
+    assert((tok::TokenKind) *CurPtr == tok::eof && "Not at the end of the file");
+    ReadToken(CurPtr, Tok);
+}
+
+void PTHLexer::DiscardToEndOfLine() {
+    assert(ParsingPreprocessorDirective && ParsingFilename == false &&
+           "Must be in a preprocessing directive!");
+
+    // Skip tokens by only peeking at their token kind.  We don't need to
+    // reconstruct full tokens (or look up identifiers) to find the eom.
+    const unsigned char *p = CurPtr;
+    while (1) {
+        tok::TokenKind K = (tok::TokenKind) *p;
+        if (K == tok::eof) break;
+        p += TokenSize;
+        if (K == tok::eom) break;
+    }
+    CurPtr = p;
+
+    ParsingPreprocessorDirective = false;
+    MIOpt.ReadToken();
+}
+
+std::string PTHLexer::ReadToEndOfLine() {
+    assert(ParsingPreprocessorDirective && ParsingFilename == false &&
+           "Must be in a preprocessing directive!");
+    SourceManager &SM = PP->getSourceManager();
+    const char *BufStart = SM.getBuffer(getFileID())->getBufferStart();
+
+    // The line runs from the end of the last token read to the eom, which sits
+    // on the newline (or the end of the buffer).
+    unsigned StartOffset = SM.getFileOffset(getSourceLocation());
+    const unsigned char *p = CurPtr;
+    while ((tok::TokenKind) *p != tok::eom && (tok::TokenKind) *p != tok::eof)
+        p += TokenSize;
+    const unsigned char *OffsetPtr = p + 8;
+    unsigned EndOffset = ReadLE32(OffsetPtr);
+
+    // Fold trigraphs and escaped newlines like Lexer::ReadToEndOfLine does.
+    std::string Result;
+    for (const char *Ptr = BufStart+StartOffset, *End = BufStart+EndOffset;
+         Ptr < End; ) {
+        unsigned CharSize;
+        Result += Lexer::getCharAndSizeNoWarn(Ptr, CharSize, PP->getLangOptions());
+        Ptr += CharSize;
+    }
+
+    DiscardToEndOfLine();
+    return Result;
+}
+
+unsigned PTHLexer::isNextPPTokenLParen() {
+    tok::TokenKind K = (tok::TokenKind) *CurPtr;
+    if (K == tok::eof)
+        return 2;
+    return K == tok::l_paren;
+}
+
+SourceLocation PTHLexer::getSourceLocation() {
+    // getSourceLocation is not on the hot path.  It is used to get the location
+    // to report when transitioning back to this lexer after a #include, which
+    // for Lexer is the character right after the last token it formed.
+    if (CurPtr == TokBuf)
+        return FileStartLoc;
+
+    const unsigned char *Prev = CurPtr - TokenSize;
+    uint32_t Word0 = ReadLE32(Prev);
+    Prev += 4;
+    uint32_t Offset = ReadLE32(Prev);
+    return FileStartLoc.getFileLocWithOffset(Offset + (Word0 >> 16));
+}
+
+/// SkipBlock - PTHFile::Create checked that the side table has an entry for
+/// each conditional directive and that each entry jumps forward to another, so
+/// the lookups here cannot leave the file.
+bool PTHLexer::SkipBlock() {
+    assert(LastHashTokPtr && "No known '#' token.");
+
+    // The side table is sorted by the index of the '#' token, so find the
+    // entry for the directive we are sitting in with a binary search.
+    uint32_t HashIdx = (LastHashTokPtr - TokBuf) / TokenSize;
+    unsigned Lo = 0, Hi = NumPPCond;
+    while (Lo < Hi) {
+        unsigned Mid = Lo + (Hi - Lo) / 2;
+        const unsigned char *EntryPtr = PPCond + Mid*PPCondEntrySize;
+        if (ReadLE32(EntryPtr) < HashIdx)
+            Lo = Mid + 1;
+        else
+            Hi = Mid;
+    }
+    assert(Lo < NumPPCond && "No PP-cond entry found for '#'");
+
+    const unsigned char *EntryPtr = PPCond + Lo*PPCondEntrySize;
+    assert(ReadLE32(EntryPtr) == HashIdx && "No PP-cond entry found for '#'");
+    EntryPtr = PPCond + Lo*PPCondEntrySize + 4;
+    uint32_t TargetIdx = ReadLE32(EntryPtr);
+    assert(TargetIdx && "No jumping from #endifs.");
+
+    // Jump to the '#' of the next #elif, #else or #endif at this level.
+    const unsigned char *TargetPtr = PPCond + TargetIdx*PPCondEntrySize;
+    uint32_t TargetHashIdx = ReadLE32(TargetPtr);
+    bool isEndif = ReadLE32(TargetPtr) == 0;
+
+    LastHashTokPtr = TokBuf + TargetHashIdx*TokenSize;
+    assert((tok::TokenKind) *LastHashTokPtr == tok::hash && "Not a '#' token");
+    CurPtr = LastHashTokPtr + TokenSize;
+
+    // Did we reach a #endif?  If so, consume the rest of its line as well.
+    if (isEndif) {
+        ParsingPreprocessorDirective = true;
+        DiscardToEndOfLine();
+    }
+    return isEndif;
+}
+
+//===----------------------------------------------------------------------===//
+// PTHFile methods.
+//===----------------------------------------------------------------------===//
+
+bool pth::StatFile(const char *Path, uint64_t &Size, uint64_t &ModTime) {
+    struct stat StatBuf;
+    if (::stat(Path, &StatBuf))
+        return false;
+    Size = StatBuf.st_size;
+#if defined(__APPLE__)
+    ModTime = StatBuf.st_mtimespec.tv_sec*1000000000ULL + StatBuf.st_mtimespec.tv_nsec;
+#else
+    ModTime = StatBuf.st_mtim.tv_sec*1000000000ULL + StatBuf.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+PTHFile::PTHFile(const MemoryBuffer *buf)
+    : Buf(buf), IdTable(0), NumIds(0), SpellingBase(0) {
+    BufStart = (const unsigned char*) buf->getBufferStart();
+    BufEnd = (const unsigned char*) buf->getBufferEnd();
+}
+
+PTHFile::~PTHFile() {
+}
+
+static bool InvalidPTH(std::string *ErrStr, const std::string &file,
+                       const char *Why) {
+    if (ErrStr)
+        *ErrStr = "invalid or corrupt PTH file '" + file + "': " + Why;
+    return false;
+}
+
+static bool IsLiteralKind(unsigned Kind) {
+    return Kind == tok::numeric_constant || Kind == tok::char_constant ||
+           Kind == tok::string_literal || Kind == tok::wide_string_literal ||
+           Kind == tok::angle_string_literal;
+}
+
+/// ValidateFileEntry - Check the token stream and the PPCond table of a file
+/// against everything PTHLexer relies on.  Returns why the entry is malformed,
+/// or null if it is good.
+const char *PTHFile::ValidateFileEntry(const unsigned char *Entry) const {
+    uint64_t BufSize = BufEnd - BufStart;
+    uint64_t SpellingsSize = BufEnd - SpellingBase;
+
+    const unsigned char *EntryPtr = Entry;
+    uint32_t NameOffset = ReadLE32(EntryPtr);
+    uint32_t TokenOffset = ReadLE32(EntryPtr);
+    uint32_t PPCondOffset = ReadLE32(EntryPtr);
+    uint32_t NumPPCond = ReadLE32(EntryPtr);
+    uint64_t Size = ReadLE64(EntryPtr);
+    if (NameOffset >= SpellingsSize || TokenOffset > BufSize ||
+        PPCondOffset + (uint64_t) NumPPCond*PPCondEntrySize > BufSize)
+        return "file entry out of range";
+    const unsigned char *PPCond = BufStart + PPCondOffset;
+
+    // Walk the tokens up to the eof.  Each '#' that starts a conditional
+    // directive must have the next PPCond entry, as PTHLexer::SkipBlock looks
+    // the entry up by the index of the '#'.
+    unsigned NextCond = 0;
+    bool AfterHash = false, InDirective = false;
+    const unsigned char *Tok = BufStart + TokenOffset;
+    for (uint32_t Idx = 0; ; ++Idx, Tok += TokenSize) {
+        if ((uint64_t) (BufEnd - Tok) < TokenSize)
+            return "token stream out of range";
+
+        const unsigned char *p = Tok;
+        uint32_t Word0 = ReadLE32(p);
+        uint32_t IdOrSpelling = ReadLE32(p);
+        uint32_t Offset = ReadLE32(p);
+        unsigned Kind = Word0 & 0xFF, Length = Word0 >> 16;
+        if (Kind >= tok::NUM_TOKENS)
+            return "invalid token kind";
+        if (Offset + (uint64_t) Length > Size)
+            return "token out of range";
+        if (Kind == tok::eof) {
+            if (InDirective)
+                return "unterminated directive";
+            break;
+        }
+
+        // Identifiers, and only identifiers, carry an identifier ID.
+        if (IsLiteralKind(Kind)) {
+            if (IdOrSpelling + (uint64_t) Length >= SpellingsSize)
+                return "spelling out of range";
+        } else if (Kind == tok::identifier ? IdOrSpelling == 0 ||
+                                             IdOrSpelling > NumIds
+                                           : IdOrSpelling != 0) {
+            return "identifier out of range";
+        }
+
+        // Every directive line ends with an eom, and only the token after a
+        // '#' at the start of a line names a directive.
+        bool IsDirectiveName = AfterHash;
+        AfterHash = Kind == tok::hash && ((Word0 >> 8) & Token::StartOfLine);
+        if (AfterHash) {
+            if (InDirective)
+                return "unterminated directive";
+            InDirective = true;
+        } else if (Kind == tok::eom) {
+            InDirective = false;
+        }
+        if (!IsDirectiveName || Kind != tok::identifier)
+            continue;
+
+        const unsigned char *IdPtr = IdTable + (IdOrSpelling-1)*4;
+        const char *Name = (const char*) SpellingBase + ReadLE32(IdPtr);
+        tok::PPKeywordKind K = tok::getPPKeywordID(Name, strlen(Name));
+        if (K != tok::pp_if && K != tok::pp_ifdef && K != tok::pp_ifndef &&
+            K != tok::pp_elif && K != tok::pp_else && K != tok::pp_endif)
+            continue;
+
+        if (NextCond == NumPPCond)
+            return "missing PPCond entry";
+        const unsigned char *CondPtr = PPCond + NextCond*PPCondEntrySize;
+        uint32_t CondHashIdx = ReadLE32(CondPtr);
+        uint32_t Target = ReadLE32(CondPtr);
+        if (CondHashIdx != Idx-1)
+            return "missing PPCond entry";
+        // #endif entries have a target of zero; the others jump forward.
+        if (K == tok::pp_endif ? Target != 0
+                               : Target <= NextCond || Target >= NumPPCond)
+            return "PPCond target out of range";
+        ++NextCond;
+    }
+    if (NextCond != NumPPCond)
+        return "extra PPCond entries";
+    return 0;
+}
+
+PTHFile *PTHFile::Create(const std::string &file, std::string *ErrStr) {
+    llvm::OwningPtr<const MemoryBuffer> File(MemoryBuffer::getFile(file.c_str(),
+                                                                   ErrStr));
+    if (!File)
+        return 0;
+
+    const unsigned char *BufStart = (const unsigned char*) File->getBufferStart();
+    uint64_t BufSize = File->getBufferSize();
+    if (BufSize < HeaderSize || memcmp(BufStart, Magic, sizeof(Magic)) != 0) {
+        InvalidPTH(ErrStr, file, "bad magic");
+        return 0;
+    }
+
+    const unsigned char *p = BufStart + sizeof(Magic);
+    if (ReadLE32(p) != Version) {
+        InvalidPTH(ErrStr, file, "unsupported version");
+        return 0;
+    }
+    uint32_t NumFiles = ReadLE32(p);
+    uint32_t FileTableOffset = ReadLE32(p);
+    uint32_t NumIds = ReadLE32(p);
+    uint32_t IdTableOffset = ReadLE32(p);
+    uint32_t SpellingsOffset = ReadLE32(p);
+
+    if (FileTableOffset + (uint64_t) NumFiles*FileEntrySize > BufSize ||
+        IdTableOffset + (uint64_t) NumIds*4 > BufSize ||
+        SpellingsOffset > BufSize) {
+        InvalidPTH(ErrStr, file, "table out of range");
+        return 0;
+    }
+
+    llvm::OwningPtr<PTHFile> PF(new PTHFile(File.take()));
+    PF->IdTable = BufStart + IdTableOffset;
+    PF->NumIds = NumIds;
+    PF->SpellingBase = BufStart + SpellingsOffset;
+
+    // Names are NUL terminated, and so is the buffer, so an offset inside the
+    // spelling pool is enough.
+    const unsigned char *IdPtr = PF->IdTable;
+    for (unsigned i = 0; i != NumIds; ++i) {
+        if (SpellingsOffset + (uint64_t) ReadLE32(IdPtr) >= BufSize) {
+            InvalidPTH(ErrStr, file, "identifier out of range");
+            return 0;
+        }
+    }
+
+    const unsigned char *Entry = BufStart + FileTableOffset;
+    for (unsigned i = 0; i != NumFiles; ++i, Entry += FileEntrySize) {
+        if (const char *Why = PF->ValidateFileEntry(Entry)) {
+            InvalidPTH(ErrStr, file, Why);
+            return 0;
+        }
+        const unsigned char *EntryPtr = Entry;
+        const char *Name = (const char*) PF->SpellingBase + ReadLE32(EntryPtr);
+        PF->FileLookup[Name] = Entry;
+    }
+
+    return PF.take();
+}
+
+//===----------------------------------------------------------------------===//
+// PTHManager methods.
+//===----------------------------------------------------------------------===//
+
+PTHManager::PTHManager(const PTHFile &F)
+    : File(F), PerIDCache(F.NumIds), PP(0), NumLexersCreated(0),
+      NumStaleFiles(0), NumMissingFiles(0), NumIdsResolved(0) {
+}
+
+PTHManager::~PTHManager() {
+}
+
+IdentifierInfo *PTHManager::LazilyCreateIdentifierInfo(unsigned PersistentID) {
+    assert(PersistentID < File.NumIds && "Invalid persistent identifier ID");
+    const unsigned char *p = File.IdTable + PersistentID*4;
+    const char *Name = (const char*) File.SpellingBase + ReadLE32(p);
+
+    ++NumIdsResolved;
+    IdentifierInfo *II = PP->getIdentifierInfo(Name);
+    PerIDCache[PersistentID] = II;
+    return II;
+}
+
+PTHLexer *PTHManager::CreateLexer(FileID FID) {
+    assert(PP && "No preprocessor set yet!");
+    const FileEntry *FE = PP->getSourceManager().getFileEntryForID(FID);
+    if (!FE)
+        return 0;
+
+    const unsigned char *Entry = File.FileLookup.lookup(FE->getName());
+    if (!Entry) {
+        ++NumMissingFiles;
+        return 0;
+    }
+
+    Entry += 4;  // Skip the name.
+    uint32_t TokenOffset = ReadLE32(Entry);
+    uint32_t PPCondOffset = ReadLE32(Entry);
+    uint32_t NumPPCond = ReadLE32(Entry);
+    uint64_t Size = ReadLE64(Entry);
+    uint64_t ModTime = ReadLE64(Entry);
+
+    // The cached tokens are only good for the exact file they were made from.
+    uint64_t DiskSize, DiskModTime;
+    if (Size != (uint64_t) FE->getSize() ||
+        !StatFile(FE->getName(), DiskSize, DiskModTime) ||
+        Size != DiskSize || ModTime != DiskModTime) {
+        ++NumStaleFiles;
+        return 0;
+    }
+
+    ++NumLexersCreated;
+    return new PTHLexer(*PP, FID, File.BufStart + TokenOffset,
+                        File.BufStart + PPCondOffset, NumPPCond, *this);
+}
+
+void PTHManager::PrintStats() const {
+    std::cerr << "\n*** PTH Stats:\n";
+    std::cerr << File.getNumFiles() << " files, " << File.getNumIdentifiers()
+              << " identifiers in the token cache.\n";
+    std::cerr << NumLexersCreated << " files lexed from the cache, "
+              << NumStaleFiles << " stale, " << NumMissingFiles << " not cached.\n";
+    std::cerr << NumIdsResolved << " identifiers resolved.\n";
+}
@@ -0,0 +1,105 @@
+/***********************************
+* File:     PTHLexer.h
+*
+* Author:   agent
+*
+* Email:    agent@local
+*
+* Date:     2026/10/16
+***********************************/
+
+#ifndef CPTOYC_PTHLEXER_H
+#define CPTOYC_PTHLEXER_H
+
+#include "PreprocessorLexer.h"
+#include <stdint.h>
+#include <string>
+
+namespace CPToyC {
+    namespace Compiler {
+
+        class PTHManager;
+
+        /// PTHLexer - This lexer returns the tokens of a file from a pre-tokenized
+        /// header (PTH) file instead of lexing its characters.  It plays the role of
+        /// Lexer on the include stack, so directives, the multiple-include
+        /// optimization and conditional skipping all keep working.
+        class PTHLexer : public PreprocessorLexer {
+            SourceLocation FileStartLoc;
+
+            /// TokBuf - Buffer from PTH file containing raw token data.
+            const unsigned char* TokBuf;
+
+            /// CurPtr - Pointer into current offset of the token buffer where
+            ///  the next token will be read.
+            const unsigned char* CurPtr;
+
+            /// LastHashTokPtr - Pointer into TokBuf of the last processed '#'
+            ///  token that appears at the start of a line.
+            const unsigned char* LastHashTokPtr;
+
+            /// PPCond - Pointer to a side table in the PTH file that provides a
+            ///  a consise summary of the preproccessor conditional block structure.
+            ///  This is used to perform quick skipping of conditional blocks.
+            const unsigned char* PPCond;
+            unsigned NumPPCond;
+
+            PTHLexer(const PTHLexer&);  // DO NOT IMPLEMENT
+            void operator=(const PTHLexer&); // DO NOT IMPLEMENT
+
+            /// ReadToken - Decode the token record at Ptr into Tok, returning the
+            ///  identifier ID stored with it (0 if there is none).
+            uint32_t ReadToken(const unsigned char *Ptr, Token &Tok);
+
+            /// PTHMgr - The PTHManager object that created this PTHLexer.
+            PTHManager& PTHMgr;
+
+        protected:
+            friend class PTHManager;
+            PTHLexer(Preprocessor& pp, FileID FID, const unsigned char* D,
+                     const unsigned char* ppcond, unsigned numppcond,
+                     PTHManager &PM);
+        public:
+
+            ~PTHLexer() {}
+
+            /// Lex - Return the next token.
+            void Lex(Token &Tok);
+
+            /// getEOF - Return the eof token of this file.  Only valid once Lex has
+            /// reached it.
+            void getEOF(Token &Tok);
+
+            /// DiscardToEndOfLine - Skip the rest of the current preprocessor line.
+            /// This switches the lexer out of directive mode.
+            void DiscardToEndOfLine();
+
+            /// ReadToEndOfLine - Read the rest of the current preprocessor line as an
+            /// uninterpreted string.  Token records carry no whitespace, so the text
+            /// is recovered from the source buffer.  This switches the lexer out of
+            /// directive mode.
+            std::string ReadToEndOfLine();
+
+            /// isNextPPTokenLParen - Return 1 if the next unexpanded token will return a
+            /// tok::l_paren token, 0 if it is something else and 2 if there are no more
+            /// tokens controlled by this lexer.
+            unsigned isNextPPTokenLParen();
+
+            /// IndirectLex - An indirect call to 'Lex' that can be invoked via
+            ///  the PreprocessorLexer interface.
+            void IndirectLex(Token &Result) { Lex(Result); }
+
+            /// getSourceLocation - Return a source location for the next character in
+            /// the current file, i.e. the end of the last token read, as Lexer does.
+            SourceLocation getSourceLocation();
+
+            /// SkipBlock - Used by Preprocessor to skip the current conditional block.
+            ///  Returns true if the block ended with an #endif, whose line has then
+            ///  been consumed, or false if the lexer is positioned on the directive
+            ///  name of an #else or #elif.
+            bool SkipBlock();
+        };
+    }
+}
+
+#endif //CPTOYC_PTHLEXER_H
@@ -0,0 +1,167 @@
+/***********************************
+* File:     PTHManager.h
+*
+* Author:   agent
+*
+* Email:    agent@local
+*
+* Date:     2026/10/16
+***********************************/
+
+#ifndef CPTOYC_PTHMANAGER_H
+#define CPTOYC_PTHMANAGER_H
+
+#include "Basic/SourceLocation.h"
+#include "llvm/StringMap.h"
+#include "llvm/OwningPtr.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace CPToyC {
+    namespace Compiler {
+
+        class FileEntry;
+        class MemoryBuffer;
+        class IdentifierInfo;
+        class Preprocessor;
+        class PTHLexer;
+
+        /// PTH file layout.  Every integer is stored little-endian.
+        ///
+        ///   Header:      Magic[8], Version, NumFiles, FileTableOffset,
+        ///                NumIdentifiers, IdentifierTableOffset, SpellingsOffset
+        ///   File table:  NameOffset, TokenOffset, PPCondOffset, NumPPCond,
+        ///                Size (u64), ModTime (u64, in nanoseconds)
+        ///                -- one entry per file
+        ///   Tokens:      Kind | Flags << 8 | Length << 16, IdOrSpelling, Offset
+        ///   PPCond:      HashTokenIndex, TargetEntry  -- one entry per #if,
+        ///                #ifdef, #ifndef, #elif, #else and #endif
+        ///   Identifiers: offset of each NUL terminated name, by persistent ID
+        ///   Spellings:   raw bytes of every name and literal, NUL terminated
+        namespace pth {
+            enum {
+                Version = 2,
+                HeaderSize = 8 + 4*6,
+                FileEntrySize = 4*4 + 8*2,
+                TokenSize = 4*3,
+                PPCondEntrySize = 4*2
+            };
+
+            extern const char Magic[8];
+
+            inline uint32_t ReadLE32(const unsigned char *&Data) {
+                uint32_t V = ((uint32_t) Data[0]) |
+                             ((uint32_t) Data[1] << 8) |
+                             ((uint32_t) Data[2] << 16) |
+                             ((uint32_t) Data[3] << 24);
+                Data += 4;
+                return V;
+            }
+
+            inline uint64_t ReadLE64(const unsigned char *&Data) {
+                uint64_t Lo = ReadLE32(Data);
+                uint64_t Hi = ReadLE32(Data);
+                return Lo | (Hi << 32);
+            }
+
+            /// StatFile - Get the size and the modification time, in nanoseconds,
+            /// that a cached file is recorded and checked with.  FileEntry only
+            /// keeps the mtime in seconds.  Returns false if the file can't be
+            /// stat'ed.
+            bool StatFile(const char *Path, uint64_t &Size, uint64_t &ModTime);
+        }
+
+        /// PTHFile - A loaded pre-tokenized header file.  Every offset in it is
+        /// checked when it is created, so the lexers reading it need no bounds
+        /// checks.  It is not changed after that, so the PTHManagers of all
+        /// translation units share one PTHFile, on any thread.
+        class PTHFile {
+            friend class PTHManager;
+            friend class PTHLexer;
+
+            /// Buf - The memory mapped PTH file.
+            llvm::OwningPtr<const MemoryBuffer> Buf;
+
+            /// FileLookup - Maps a file name to its entry in the file table.
+            llvm::StringMap<const unsigned char*> FileLookup;
+
+            /// IdTable - Offsets of the identifier names, indexed by persistent ID.
+            const unsigned char *IdTable;
+            unsigned NumIds;
+
+            /// SpellingBase - Start of the spelling pool in the PTH file.
+            const unsigned char *SpellingBase;
+
+            /// BufStart/BufEnd - Bounds of the PTH file, used to validate offsets.
+            const unsigned char *BufStart, *BufEnd;
+
+            PTHFile(const MemoryBuffer *buf);
+
+            PTHFile(const PTHFile&); // DO NOT IMPLEMENT
+            void operator=(const PTHFile&); // DO NOT IMPLEMENT
+
+            const char *ValidateFileEntry(const unsigned char *Entry) const;
+
+        public:
+            ~PTHFile();
+
+            /// Create - Load and validate the specified PTH file.  This method
+            ///  returns NULL if it can't be read or is malformed, filling in ErrStr
+            ///  if it is non-null.
+            static PTHFile *Create(const std::string &file, std::string *ErrStr = 0);
+
+            unsigned getNumFiles() const { return FileLookup.getNumItems(); }
+            unsigned getNumIdentifiers() const { return NumIds; }
+        };
+
+        /// PTHManager - Hands out PTHLexers for the source files a PTHFile covers,
+        /// on behalf of one Preprocessor.  An entry is only used when the file on
+        /// disk still has the size and modification time it was cached with.
+        class PTHManager {
+            friend class PTHLexer;
+
+            /// File - The token cache, shared with other translation units.
+            const PTHFile &File;
+
+            /// PerIDCache - Lazily resolved IdentifierInfo objects, indexed by the
+            ///  persistent identifier ID used in the PTH file.
+            std::vector<IdentifierInfo*> PerIDCache;
+
+            /// PP - The Preprocessor object that will use this PTHManager to create
+            ///  PTHLexer objects.
+            Preprocessor *PP;
+
+            // Statistics.
+            unsigned NumLexersCreated, NumStaleFiles, NumMissingFiles;
+            unsigned NumIdsResolved;
+
+            PTHManager(const PTHManager&); // DO NOT IMPLEMENT
+            void operator=(const PTHManager&); // DO NOT IMPLEMENT
+
+            /// GetIdentifierInfo - Used to reconstruct IdentifierInfo objects from the
+            ///  PTH file.
+            IdentifierInfo *GetIdentifierInfo(unsigned PersistentID) {
+                if (IdentifierInfo *II = PerIDCache[PersistentID])
+                    return II;
+                return LazilyCreateIdentifierInfo(PersistentID);
+            }
+            IdentifierInfo *LazilyCreateIdentifierInfo(unsigned PersistentID);
+
+        public:
+            explicit PTHManager(const PTHFile &F);
+            ~PTHManager();
+
+            void setPreprocessor(Preprocessor *pp) { PP = pp; }
+
+            /// CreateLexer - Return a PTHLexer that "lexes" the cached tokens for the
+            ///  specified file.  This method returns NULL if no cached tokens exist
+            ///  for the file or if they are out of date.
+            PTHLexer *CreateLexer(FileID FID);
+
+            void PrintStats() const;
+        };
+    }
+}
+
+#endif //CPTOYC_PTHMANAGER_H
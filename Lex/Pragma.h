@@ -0,0 +1,90 @@
+/***********************************
+* File:     Pragma.h
+*
+* Author:   agent
+*
+* Email:    agent@local
+*
+* Date:     2026/10/16
+***********************************/
+
+#ifndef CPTOYC_PRAGMA_H
+#define CPTOYC_PRAGMA_H
+
+#include "llvm/DenseMap.h"
+
+namespace CPToyC {
+    namespace Compiler {
+        class Preprocessor;
+        class Token;
+        class IdentifierInfo;
+        class PragmaNamespace;
+
+        /// PragmaHandler - Instances of this interface defined to handle the various
+        /// pragmas that the language front-end uses.  Each handler optionally has a
+        /// name (e.g. "pack") and the HandlePragma method is invoked when a pragma with
+        /// that identifier is found.  If a handler does not match any of the declared
+        /// pragmas the handler with a null identifier is invoked, if it exists.
+        ///
+        /// Note that the PragmaNamespace class can be used to subdivide pragmas, e.g.
+        /// we treat "#pragma STDC" and "#pragma GCC" as namespaces that contain other
+        /// pragmas.
+        class PragmaHandler {
+            const IdentifierInfo *Name;
+        public:
+            PragmaHandler(const IdentifierInfo *name) : Name(name) {}
+            virtual ~PragmaHandler();
+
+            const IdentifierInfo *getName() const { return Name; }
+            virtual void HandlePragma(Preprocessor &PP, Token &FirstToken) = 0;
+
+            /// getIfNamespace - If this is a namespace, return it.  This is equivalent to
+            /// using a dynamic_cast, but doesn't require RTTI.
+            virtual PragmaNamespace *getIfNamespace() { return 0; }
+        };
+
+        /// PragmaNamespace - This PragmaHandler subdivides the namespace of pragmas,
+        /// allowing hierarchical pragmas to be defined.  Common examples of namespaces
+        /// are "#pragma GCC", "#pragma STDC", and "#pragma omp", but any namespaces may
+        /// be (potentially recursively) defined.
+        ///
+        /// Handlers are keyed by their uniqued IdentifierInfo, so dispatching a pragma
+        /// is a single hash lookup no matter how many handlers are registered.
+        class PragmaNamespace : public PragmaHandler {
+            /// Handlers - This is a map of the handlers in this namespace, keyed by
+            /// their name.
+            llvm::DenseMap<const IdentifierInfo*, PragmaHandler*> Handlers;
+
+            /// NullHandler - The handler with a null name, invoked for any pragma in
+            /// this namespace that has no handler of its own.
+            PragmaHandler *NullHandler;
+        public:
+            PragmaNamespace(const IdentifierInfo *Name)
+                : PragmaHandler(Name), NullHandler(0) {}
+            virtual ~PragmaNamespace();
+
+            /// FindHandler - Check to see if there is already a handler for the
+            /// specified name.  If not, return the handler for the null identifier if it
+            /// exists, otherwise return null.  If IgnoreNull is true (the default) then
+            /// the null handler isn't returned on failure to match.
+            PragmaHandler *FindHandler(const IdentifierInfo *Name,
+                                       bool IgnoreNull = true) const;
+
+            /// AddPragma - Add a pragma to this namespace.
+            ///
+            void AddPragma(PragmaHandler *Handler);
+
+            /// RemovePragmaHandler - Remove the given handler from the
+            /// namespace.
+            void RemovePragmaHandler(PragmaHandler *Handler);
+
+            bool IsEmpty() { return Handlers.empty() && NullHandler == 0; }
+
+            virtual void HandlePragma(Preprocessor &PP, Token &FirstToken);
+
+            virtual PragmaNamespace *getIfNamespace() { return this; }
+        };
+    }
+}
+
+#endif //CPTOYC_PRAGMA_H
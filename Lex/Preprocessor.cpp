@@ -10,7 +10,10 @@
 #include "Preprocessor.h"
 #include "Basic/HeaderSearch.h"
 #include "MacroInfo.h"
+#include "MacroArgs.h"
 #include "lexer.h"
+#include "PTHManager.h"
+#include "Pragma.h"
 #include "Basic/FileManager.h"
 #include "Basic/IdentifierTable.h"
 #include "llvm/APFloat.h"
@@ -42,7 +45,10 @@ Preprocessor::Preprocessor(Diagnostic &diags, const LangOptions &opts,
     NumMacroExpanded = NumFnMacroExpanded = NumBuiltinMacroExpanded = 0;
     NumFastMacroExpanded = NumTokenPaste = NumFastTokenPaste = 0;
     MaxIncludeStackDepth = 0;
-    NumSkipped = 0;
+    NumSkipped = NumSkipRangesRecorded = NumSkipRangeHits = 0;
+    NumDirectiveIndexJumps = 0;
+    NumMacroArgsAllocated = NumMacroArgsReused = 0;
+    NumMacroExpansionsRecorded = NumMacroExpansionsReplayed = 0;
 
     // Default to discarding comments.
     KeepComments = false;
@@ -52,6 +58,11 @@ Preprocessor::Preprocessor(Diagnostic &diags, const LangOptions &opts,
     DisableMacroExpansion = false;
     InMacroArgs = false;
     NumCachedTokenLexers = 0;
+    MacroArgCache = 0;
+    MacroGeneration = 0;
+    CurRecording = 0;
+    RecordingFailed = false;
+    RecordingEnd = 0;
 
     CachedLexPos = 0;
 
@@ -59,6 +70,10 @@ Preprocessor::Preprocessor(Diagnostic &diags, const LangOptions &opts,
     // This gets unpoisoned where it is allowed.
     (Ident__VA_ARGS__ = getIdentifierInfo("__VA_ARGS__"))->setIsPoisoned();
 
+    // Initialize the pragma handlers.
+    PragmaHandlers = new PragmaNamespace(0);
+    RegisterBuiltinPragmas();
+
     // Initialize builtin macros like __LINE__ and friends.
     RegisterBuiltinMacros();
 }
@@ -68,6 +83,7 @@ Preprocessor::~Preprocessor() {
 
     while (!IncludeMacroStack.empty()) {
         delete IncludeMacroStack.back().TheLexer;
+        delete IncludeMacroStack.back().ThePTHLexer;
         delete IncludeMacroStack.back().TheTokenLexer;
         IncludeMacroStack.pop_back();
     }
@@ -80,15 +96,24 @@ Preprocessor::~Preprocessor() {
         // destroyed. We still need to run the dstor, however, to free
         // memory alocated by MacroInfo.
         I->second->Destroy(BP);
-        I->first->setHasMacroDefinition(false);
+        I->first->setMacroInfo(0);
     }
 
     // Free any cached macro expanders.
     for (unsigned i = 0, e = NumCachedTokenLexers; i != e; ++i)
         delete TokenLexerCache[i];
 
+    // Free the recorded macro expansions.
+    for (llvm::DenseMap<IdentifierInfo*, CachedMacroExpansion*>::iterator I =
+            MacroExpansionCache.begin(), E = MacroExpansionCache.end(); I != E; ++I)
+        delete I->second;
+
+    // Free any cached MacroArgs.
+    for (MacroArgs *ArgList = MacroArgCache; ArgList; )
+        ArgList = ArgList->deallocate();
+
     // Release pragma information.
-//    delete PragmaHandlers;
+    delete PragmaHandlers;
 
     // Delete the scratch buffer info.
     delete ScratchBuf;
@@ -96,6 +121,11 @@ Preprocessor::~Preprocessor() {
     delete Callbacks;
 }
 
+void Preprocessor::setPTHManager(PTHManager* pm) {
+    PTH.reset(pm);
+    PTH->setPreprocessor(this);
+}
+
 void Preprocessor::DumpToken(const Token &Tok, bool DumpFlags) const {
     std::cerr << tok::getTokenName(Tok.getKind()) << " \t'"<< getSpelling(Tok) << "'";
 
@@ -145,13 +175,25 @@ void Preprocessor::PrintStats() {
     std::cerr << "  " << NumEndif << " #endif.\n";
     std::cerr << "  " << NumPragma << " #pragma.\n";
     std::cerr << NumSkipped << " #if/#ifndef#ifdef regions skipped\n";
+    std::cerr << "  " << NumSkipRangesRecorded << " skipped stretches recorded, "
+              << NumSkipRangeHits << " jumped over without lexing.\n";
+    std::cerr << "  " << NumDirectiveIndexJumps
+              << " jumps to the next directive line while skipping.\n";
 
     std::cerr << NumMacroExpanded << "/" << NumFnMacroExpanded << "/"
               << NumBuiltinMacroExpanded << " obj/fn/builtin macros expanded, "
               << NumFastMacroExpanded << " on the fast path.\n";
+    std::cerr << NumMacroArgsAllocated << " macro argument lists allocated, "
+              << NumMacroArgsReused << " reused from the free list.\n";
+    std::cerr << NumMacroExpansionsRecorded
+              << " object-like macro expansions recorded, "
+              << NumMacroExpansionsReplayed << " replayed.\n";
     std::cerr << (NumFastTokenPaste+NumTokenPaste)
               << " token paste (##) operations performed, "
               << NumFastTokenPaste << " on the fast path.\n";
+
+    if (PTH)
+        PTH->PrintStats();
 }
 
 //===----------------------------------------------------------------------===//
@@ -318,6 +360,26 @@ SourceLocation Preprocessor::getLocForEndOfToken(SourceLocation Loc) {
     return AdvanceToTokenCharacter(Loc, Len);
 }
 
+/// getInstantiationLineNumber - In -E mode this is asked for the first token of
+/// every line, which would otherwise make the SourceManager build the line table
+/// of every file and binary search it each time.
+unsigned Preprocessor::getInstantiationLineNumber(SourceLocation Loc) {
+    if (Loc.isInvalid()) return 0;
+    Loc = SourceMgr.getInstantiationLoc(Loc);
+
+    // The location is almost always in the file being lexed, or in a file that
+    // includes it.
+    if (CurLexer)
+        if (unsigned LineNo = CurLexer->getLineNumber(Loc))
+            return LineNo;
+    for (unsigned i = IncludeMacroStack.size(); i != 0; --i)
+        if (Lexer *L = IncludeMacroStack[i-1].TheLexer)
+            if (unsigned LineNo = L->getLineNumber(Loc))
+                return LineNo;
+
+    return SourceMgr.getInstantiationLineNumber(Loc);
+}
+
 
 //===----------------------------------------------------------------------===//
 // Preprocessor Initialization Methods
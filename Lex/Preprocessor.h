@@ -11,6 +11,7 @@
 #ifndef CPTOYC_PREPROCESSOR_H
 #define CPTOYC_PREPROCESSOR_H
 #include "lexer.h"
+#include "PTHLexer.h"
 #include "PPCallbacks.h"
 #include "TokenLexer.h"
 #include "DirectoryLookup.h"
@@ -18,6 +19,7 @@
 #include "Basic/IdentifierTable.h"
 #include "Basic/SourceLocation.h"
 #include "llvm/DenseMap.h"
+#include "llvm/SmallVector.h"
 #include "llvm/OwningPtr.h"
 #include "llvm/Allocator.h"
 #include "Basic/LangOptions.h"
@@ -35,8 +37,13 @@ namespace CPToyC {
         class ScratchBuffer;
         class PPCallbacks;
         class DirectoryLookup;
+        class PTHManager;
+        class PragmaNamespace;
+        class PragmaHandler;
 
         class Preprocessor {
+            friend class MacroArgs;
+
             Diagnostic          *Diags;
             LangOptions         Features;
             FileManager         &FileMgr;
@@ -44,6 +51,10 @@ namespace CPToyC {
             ScratchBuffer       *ScratchBuf;
             HeaderSearch        &HeaderInfo;
 
+            /// PTH - An optional PTHManager object used for getting tokens from
+            ///  a token cache rather than lexing the original source file.
+            llvm::OwningPtr<PTHManager> PTH;
+
             /// BP - A BumpPtrAllocator object used to quickly allocate and release
             ///  objects internal to the Preprocessor.
             llvm::BumpPtrAllocator BP;
@@ -56,6 +67,7 @@ namespace CPToyC {
             IdentifierInfo *Ident__TIMESTAMP__;              // __TIMESTAMP__
             IdentifierInfo *Ident__COUNTER__;                // __COUNTER__
             IdentifierInfo *Ident__VA_ARGS__;                // __VA_ARGS__
+            IdentifierInfo *Ident_Pragma;                    // _Pragma
 
             SourceLocation DATELoc, TIMELoc;
             unsigned CounterValue;  // Next __COUNTER__ value.
@@ -77,6 +89,10 @@ namespace CPToyC {
             /// the program, including program keywords.
             IdentifierTable Identifiers;
 
+            /// PragmaHandlers - This tracks all of the pragmas that the client registered
+            /// with this preprocessor.
+            PragmaNamespace *PragmaHandlers;
+
             /// \brief Tracks all of the comment handlers that the client registered
             /// with this preprocessor.
             std::vector<CommentHandler *> CommentHandlers;
@@ -86,6 +102,11 @@ namespace CPToyC {
             ///  Only one of CurLexer, CurPTHLexer, or CurTokenLexer will be non-null.
             llvm::OwningPtr<Lexer> CurLexer;
 
+            /// CurPTHLexer - This is the current top of stack that we're lexing from if
+            ///  not expanding from a macro and we are lexing from a PTH cache.
+            ///  Only one of CurLexer, CurPTHLexer, or CurTokenLexer will be non-null.
+            llvm::OwningPtr<PTHLexer> CurPTHLexer;
+
             /// CurPPLexer - This is the current top of the stack what we're lexing from
             ///  if not expanding a macro.  This is an alias for either CurLexer or
             ///  CurPTHLexer.
@@ -105,13 +126,15 @@ namespace CPToyC {
             /// CurLexer/CurTokenLexer.
             struct IncludeStackInfo {
                 Lexer                 *TheLexer;
+                PTHLexer              *ThePTHLexer;
                 PreprocessorLexer     *ThePPLexer;
                 TokenLexer            *TheTokenLexer;
                 const DirectoryLookup *TheDirLookup;
 
-                IncludeStackInfo(Lexer *L, PreprocessorLexer* PPL,
+                IncludeStackInfo(Lexer *L, PTHLexer* P, PreprocessorLexer* PPL,
                                  TokenLexer* TL, const DirectoryLookup *D)
-                        : TheLexer(L), ThePPLexer(PPL), TheTokenLexer(TL), TheDirLookup(D) {}
+                        : TheLexer(L), ThePTHLexer(P), ThePPLexer(PPL), TheTokenLexer(TL),
+                          TheDirLookup(D) {}
             };
             std::vector<IncludeStackInfo> IncludeMacroStack;
 
@@ -120,7 +143,8 @@ namespace CPToyC {
             PPCallbacks *Callbacks;
 
             /// Macros - For each IdentifierInfo with 'HasMacro' set, we keep a mapping
-            /// to the actual definition of the macro.
+            /// to the actual definition of the macro.  This is only used to walk the
+            /// defined macros; lookups use the MacroInfo stored in the IdentifierInfo.
             llvm::DenseMap<IdentifierInfo*, MacroInfo*> Macros;
 
             /// MICache - A "freelist" of MacroInfo objects that can be reused for quick
@@ -133,7 +157,19 @@ namespace CPToyC {
             unsigned NumEnteredSourceFiles, MaxIncludeStackDepth;
             unsigned NumMacroExpanded, NumFnMacroExpanded, NumBuiltinMacroExpanded;
             unsigned NumFastMacroExpanded, NumTokenPaste, NumFastTokenPaste;
-            unsigned NumSkipped;
+            unsigned NumSkipped, NumSkipRangesRecorded, NumSkipRangeHits;
+            unsigned NumDirectiveIndexJumps;
+            unsigned NumMacroArgsAllocated, NumMacroArgsReused;
+            unsigned NumMacroExpansionsRecorded, NumMacroExpansionsReplayed;
+
+            /// SkipRanges - The stretches of excluded conditional blocks skipped so
+            /// far, from the offset in a file where skipping started or resumed to the
+            /// offset of the '#' of the #elif, #else or #endif at the same nesting
+            /// level that ended it.  Nothing in such a stretch depends on the macros
+            /// defined, so when it is skipped again the lexer jumps straight to that
+            /// directive.  A stretch that produced a diagnostic is not recorded, so
+            /// the diagnostic is reported every time.
+            llvm::DenseMap<std::pair<const FileEntry*, unsigned>, unsigned> SkipRanges;
 
             /// Predefines - This string is the predefined macros that preprocessor
             /// should use from the command line etc.
@@ -144,6 +180,57 @@ namespace CPToyC {
             unsigned NumCachedTokenLexers;
             TokenLexer *TokenLexerCache[TokenLexerCacheSize];
 
+            /// MacroArgCache - This is a "freelist" of MacroArg objects that can be
+            /// reused for quick allocation.
+            MacroArgs *MacroArgCache;
+
+            /// MacroGeneration - Bumped on every #define and #undef.  Each MacroInfo
+            /// records the value it was installed with.
+            unsigned MacroGeneration;
+
+            /// CachedMacroExpansion - The fully expanded tokens of an object-like
+            /// macro, recorded the first time it is expanded outside of any other
+            /// macro.  Later uses of the macro return these tokens instead of
+            /// expanding the nested macros again.
+            struct CachedMacroExpansion {
+                /// Macros - Each macro that was expanded to produce Tokens, and each
+                /// identifier among Tokens that is left alone, with the generation of
+                /// its definition or 0 if it is not a macro.  The expansion is only
+                /// reused while all of them are defined the same way, and not while
+                /// any of them is being expanded.  The first is the macro itself.
+                llvm::SmallVector<std::pair<IdentifierInfo*, unsigned>, 4> Macros;
+
+                /// Tokens - The expanded tokens.  Their locations are not used.
+                std::vector<Token> Tokens;
+
+                /// Runs - Ranges of characters, each within one buffer, covering the
+                /// spellings of Tokens.  A use of the expansion creates one
+                /// instantiation entry per run.
+                llvm::SmallVector<std::pair<SourceLocation, unsigned>, 4> Runs;
+
+                /// TokenLocs - The run each token is spelled in and its offset there.
+                std::vector<std::pair<unsigned, unsigned> > TokenLocs;
+
+                /// Cacheable - False if the expansion depends on more than the macro
+                /// definitions (it used __LINE__, produced a diagnostic, ran past the
+                /// end of the macro, ...) or expanded no other macro, so recording it
+                /// again is not worth it until a definition changes.
+                bool Cacheable;
+            };
+
+            /// MacroExpansionCache - The recorded expansion of each object-like
+            /// macro, by name.
+            llvm::DenseMap<IdentifierInfo*, CachedMacroExpansion*> MacroExpansionCache;
+
+            /// CurRecording - The expansion being recorded, if any.  Diagnostics are
+            /// held back while recording; RecordingFailed is set instead.
+            CachedMacroExpansion *CurRecording;
+            bool RecordingFailed;
+
+            /// RecordingEnd - The EOF stream below the expansion being recorded.
+            /// A lookahead for '(' that reaches it fails the recording.
+            TokenLexer *RecordingEnd;
+
         private:  // Cached tokens state.
             typedef std::vector<Token> CachedTokensTy;
 
@@ -180,6 +267,12 @@ namespace CPToyC {
             IdentifierTable &getIdentifierTable() { return Identifiers; }
             llvm::BumpPtrAllocator &getPreprocessorAllocator() { return BP; }
 
+            /// setPTHManager - Use the specified token cache for source files it has
+            ///  up-to-date tokens for.  The Preprocessor takes ownership of it.
+            void setPTHManager(PTHManager* pm);
+
+            PTHManager *getPTHManager() { return PTH.get(); }
+
             /// SetCommentRetentionState - Control whether or not the preprocessor retains
             /// comments in output.
             void SetCommentRetentionState(bool KeepComments, bool KeepMacroComments) {
@@ -213,7 +306,7 @@ namespace CPToyC {
             /// getMacroInfo - Given an identifier, return the MacroInfo it is #defined to
             /// or null if it isn't #define'd.
             MacroInfo *getMacroInfo(IdentifierInfo *II) const {
-                return II->hasMacroDefinition() ? Macros.find(II)->second : 0;
+                return II->getMacroInfo();
             }
 
             /// setMacroInfo - Specify a macro for this identifier.
@@ -243,10 +336,29 @@ namespace CPToyC {
                 return &Identifiers.get(NameStart, NameEnd);
             }
 
+            /// getIdentifierInfo - Like the above, for a name whose llvm::HashString
+            /// has already been computed.
+            IdentifierInfo *getIdentifierInfo(const char *NameStart,
+                                              const char *NameEnd,
+                                              unsigned FullHash) {
+                return &Identifiers.get(NameStart, NameEnd, FullHash);
+            }
+
             IdentifierInfo *getIdentifierInfo(const char *NameStr) {
                 return getIdentifierInfo(NameStr, NameStr+strlen(NameStr));
             }
 
+            /// AddPragmaHandler - Add the specified pragma handler to the preprocessor.
+            /// If 'Namespace' is non-null, then it is a token required to exist on the
+            /// pragma line before the pragma string starts, e.g. "STDC" or "GCC".
+            void AddPragmaHandler(const char *Namespace, PragmaHandler *Handler);
+
+            /// RemovePragmaHandler - Remove the specific pragma handler from
+            /// the preprocessor. If \arg Namespace is non-null, then it should
+            /// be the namespace that \arg Handler was added to. It is an error
+            /// to remove a handler that has not been registered.
+            void RemovePragmaHandler(const char *Namespace, PragmaHandler *Handler);
+
             /// \brief Add the specified comment handler to the preprocessor.
             void AddCommentHandler(CommentHandler *Handler);
 
@@ -323,6 +435,8 @@ namespace CPToyC {
             void Lex(Token &Result) {
                 if (CurLexer)
                     CurLexer->Lex(Result);
+                else if (CurPTHLexer)
+                    CurPTHLexer->Lex(Result);
                 else if (CurTokenLexer)
                     CurTokenLexer->Lex(Result);
                 else
@@ -417,12 +531,15 @@ namespace CPToyC {
             /// the specified Token's location, translating the token's start
             /// position in the current buffer into a SourcePosition object for rendering.
             DiagnosticBuilder Diag(SourceLocation Loc, unsigned DiagID) {
+                if (CurRecording) {
+                    RecordingFailed = true;
+                    return DiagnosticBuilder(DiagnosticBuilder::Suppress);
+                }
                 return Diags->Report(FullSourceLoc(Loc, getSourceManager()), DiagID);
             }
 
             DiagnosticBuilder Diag(const Token &Tok, unsigned DiagID) {
-                return Diags->Report(FullSourceLoc(Tok.getLocation(), getSourceManager()),
-                                     DiagID);
+                return Diag(Tok.getLocation(), DiagID);
             }
 
             /// getSpelling() - Return the 'spelling' of the Tok token.  The spelling of a
@@ -478,6 +595,12 @@ namespace CPToyC {
             /// source location.
             SourceLocation getLocForEndOfToken(SourceLocation Loc);
 
+            /// getInstantiationLineNumber - Return the physical line number of the
+            /// instantiation point of the specified location, like the SourceManager
+            /// method of the same name.  If that point is in a file being lexed, the
+            /// lexer's running line counter answers without a line table lookup.
+            unsigned getInstantiationLineNumber(SourceLocation Loc);
+
             /// DumpToken - Print the token to stderr, used for debugging.
             ///
             void DumpToken(const Token &Tok, bool DumpFlags = false) const;
@@ -558,9 +681,17 @@ namespace CPToyC {
             ///  SourceLocation.
             MacroInfo* AllocateMacroInfo(SourceLocation L);
 
+            // Pragmas.
+            void HandlePragmaOnce(Token &OnceTok);
+            void HandlePragmaMark();
+            void HandlePragmaPoison(Token &PoisonTok);
+            void HandlePragmaSystemHeader(Token &SysHeaderTok);
+            void HandlePragmaDependency(Token &DependencyTok);
+
         private:
             void PushIncludeMacroStack() {
                 IncludeMacroStack.push_back(IncludeStackInfo(CurLexer.take(),
+                                                             CurPTHLexer.take(),
                                                              CurPPLexer,
                                                              CurTokenLexer.take(),
                                                              CurDirLookup));
@@ -569,6 +700,7 @@ namespace CPToyC {
 
             void PopIncludeMacroStack() {
                 CurLexer.reset(IncludeMacroStack.back().TheLexer);
+                CurPTHLexer.reset(IncludeMacroStack.back().ThePTHLexer);
                 CurPPLexer = IncludeMacroStack.back().ThePPLexer;
                 CurTokenLexer.reset(IncludeMacroStack.back().TheTokenLexer);
                 CurDirLookup  = IncludeMacroStack.back().TheDirLookup;
@@ -609,6 +741,11 @@ namespace CPToyC {
             ///  SkipExcludedConditionalBlock.
             void PTHSkipExcludedConditionalBlock();
 
+            /// SkipToNextDirectiveLine - Move the skipping lexer to the next line of
+            /// its buffer that may hold a directive, as far as the DirectiveIndex of
+            /// the buffer tells.
+            const char *SkipToNextDirectiveLine(const DirectiveIndex &DI);
+
             /// EvaluateDirectiveExpression - Evaluate an integer constant expression that
             /// may occur after a #if or #elif directive and return it as a bool.  If the
             /// expression is equivalent to "!defined(X)" return X in IfNDefMacro.
@@ -627,6 +764,28 @@ namespace CPToyC {
             /// the macro should not be expanded return true, otherwise return false.
             bool HandleMacroExpandedIdentifier(Token &Tok, MacroInfo *MI);
 
+            /// ExpandCachedMacro - Expand the object-like macro named by Tok from
+            /// its recorded expansion, recording it first if it has none, and return
+            /// the first expanded token as 'Tok'.  Return false, leaving Tok alone,
+            /// if the macro has to be expanded the normal way.
+            bool ExpandCachedMacro(Token &Tok, MacroInfo *MI);
+
+            /// RecordMacroExpansion - Fully expand the object-like macro named by
+            /// Tok into CE.  Return false if the result can't stand for this use.
+            bool RecordMacroExpansion(Token &Tok, MacroInfo *MI,
+                                      CachedMacroExpansion &CE);
+
+            /// isMacroExpansionCurrent - Return true if every identifier CE depends
+            /// on still has the definition it was recorded with.  If CheckEnabled,
+            /// none of the macros may be in the middle of an expansion either.
+            bool isMacroExpansionCurrent(const CachedMacroExpansion &CE,
+                                         bool CheckEnabled) const;
+
+            /// EnterExpandedTokens - Return NumToks fully expanded tokens, given in
+            /// an array allocated with new[], as the expansion of the macro named by
+            /// Tok, and lex the first of them into Tok.
+            void EnterExpandedTokens(Token &Tok, Token *Toks, unsigned NumToks);
+
             /// isNextPPTokenLParen - Determine whether the next preprocessor token to be
             /// lexed is a '('.  If so, consume the token and return true, if not, this
             /// method should have no observable side-effect on the lexed tokens.
@@ -647,6 +806,10 @@ namespace CPToyC {
             /// start lexing tokens from it instead of the current buffer.
             void EnterSourceFileWithLexer(Lexer *TheLexer, const DirectoryLookup *Dir);
 
+            /// EnterSourceFileWithPTH - Add a lexer to the top of the include stack and
+            /// start getting tokens from it using the PTH cache.
+            void EnterSourceFileWithPTH(PTHLexer *PL, const DirectoryLookup *Dir);
+
             /// GetIncludeFilenameSpelling - Turn the specified lexer token into a fully
             /// checked and spelled filename, e.g. as an operand of #include. This returns
             /// true if the input filename was in <>'s or false if it were in ""'s.  The
@@ -667,7 +830,7 @@ namespace CPToyC {
             /// IsFileLexer - Returns true if we are lexing from a file and not a
             ///  pragma or a macro.
             static bool IsFileLexer(const Lexer* L, const PreprocessorLexer* P) {
-                return L ? true : P != nullptr;
+                return L ? !L->isPragmaLexer() : P != nullptr;
             }
 
             static bool IsFileLexer(const IncludeStackInfo& I) {
@@ -719,6 +882,10 @@ namespace CPToyC {
             void HandleElseDirective(Token &Tok);
             void HandleElifDirective(Token &Tok);
 
+            // Pragmas.
+            void HandlePragmaDirective();
+            void Handle_Pragma(Token &Tok);
+
         public:
             void HandleComment(SourceRange Comment);
         };
@@ -31,8 +31,8 @@ void PreprocessorLexer::LexIncludeFilename(Token &FilenameTok) {
     // We should have obtained the filename now.
     ParsingFilename = false;
 
-    // No filename?
-    if (FilenameTok.is(tok::eom))
+    // No filename?  Raw lexers (which may have no preprocessor) stay quiet.
+    if (FilenameTok.is(tok::eom) && !LexingRawMode)
         PP->Diag(FilenameTok.getLocation(), diag::err_pp_expects_filename);
 }
 
@@ -39,6 +39,23 @@ void TokenLexer::Init(Token &Tok, SourceLocation ILEnd, MacroArgs *Actuals) {
     DisableMacroExpansion = false;
     NumTokens = Macro->tokens_end()-Macro->tokens_begin();
 
+    // The body of a macro is lexed from one file, so its tokens span a single
+    // range of characters.  Record it so that they can share one instantiation
+    // entry.
+    MacroDefStart = MacroDefLength = 0;
+    MacroExpansionStart = SourceLocation();
+    if (NumTokens) {
+        SourceLocation First = Tokens[0].getLocation();
+        const Token &Last = Tokens[NumTokens-1];
+        if (First.isFileID() && Last.getLocation().isFileID() &&
+            First.getRawEncoding() <= Last.getLocation().getRawEncoding() &&
+            PP.getSourceManager().isFromSameFile(First, Last.getLocation())) {
+            MacroDefStart = First.getRawEncoding();
+            MacroDefLength = Last.getLocation().getRawEncoding() +
+                             Last.getLength() - MacroDefStart;
+        }
+    }
+
     // If this is a function-like macro, expand the arguments and change
     // Tokens to point to the expanded tokens.
     if (Macro->isFunctionLike() && Macro->getNumArgs())
@@ -68,6 +85,8 @@ void TokenLexer::Init(const Token *TokArray, unsigned NumToks,
     NumTokens = NumToks;
     CurToken = 0;
     InstantiateLocStart = InstantiateLocEnd = SourceLocation();
+    MacroDefStart = MacroDefLength = 0;
+    MacroExpansionStart = SourceLocation();
     AtStartOfLine = false;
     HasLeadingSpace = false;
 
@@ -90,7 +109,27 @@ void TokenLexer::destroy() {
     }
 
     // TokenLexer owns its formal arguments.
-    if (ActualArgs) ActualArgs->destroy();
+    if (ActualArgs) ActualArgs->destroy(PP);
+}
+
+/// getInstantiationLoc - Tokens of the macro body map into the range entry of
+/// this expansion by their offset in the body.  Argument tokens, and tokens
+/// spelled in a scratch buffer by pasting or stringizing, still get an entry of
+/// their own.
+SourceLocation TokenLexer::getInstantiationLoc(SourceLocation SpellingLoc,
+                                               unsigned TokLength) {
+    SourceManager &SM = PP.getSourceManager();
+    SourceLocation::UIntTy Offset = SpellingLoc.getRawEncoding() - MacroDefStart;
+    if (SpellingLoc.isFileID() && Offset < MacroDefLength) {
+        if (MacroExpansionStart.isInvalid())
+            MacroExpansionStart = SM.createInstantiationLoc(
+                    SourceLocation::getFromRawEncoding(MacroDefStart),
+                    InstantiateLocStart, InstantiateLocEnd, MacroDefLength);
+        return MacroExpansionStart.getFileLocWithOffset(Offset);
+    }
+
+    return SM.createInstantiationLoc(SpellingLoc, InstantiateLocStart,
+                                     InstantiateLocEnd, TokLength);
 }
 
 /// Expand the arguments of a function-like macro so that we can quickly
@@ -334,13 +373,8 @@ void TokenLexer::Lex(Token &Tok) {
     // diagnostics for the expanded token should appear as if they came from
     // InstantiationLoc.  Pull this information together into a new SourceLocation
     // that captures all of this.
-    if (InstantiateLocStart.isValid()) {   // Don't do this for token streams.
-        SourceManager &SM = PP.getSourceManager();
-        Tok.setLocation(SM.createInstantiationLoc(Tok.getLocation(),
-                                                  InstantiateLocStart,
-                                                  InstantiateLocEnd,
-                                                  Tok.getLength()));
-    }
+    if (InstantiateLocStart.isValid())   // Don't do this for token streams.
+        Tok.setLocation(getInstantiationLoc(Tok.getLocation(), Tok.getLength()));
 
     // If this is the first token, set the lexical properties of the token to
     // match the lexical properties of the macro identifier.
@@ -473,10 +507,7 @@ bool TokenLexer::PasteTokens(Token &Tok) {
                 if (!PP.getLangOptions().AsmPreprocessor) {
                     // Explicitly convert the token location to have proper instantiation
                     // information so that the user knows where it came from.
-                    SourceManager &SM = PP.getSourceManager();
-                    SourceLocation Loc =
-                            SM.createInstantiationLoc(PasteOpLoc, InstantiateLocStart,
-                                                      InstantiateLocEnd, 2);
+                    SourceLocation Loc = getInstantiationLoc(PasteOpLoc, 2);
                     PP.Diag(Loc, diag::err_pp_bad_paste)
                             << std::string(Buffer.begin(), Buffer.end());
                 }
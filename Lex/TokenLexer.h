@@ -58,6 +58,18 @@ namespace CPToyC {
             /// instantiated.
             SourceLocation InstantiateLocStart, InstantiateLocEnd;
 
+            /// MacroDefStart/MacroDefLength - The character range of the macro body in
+            /// its definition, as a raw file location and a length.  Tokens of the
+            /// body are all instantiated through a single SLocEntry that covers this
+            /// range, instead of one entry per token.  MacroDefLength is zero when
+            /// the body is not a contiguous range of a file.
+            SourceLocation::UIntTy MacroDefStart;
+            unsigned MacroDefLength;
+
+            /// MacroExpansionStart - The instantiation location of the first character
+            /// of the macro body, created on first use.
+            SourceLocation MacroExpansionStart;
+
             /// Lexical information about the expansion point of the macro: the identifier
             /// that the macro expanded from had these properties.
             bool AtStartOfLine : 1;
@@ -135,6 +147,11 @@ namespace CPToyC {
             /// token.
             bool PasteTokens(Token &Tok);
 
+            /// getInstantiationLoc - Return the location of a token spelled at
+            /// SpellingLoc with the specified length, as instantiated by this macro.
+            SourceLocation getInstantiationLoc(SourceLocation SpellingLoc,
+                                               unsigned TokLength);
+
             /// Expand the arguments of a function-like macro so that we can quickly
             /// return preexpanded tokens from Tokens.
             void ExpandFunctionArguments();
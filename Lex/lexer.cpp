@@ -19,6 +19,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <set>
+#include <string.h>
+
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define LEXER_HAVE_X86_KERNELS 1
+#else
+#define LEXER_HAVE_X86_KERNELS 0
+#endif
 
 namespace CPToyC {
 	namespace Compiler {
@@ -55,6 +63,13 @@ namespace CPToyC {
 
             // Default to not keeping comments.
             ExtendedTokenMode = 0;
+
+            // This is not a _Pragma lexer until Create_PragmaLexer says so.
+            Is_PragmaLexer = false;
+
+            // Nothing has been counted yet: the buffer starts on line 1.
+            LineCountPtr = BufStart;
+            LineCountNo = 1;
         }
 
         Lexer::Lexer(FileID FID, Preprocessor &PP)
@@ -98,6 +113,48 @@ namespace CPToyC {
             LexingRawMode = true;
         }
 
+        /// Create_PragmaLexer: Lexer constructor - Create a new lexer object for
+        /// _Pragma expansion.  This has a variety of magic semantics that this method
+        /// sets up.  It returns a new'd Lexer that must be delete'd when done.
+        ///
+        /// On entrance to this routine, TokStartLoc is a macro location which has a
+        /// spelling loc that indicates the bytes to be lexed for the token and an
+        /// instantiation location that indicates where all lexed tokens should be
+        /// "expanded from".
+        Lexer *Lexer::Create_PragmaLexer(SourceLocation SpellingLoc,
+                                         SourceLocation InstantiationLocStart,
+                                         SourceLocation InstantiationLocEnd,
+                                         unsigned TokLen, Preprocessor &PP) {
+            SourceManager &SM = PP.getSourceManager();
+
+            // Create the lexer as if we were going to lex the file normally.
+            FileID SpellingFID = SM.getFileID(SpellingLoc);
+            Lexer *L = new Lexer(SpellingFID, PP);
+
+            // Now that the lexer is created, change the start/end locations so that we
+            // just lex the subsection of the file that we want.  This is lexing from a
+            // scratch buffer, so the tail padding past the NUL is still in bounds.
+            const char *StrData = SM.getCharacterData(SpellingLoc);
+
+            L->BufferPtr = StrData;
+            L->BufferEnd = StrData+TokLen;
+            assert(L->BufferEnd[0] == 0 && "Buffer is not nul terminated!");
+
+            // Set the SourceLocation with the remapping information.  This ensures that
+            // GetMappedTokenLoc will remap the tokens as they are lexed.
+            L->FileLoc = SM.createInstantiationLoc(SM.getLocForStartOfFile(SpellingFID),
+                                                   InstantiationLocStart,
+                                                   InstantiationLocEnd, TokLen);
+
+            // Ensure that the lexer thinks it is inside a directive, so that end \n will
+            // return an EOM token.
+            L->ParsingPreprocessorDirective = true;
+
+            // This lexer really is for _Pragma.
+            L->Is_PragmaLexer = true;
+            return L;
+        }
+
         /// Stringify - Convert the specified string into a C string, with surrounding
         /// ""'s, and with escaped \ and " characters.
         std::string Lexer::Stringify(const std::string &Str, bool Charify) {
@@ -280,6 +337,259 @@ namespace CPToyC {
                    true : false;
         }
 
+        //===----------------------------------------------------------------------===//
+        // Vectorized scanning kernels.
+        //===----------------------------------------------------------------------===//
+
+        // Each kernel scans forward from Ptr and returns a pointer to the first
+        // character that stops the scan.  A nul always stops the scan, so a kernel
+        // never moves past BufferEnd, and because every buffer the lexer sees carries
+        // MemoryBuffer::TailPadding zeroed bytes after BufferEnd, the vector loads
+        // need no bounds checks.  All variants return the same pointer for the same
+        // input, so the selected kernel never changes the token stream.
+
+        /// ScanIdentifierBodyScalar - Skip [a-zA-Z0-9_].
+        static const char *ScanIdentifierBodyScalar(const char *Ptr) {
+            while (isIdentifierBody(*Ptr))
+                ++Ptr;
+            return Ptr;
+        }
+
+        /// ScanHorzWhitespaceScalar - Skip ' ', '\t', '\f', '\v'.
+        static const char *ScanHorzWhitespaceScalar(const char *Ptr) {
+            while (isHorizontalWhitespace(*Ptr))
+                ++Ptr;
+            return Ptr;
+        }
+
+        /// ScanBCPLCommentScalar - Stop at a character that needs the slow path of
+        /// SkipBCPLComment: nul, '\\', '?', '\n' or '\r'.
+        static const char *ScanBCPLCommentScalar(const char *Ptr) {
+            char C = *Ptr;
+            while (C != 0 && C != '\\' && C != '?' && C != '\n' && C != '\r')
+                C = *++Ptr;
+            return Ptr;
+        }
+
+        /// ScanStringLiteralScalar - Stop at a character that needs the slow path of
+        /// LexStringLiteral: '"', nul, '\\', '?', '\n' or '\r'.
+        static const char *ScanStringLiteralScalar(const char *Ptr) {
+            char C = *Ptr;
+            while (C != '"' && C != 0 && C != '\\' && C != '?' &&
+                   C != '\n' && C != '\r')
+                C = *++Ptr;
+            return Ptr;
+        }
+
+        /// ScanLineBreakScalar - Stop at a character that may end a physical line:
+        /// '\n', '\r' or nul.
+        static const char *ScanLineBreakScalar(const char *Ptr) {
+            char C = *Ptr;
+            while (C != 0 && C != '\n' && C != '\r')
+                C = *++Ptr;
+            return Ptr;
+        }
+
+#if LEXER_HAVE_X86_KERNELS
+        /// The SSE2 kernels build a mask of the "stop" bytes in each 16-byte block
+        /// and return the position of the first one.
+        static inline __m128i IdentifierBodyMask16(__m128i V) {
+            // Byte compares are signed, so bytes >= 0x80 never fall in a range.
+            __m128i Lower = _mm_or_si128(V, _mm_set1_epi8(0x20));
+            __m128i Alpha = _mm_and_si128(_mm_cmpgt_epi8(Lower, _mm_set1_epi8('a' - 1)),
+                                          _mm_cmplt_epi8(Lower, _mm_set1_epi8('z' + 1)));
+            __m128i Digit = _mm_and_si128(_mm_cmpgt_epi8(V, _mm_set1_epi8('0' - 1)),
+                                          _mm_cmplt_epi8(V, _mm_set1_epi8('9' + 1)));
+            __m128i Under = _mm_cmpeq_epi8(V, _mm_set1_epi8('_'));
+            return _mm_or_si128(_mm_or_si128(Alpha, Digit), Under);
+        }
+
+        static inline __m128i HorzWhitespaceMask16(__m128i V) {
+            return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8(' ')),
+                                             _mm_cmpeq_epi8(V, _mm_set1_epi8('\t'))),
+                                _mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8('\f')),
+                                             _mm_cmpeq_epi8(V, _mm_set1_epi8('\v'))));
+        }
+
+        static inline __m128i BCPLStopMask16(__m128i V) {
+            return _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(V, _mm_setzero_si128()),
+                                 _mm_cmpeq_epi8(V, _mm_set1_epi8('\\'))),
+                    _mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8('?')),
+                                 _mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8('\n')),
+                                              _mm_cmpeq_epi8(V, _mm_set1_epi8('\r')))));
+        }
+
+        static inline __m128i StringStopMask16(__m128i V) {
+            return _mm_or_si128(BCPLStopMask16(V),
+                                _mm_cmpeq_epi8(V, _mm_set1_epi8('"')));
+        }
+
+        static const char *ScanIdentifierBodySSE2(const char *Ptr) {
+            for (;; Ptr += 16) {
+                __m128i V = _mm_loadu_si128((const __m128i*)Ptr);
+                unsigned Mask = ~_mm_movemask_epi8(IdentifierBodyMask16(V)) & 0xFFFF;
+                if (Mask) return Ptr + __builtin_ctz(Mask);
+            }
+        }
+
+        static const char *ScanHorzWhitespaceSSE2(const char *Ptr) {
+            for (;; Ptr += 16) {
+                __m128i V = _mm_loadu_si128((const __m128i*)Ptr);
+                unsigned Mask = ~_mm_movemask_epi8(HorzWhitespaceMask16(V)) & 0xFFFF;
+                if (Mask) return Ptr + __builtin_ctz(Mask);
+            }
+        }
+
+        static const char *ScanBCPLCommentSSE2(const char *Ptr) {
+            for (;; Ptr += 16) {
+                __m128i V = _mm_loadu_si128((const __m128i*)Ptr);
+                unsigned Mask = _mm_movemask_epi8(BCPLStopMask16(V));
+                if (Mask) return Ptr + __builtin_ctz(Mask);
+            }
+        }
+
+        static const char *ScanLineBreakSSE2(const char *Ptr) {
+            for (;; Ptr += 16) {
+                __m128i V = _mm_loadu_si128((const __m128i*)Ptr);
+                __m128i Stop = _mm_or_si128(
+                        _mm_cmpeq_epi8(V, _mm_setzero_si128()),
+                        _mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8('\n')),
+                                     _mm_cmpeq_epi8(V, _mm_set1_epi8('\r'))));
+                unsigned Mask = _mm_movemask_epi8(Stop);
+                if (Mask) return Ptr + __builtin_ctz(Mask);
+            }
+        }
+
+        static const char *ScanStringLiteralSSE2(const char *Ptr) {
+            for (;; Ptr += 16) {
+                __m128i V = _mm_loadu_si128((const __m128i*)Ptr);
+                unsigned Mask = _mm_movemask_epi8(StringStopMask16(V));
+                if (Mask) return Ptr + __builtin_ctz(Mask);
+            }
+        }
+
+        /// The AVX2 kernels run the same tests 32 bytes at a time.
+        #define LEXER_AVX2 __attribute__((target("avx2")))
+
+        LEXER_AVX2 static const char *ScanIdentifierBodyAVX2(const char *Ptr) {
+            for (;; Ptr += 32) {
+                __m256i V = _mm256_loadu_si256((const __m256i*)Ptr);
+                __m256i Lower = _mm256_or_si256(V, _mm256_set1_epi8(0x20));
+                __m256i Alpha = _mm256_and_si256(
+                        _mm256_cmpgt_epi8(Lower, _mm256_set1_epi8('a' - 1)),
+                        _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), Lower));
+                __m256i Digit = _mm256_and_si256(
+                        _mm256_cmpgt_epi8(V, _mm256_set1_epi8('0' - 1)),
+                        _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), V));
+                __m256i Under = _mm256_cmpeq_epi8(V, _mm256_set1_epi8('_'));
+                unsigned Mask = ~(unsigned)_mm256_movemask_epi8(
+                        _mm256_or_si256(_mm256_or_si256(Alpha, Digit), Under));
+                if (Mask) return Ptr + __builtin_ctz(Mask);
+            }
+        }
+
+        LEXER_AVX2 static const char *ScanHorzWhitespaceAVX2(const char *Ptr) {
+            for (;; Ptr += 32) {
+                __m256i V = _mm256_loadu_si256((const __m256i*)Ptr);
+                __m256i WS = _mm256_or_si256(
+                        _mm256_or_si256(_mm256_cmpeq_epi8(V, _mm256_set1_epi8(' ')),
+                                        _mm256_cmpeq_epi8(V, _mm256_set1_epi8('\t'))),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(V, _mm256_set1_epi8('\f')),
+                                        _mm256_cmpeq_epi8(V, _mm256_set1_epi8('\v'))));
+                unsigned Mask = ~(unsigned)_mm256_movemask_epi8(WS);
+                if (Mask) return Ptr + __builtin_ctz(Mask);
+            }
+        }
+
+        LEXER_AVX2 static inline __m256i BCPLStopMask32(__m256i V) {
+            return _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(V, _mm256_setzero_si256()),
+                                    _mm256_cmpeq_epi8(V, _mm256_set1_epi8('\\'))),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(V, _mm256_set1_epi8('?')),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(V, _mm256_set1_epi8('\n')),
+                                                    _mm256_cmpeq_epi8(V, _mm256_set1_epi8('\r')))));
+        }
+
+        LEXER_AVX2 static const char *ScanBCPLCommentAVX2(const char *Ptr) {
+            for (;; Ptr += 32) {
+                __m256i V = _mm256_loadu_si256((const __m256i*)Ptr);
+                unsigned Mask = _mm256_movemask_epi8(BCPLStopMask32(V));
+                if (Mask) return Ptr + __builtin_ctz(Mask);
+            }
+        }
+
+        LEXER_AVX2 static const char *ScanStringLiteralAVX2(const char *Ptr) {
+            for (;; Ptr += 32) {
+                __m256i V = _mm256_loadu_si256((const __m256i*)Ptr);
+                __m256i Stop = _mm256_or_si256(BCPLStopMask32(V),
+                        _mm256_cmpeq_epi8(V, _mm256_set1_epi8('"')));
+                unsigned Mask = _mm256_movemask_epi8(Stop);
+                if (Mask) return Ptr + __builtin_ctz(Mask);
+            }
+        }
+
+        LEXER_AVX2 static const char *ScanLineBreakAVX2(const char *Ptr) {
+            for (;; Ptr += 32) {
+                __m256i V = _mm256_loadu_si256((const __m256i*)Ptr);
+                __m256i Stop = _mm256_or_si256(
+                        _mm256_cmpeq_epi8(V, _mm256_setzero_si256()),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(V, _mm256_set1_epi8('\n')),
+                                        _mm256_cmpeq_epi8(V, _mm256_set1_epi8('\r'))));
+                unsigned Mask = _mm256_movemask_epi8(Stop);
+                if (Mask) return Ptr + __builtin_ctz(Mask);
+            }
+        }
+
+        #undef LEXER_AVX2
+#endif // LEXER_HAVE_X86_KERNELS
+
+        namespace {
+            /// ScanKernels - The set of scanning routines picked for this host.
+            struct ScanKernels {
+                typedef const char *(*ScanFn)(const char *Ptr);
+                ScanFn IdentifierBody;
+                ScanFn HorzWhitespace;
+                ScanFn BCPLComment;
+                ScanFn StringLiteral;
+                ScanFn LineBreak;
+            };
+        }
+
+        /// SelectScanKernels - Pick the widest kernels the running CPU supports.
+        /// Setting CPTOYC_LEXER_SIMD to "scalar" or "sse2" in the environment caps
+        /// the selection, which is handy for comparing the outputs.
+        static ScanKernels SelectScanKernels() {
+            ScanKernels K = { ScanIdentifierBodyScalar, ScanHorzWhitespaceScalar,
+                              ScanBCPLCommentScalar, ScanStringLiteralScalar,
+                              ScanLineBreakScalar };
+#if LEXER_HAVE_X86_KERNELS
+            const char *Cap = getenv("CPTOYC_LEXER_SIMD");
+            if (Cap && strcmp(Cap, "scalar") == 0)
+                return K;
+
+            K.IdentifierBody = ScanIdentifierBodySSE2;
+            K.HorzWhitespace = ScanHorzWhitespaceSSE2;
+            K.BCPLComment = ScanBCPLCommentSSE2;
+            K.StringLiteral = ScanStringLiteralSSE2;
+            K.LineBreak = ScanLineBreakSSE2;
+            if (Cap && strcmp(Cap, "sse2") == 0)
+                return K;
+
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) {
+                K.IdentifierBody = ScanIdentifierBodyAVX2;
+                K.HorzWhitespace = ScanHorzWhitespaceAVX2;
+                K.BCPLComment = ScanBCPLCommentAVX2;
+                K.StringLiteral = ScanStringLiteralAVX2;
+                K.LineBreak = ScanLineBreakAVX2;
+            }
+#endif
+            return K;
+        }
+
+        static const ScanKernels TheScanKernels = SelectScanKernels();
+
         //===----------------------------------------------------------------------===//
         // Diagnostics forwarding code.
         //===----------------------------------------------------------------------===//
@@ -311,6 +621,48 @@ namespace CPToyC {
             return SM.createInstantiationLoc(SpellingLoc, II.first, II.second, TokLen);
         }
 
+        /// getLineNumber - The line numbers agree with SourceManager::getLineNumber:
+        /// "\r\n" and "\n\r" end a single line, a lone '\r' ends a line, and
+        /// embedded nuls are ordinary characters.
+        unsigned Lexer::getLineNumber(SourceLocation Loc) {
+            if (!Loc.isFileID() || !FileLoc.isFileID())
+                return 0;
+            SourceLocation::UIntTy Offset =
+                    Loc.getRawEncoding() - FileLoc.getRawEncoding();
+            if (Loc.getRawEncoding() < FileLoc.getRawEncoding() ||
+                Offset > unsigned(BufferEnd-BufferStart))
+                return 0;
+            const char *Ptr = BufferStart + Offset;
+
+            // Going back is rare (e.g. a diagnostic about an earlier token): count
+            // again from the start.
+            if (Ptr < LineCountPtr) {
+                LineCountPtr = BufferStart;
+                LineCountNo = 1;
+            }
+
+            const char *CurPtr = LineCountPtr;
+            while (1) {
+                CurPtr = TheScanKernels.LineBreak(CurPtr);
+                if (CurPtr >= Ptr)
+                    break;
+                if (*CurPtr == 0) {     // An embedded nul, not the end of the buffer.
+                    ++CurPtr;
+                    continue;
+                }
+                const char *LineStart = CurPtr+1;
+                if ((*LineStart == '\n' || *LineStart == '\r') && *LineStart != *CurPtr)
+                    ++LineStart;
+                // Ptr is between the two characters of a pair, so still on this line.
+                if (LineStart > Ptr)
+                    break;
+                CurPtr = LineStart;
+                ++LineCountNo;
+            }
+            LineCountPtr = CurPtr < Ptr ? CurPtr : Ptr;
+            return LineCountNo;
+        }
+
         /// getSourceLocation - Return a source location identifier for the specified
         /// offset in the current file.
         SourceLocation Lexer::getSourceLocation(const char *Loc,
@@ -509,11 +861,8 @@ namespace CPToyC {
         void Lexer::LexIdentifier(Token &Result, const char *CurPtr) {
             // Match [_A-Za-z0-9]*, we have already matched [_A-Za-z$]
             unsigned Size;
-            unsigned char C = *CurPtr++;
-            while (isIdentifierBody(C)) {
-                C = *CurPtr++;
-            }
-            --CurPtr;   // Back up over the skipped character.
+            CurPtr = TheScanKernels.IdentifierBody(CurPtr);
+            unsigned char C = *CurPtr;
 
             // Fast path, no $,\,? in identifier found.  '\' might be an escaped newline
             // or UCN, and ? might be a trigraph for '\', an escaped newline or UCN.
@@ -528,8 +877,16 @@ namespace CPToyC {
                 if (LexingRawMode) return;
 
                 // Fill in Result.IdentifierInfo, looking up the identifier in the
-                // identifier table.
-                IdentifierInfo *II = PP->LookUpIdentifierInfo(Result, IdStart);
+                // identifier table.  A name that needs no cleaning is hashed here,
+                // while the bytes just scanned are still in cache.
+                IdentifierInfo *II;
+                if (!Result.needsCleaning()) {
+                    II = PP->getIdentifierInfo(IdStart, CurPtr,
+                                               llvm::HashString(IdStart, CurPtr));
+                    Result.setIdentifierInfo(II);
+                } else {
+                    II = PP->LookUpIdentifierInfo(Result, IdStart);
+                }
 
                 // Change the kind of this identifier to the appropriate token kind, e.g.
                 // turning "for" into a keyword.
@@ -604,6 +961,8 @@ namespace CPToyC {
         void Lexer::LexStringLiteral(Token &Result, const char *CurPtr, bool Wide) {
             const char *NulCharacter = 0; // Does this string contain the \0 character?
 
+            // Characters that are not special to the loop below are skipped in bulk.
+            CurPtr = TheScanKernels.StringLiteral(CurPtr);
             char C = getAndAdvanceChar(CurPtr, Result);
             while (C != '"') {
                 // Skip escaped characters.
@@ -619,6 +978,7 @@ namespace CPToyC {
                 } else if (C == 0) {
                     NulCharacter = CurPtr-1;
                 }
+                CurPtr = TheScanKernels.StringLiteral(CurPtr);
                 C = getAndAdvanceChar(CurPtr, Result);
             }
 
@@ -724,9 +1084,15 @@ namespace CPToyC {
             // Whitespace - Skip it, then return the token after the whitespace.
             unsigned char Char = *CurPtr;  // Skip consequtive spaces efficiently.
             while (1) {
-                // Skip horizontal whitespace very aggressively.
-                while (isHorizontalWhitespace(Char))
+                // Skip horizontal whitespace very aggressively.  Single spaces are
+                // the common case, only hand longer runs to the scanning kernel.
+                if (isHorizontalWhitespace(Char)) {
                     Char = *++CurPtr;
+                    if (isHorizontalWhitespace(Char)) {
+                        CurPtr = TheScanKernels.HorzWhitespace(CurPtr);
+                        Char = *CurPtr;
+                    }
+                }
 
                 // Otherwise if we have something other than whitespace, we're done.
                 if (Char != '\n' && Char != '\r')
@@ -781,17 +1147,11 @@ namespace CPToyC {
             // them.  As such, optimize for this case with the inner loop.
             char C;
             do {
+                // Skip over characters in the fast loop, stopping at a nul (potentially
+                // EOF), '\\' (potentially escaped newline), '?' (potentially trigraph) or
+                // a newline.
+                CurPtr = TheScanKernels.BCPLComment(CurPtr);
                 C = *CurPtr;
-                // FIXME: Speedup BCPL comment lexing.  Just scan for a \n or \r character.
-                // If we find a \n character, scan backwards, checking to see if it's an
-                // escaped newline, like we do for block comments.
-
-                // Skip over characters in the fast loop.
-                while (C != 0 &&                // Potentially EOF.
-                       C != '\\' &&             // Potentially escaped newline.
-                       C != '?' &&              // Potentially trigraph.
-                       C != '\n' && C != '\r')  // Newline or DOS-style newline.
-                    C = *++CurPtr;
 
                 // If this is a newline, we're done.
                 if (C == '\n' || C == '\r')
@@ -1177,7 +1537,8 @@ namespace CPToyC {
                 FormTokenWithChars(Result, CurPtr, tok::eom);
 
                 // Restore comment saving mode, in case it was disabled for directive.
-                SetCommentRetentionState(PP->getCommentRetentionState());
+                if (PP)
+                    SetCommentRetentionState(PP->getCommentRetentionState());
                 return true;  // Have a token.
             }
 
@@ -1312,7 +1673,8 @@ namespace CPToyC {
                         ParsingPreprocessorDirective = false;
 
                         // Restore comment saving mode, in case it was disabled for directive.
-                        SetCommentRetentionState(PP->getCommentRetentionState());
+                        if (PP)
+                            SetCommentRetentionState(PP->getCommentRetentionState());
 
                         // Since we consumed a newline, we are back at the start of a line.
                         IsAtStartOfLine = true;
@@ -32,6 +32,7 @@ namespace CPToyC {
             const char *BufferEnd;         // End of the buffer.
             SourceLocation FileLoc;        // Location for start of file.
             LangOptions Features;          // Features enabled by this language (cache).
+            bool Is_PragmaLexer;           // True if lexer for _Pragma handling.
             //===--------------------------------------------------------------------===//
             // Context-specific lexing flags set by the preprocessor.
             //
@@ -58,6 +59,13 @@ namespace CPToyC {
             // line" flag set on it.
             bool IsAtStartOfLine;
 
+            // LineCountPtr/LineCountNo - The running physical line counter: the line
+            // breaks before LineCountPtr have been counted, and LineCountPtr is on
+            // line LineCountNo.  This is only a cache for getLineNumber, so it needs
+            // no save/restore code.
+            const char *LineCountPtr;
+            unsigned LineCountNo;
+
             Lexer(const Lexer&) = delete;          // DO NOT IMPLEMENT
             void operator=(const Lexer&) = delete; // DO NOT IMPLEMENT
             friend class Preprocessor;
@@ -81,6 +89,14 @@ namespace CPToyC {
             /// range will outlive it, so it doesn't take ownership of it.
             Lexer(FileID FID, const SourceManager &SM, const LangOptions &Features);
 
+            /// Create_PragmaLexer: Lexer constructor - Create a new lexer object for
+            /// _Pragma expansion.  This has a variety of magic semantics that this method
+            /// sets up.  It returns a new'd Lexer that must be delete'd when done.
+            static Lexer *Create_PragmaLexer(SourceLocation SpellingLoc,
+                                             SourceLocation InstantiationLocStart,
+                                             SourceLocation InstantiationLocEnd,
+                                             unsigned TokLen, Preprocessor &PP);
+
             /// getFeatures - Return the language features currently enabled.  NOTE: this
             /// lexer modifies features as a file is parsed!
             const LangOptions &getFeatures() const { return Features; }
@@ -91,6 +107,9 @@ namespace CPToyC {
             /// from.  Currently this is only used by _Pragma handling.
             SourceLocation getFileLoc() const { return FileLoc; }
 
+            /// isPragmaLexer - Returns true if this Lexer is being used to lex a pragma.
+            bool isPragmaLexer() const { return Is_PragmaLexer; }
+
             /// Lex - Return the next token in the file.  If this is the end of file, it
             /// return the tok::eof token.  Return true if an error occurred and
             /// compilation should terminate, false if normal.  This implicitly involves
@@ -175,6 +194,12 @@ namespace CPToyC {
             /// the current file.
             SourceLocation getSourceLocation() { return getSourceLocation(BufferPtr); }
 
+            /// getLineNumber - Return the physical line of the specified file location,
+            /// or 0 if it is not in this lexer's buffer.  Line breaks are counted
+            /// forward from the previous query, the way the lexer itself moves, so the
+            /// SourceManager never has to build the line table of the file.
+            unsigned getLineNumber(SourceLocation Loc);
+
             /// Stringify - Convert the specified string into a C string by escaping '\'
             /// and " characters.  This does not add surrounding ""'s to the string.
             /// If Charify is true, this escapes the ' character instead of ".
@@ -44,7 +44,7 @@ namespace CPToyC {
             /// UintData - This holds either the length of the token text, when
             /// a normal token, or the end of the SourceRange when an annotation
             /// token.
-            unsigned UintData;
+            SourceLocation::UIntTy UintData;
 
             /// PtrData - This is a union of four different pointer types, which depends
             /// on what type of token this is:
@@ -22,6 +22,7 @@
 #include <memory>
 #include <vector>
 #include <sys/mman.h>
+#include <mutex>
 
 using namespace CPToyC::Compiler;
 
@@ -32,11 +33,13 @@ MemoryBuffer::~MemoryBuffer() {
 
 void MemoryBuffer::initCopyOf(const char *BufStart, const char *BufEnd) {
     size_t Size = BufEnd - BufStart;
-    BufferStart = (char *)malloc((Size + 1) * sizeof(char));
+    BufferStart = (char *)malloc((Size + TailPadding) * sizeof(char));
     BufferEnd = BufferStart + Size;
     memcpy(const_cast<char *>(BufferStart), BufStart, Size);
-    *const_cast<char *>(BufferEnd) = 0; // Null terminate buffer
+    // Null terminate buffer and zero the padding after it.
+    memset(const_cast<char *>(BufferEnd), 0, TailPadding);
     MustDeleteBuffer = true;
+    HasTailPadding = true;
 }
 
 void MemoryBuffer::init(const char *BufStart, const char *BufEnd) {
@@ -44,6 +47,7 @@ void MemoryBuffer::init(const char *BufStart, const char *BufEnd) {
     BufferStart = BufStart;
     BufferEnd = BufEnd;
     MustDeleteBuffer = false;
+    HasTailPadding = false;
 }
 
 namespace {
@@ -73,18 +77,19 @@ MemoryBuffer *MemoryBuffer::getMemBufferCopy(const char *StartPtr, const char *E
 }
 
 MemoryBuffer *MemoryBuffer::getNewUninitMemBuffer(size_t Size, const char *BufferName) {
-    char *Buf = (char *)malloc((Size + 1) * sizeof(char));
+    char *Buf = (char *)malloc((Size + TailPadding) * sizeof(char));
     if (!Buf) return 0;
-    Buf[Size] = 0;
+    memset(Buf + Size, 0, TailPadding);
     MemoryBufferMem *SB = new MemoryBufferMem(Buf, Buf + Size, BufferName);
     SB->MustDeleteBuffer = true;
+    SB->HasTailPadding = true;
     return SB;
 }
 
 MemoryBuffer *MemoryBuffer::getNewMemBuffer(size_t Size, const char *BufferName) {
     MemoryBuffer *SB = getNewUninitMemBuffer(Size, BufferName);
     if (!SB) return 0;
-    memset(const_cast<char *>(SB->getBufferStart()), 0, Size + 1);
+    memset(const_cast<char *>(SB->getBufferStart()), 0, Size);
     return SB;
 }
 
@@ -96,33 +101,81 @@ MemoryBuffer *MemoryBuffer::getFileOrSTDIN(const char *FileName, std::string *Er
     if (M) return M;
 
     const char *EmptyStr = "";
-    return MemoryBuffer::getMemBuffer(EmptyStr, EmptyStr, "<stdin>");
+    return MemoryBuffer::getMemBufferCopy(EmptyStr, EmptyStr, "<stdin>");
+}
+
+static MemoryBuffer::LoadStats TheLoadStats;
+
+const MemoryBuffer::LoadStats &MemoryBuffer::getLoadStats() {
+    return TheLoadStats;
 }
 
 namespace {
-    const char *MapInFilePages(int FD, uint64_t FileSize) {
+    size_t getPageSize() {
+        static const size_t PageSize = ::sysconf(_SC_PAGESIZE);
+        return PageSize;
+    }
+
+    /// MapInFilePages - Map FileSize bytes of FD followed by at least TailPadding
+    /// zero bytes.  If the zero filled part of the last page is too short (or the
+    /// file ends on a page boundary), reserve an extra anonymous page first and
+    /// map the file over the front of the reservation.  MappedSize is set to the
+    /// length to unmap.
+    const char *MapInFilePages(int FD, uint64_t FileSize, uint64_t &MappedSize,
+                               bool &Overlay) {
         int Flags = MAP_PRIVATE;
 #ifdef MAP_FILE
         Flags |= MAP_FILE;
 #endif
-        void *BasePtr = ::mmap(0, FileSize, PROT_READ, Flags, FD, 0);
-        if (BasePtr == MAP_FAILED)
-            return 0;
+        size_t PageSize = getPageSize();
+        uint64_t Tail = FileSize & (PageSize - 1);
+        Overlay = Tail == 0 || PageSize - Tail < MemoryBuffer::TailPadding;
+
+        void *BasePtr;
+        if (!Overlay) {
+            MappedSize = FileSize;
+            BasePtr = ::mmap(0, FileSize, PROT_READ, Flags, FD, 0);
+            if (BasePtr == MAP_FAILED)
+                return 0;
+        } else {
+            MappedSize = (FileSize - Tail) + (Tail ? PageSize : 0) + PageSize;
+            BasePtr = ::mmap(0, MappedSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                             -1, 0);
+            if (BasePtr == MAP_FAILED)
+                return 0;
+            if (::mmap(BasePtr, FileSize, PROT_READ, Flags | MAP_FIXED, FD, 0) ==
+                MAP_FAILED) {
+                ::munmap(BasePtr, MappedSize);
+                return 0;
+            }
+        }
+
+        // The lexer reads the file front to back exactly once.
+#ifdef MADV_SEQUENTIAL
+        ::madvise(BasePtr, FileSize, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+        ::madvise(BasePtr, FileSize, MADV_WILLNEED);
+#endif
         return (const char*)BasePtr;
     }
 
-    void UnMapFilePages(const char *BasePtr, uint64_t FileSize) {
-        ::munmap((void*)BasePtr, FileSize);
+    void UnMapFilePages(const char *BasePtr, uint64_t MappedSize) {
+        ::munmap((void*)BasePtr, MappedSize);
     }
 }
 
 namespace {
     class MemoryBufferMMapFile : public MemoryBuffer {
         std::string Filename;
+        uint64_t MappedSize;
     public:
-        MemoryBufferMMapFile(const char *filename, const char *Pages, uint64_t Size)
-            : Filename(filename) {
+        MemoryBufferMMapFile(const char *filename, const char *Pages, uint64_t Size,
+                             uint64_t mappedSize)
+            : Filename(filename), MappedSize(mappedSize) {
             init(Pages, Pages + Size);
+            // MapInFilePages guarantees TailPadding zero bytes after the file.
+            HasTailPadding = true;
         }
 
         virtual const char *getBufferIdentifier() const override{
@@ -130,11 +183,115 @@ namespace {
         }
 
         ~MemoryBufferMMapFile() {
-            UnMapFilePages(getBufferStart(), getBufferSize());
+            UnMapFilePages(getBufferStart(), MappedSize);
         }
     };
 }
 
+namespace {
+    /// SlabPool - Small files are read into large slabs instead of a malloc
+    /// block each.  A slab is freed once every buffer carved out of it is gone
+    /// and it is no longer the slab being filled.
+    class SlabPool {
+        struct Slab {
+            size_t Used;
+            unsigned Refs;
+        };
+
+        enum { SlabSize = 256*1024, Alignment = 16 };
+
+        Slab *Cur;
+        std::mutex Lock;
+
+        static char *getSlabData(Slab *S) {
+            return reinterpret_cast<char *>(S) + sizeof(Slab);
+        }
+
+    public:
+        SlabPool() : Cur(0) {}
+
+        ~SlabPool() {
+            if (Cur && Cur->Refs == 0)
+                free(Cur);
+        }
+
+        /// Allocate - Return Size bytes followed by TailPadding zero bytes, and
+        /// the slab they live in.
+        char *Allocate(size_t Size, void *&Owner) {
+            size_t Needed = (Size + MemoryBuffer::TailPadding + Alignment - 1) &
+                            ~size_t(Alignment - 1);
+            assert(Needed <= SlabSize - sizeof(Slab) && "File too big for a slab!");
+
+            std::lock_guard<std::mutex> Guard(Lock);
+            if (!Cur || Cur->Used + Needed > SlabSize - sizeof(Slab)) {
+                if (Cur && Cur->Refs == 0)
+                    free(Cur);
+                Cur = (Slab *)malloc(SlabSize);
+                if (!Cur) return 0;
+                Cur->Used = 0;
+                Cur->Refs = 0;
+                ++TheLoadStats.NumSlabs;
+            }
+
+            char *Ptr = getSlabData(Cur) + Cur->Used;
+            Cur->Used += Needed;
+            ++Cur->Refs;
+            memset(Ptr + Size, 0, MemoryBuffer::TailPadding);
+            Owner = Cur;
+            return Ptr;
+        }
+
+        void Release(void *Owner) {
+            Slab *S = static_cast<Slab *>(Owner);
+            std::lock_guard<std::mutex> Guard(Lock);
+            if (--S->Refs == 0 && S != Cur)
+                free(S);
+        }
+    };
+
+    SlabPool &getSlabPool() {
+        static SlabPool Pool;
+        return Pool;
+    }
+
+    class MemoryBufferPooled : public MemoryBuffer {
+        std::string Filename;
+        void *Owner;
+    public:
+        MemoryBufferPooled(const char *filename, const char *Start, size_t Size,
+                           void *owner)
+            : Filename(filename), Owner(owner) {
+            init(Start, Start + Size);
+            HasTailPadding = true;
+        }
+
+        virtual const char *getBufferIdentifier() const override{
+            return Filename.c_str();
+        }
+
+        ~MemoryBufferPooled() {
+            getSlabPool().Release(Owner);
+        }
+    };
+}
+
+/// ReadFileData - Read Size bytes of FD into Buf, retrying on EINTR.
+static bool ReadFileData(int FD, char *BufPtr, size_t BytesLeft) {
+    while (BytesLeft) {
+        ssize_t NumRead = ::read(FD, BufPtr, BytesLeft);
+        if (NumRead > 0) {
+            BytesLeft -= NumRead;
+            BufPtr += NumRead;
+        }else if (NumRead == -1 && errno == EINTR) {
+            // try again
+        }else {
+            // error reading, or the file shrank under us.
+            return false;
+        }
+    }
+    return true;
+}
+
 MemoryBuffer *MemoryBuffer::getFile(const char *Filename, std::string *ErrStr, int64_t FileSize) {
     int OpenFlags = 0;
 #ifdef O_BINARY
@@ -156,14 +313,34 @@ MemoryBuffer *MemoryBuffer::getFile(const char *Filename, std::string *ErrStr, i
         FileSize = FileInfo.st_size;
     }
 
-    // 判断是否 FileSize == 0x1000 (FileSize & (0x1000 - 1))
-    if (FileSize >= 4096*4 && (FileSize & (0x1000 - 1)) != 0) {
-        if (const char *Pages = MapInFilePages(FD, FileSize)) {
+    // Large files are always mapped; MapInFilePages takes care of the padding.
+    if (FileSize >= LargeFileThreshold) {
+        uint64_t MappedSize;
+        bool Overlay;
+        if (const char *Pages = MapInFilePages(FD, FileSize, MappedSize, Overlay)) {
+            ::close(FD);
+            ++(Overlay ? TheLoadStats.NumMappedOverlay : TheLoadStats.NumMapped);
+            TheLoadStats.BytesMapped += FileSize;
+            return new MemoryBufferMMapFile(Filename, Pages, FileSize, MappedSize);
+        }
+    } else {
+        void *Owner;
+        if (char *Buf = getSlabPool().Allocate(FileSize, Owner)) {
+            llvm::OwningPtr<MemoryBuffer> SB(
+                    new MemoryBufferPooled(Filename, Buf, FileSize, Owner));
+            if (!ReadFileData(FD, Buf, FileSize)) {
+                ::close(FD);
+                if (ErrStr) *ErrStr = "error reading file data";
+                return 0;
+            }
             ::close(FD);
-            return new MemoryBufferMMapFile(Filename, Pages, FileSize);
+            ++TheLoadStats.NumPooled;
+            TheLoadStats.BytesPooled += FileSize;
+            return SB.take();
         }
     }
 
+    // Mapping or pooling failed, read the file into a buffer of its own.
     MemoryBuffer *Buf = MemoryBuffer::getNewUninitMemBuffer(FileSize, Filename);
     if (!Buf) {
         if (ErrStr) *ErrStr = "could not allocate buffer";
@@ -172,24 +349,14 @@ MemoryBuffer *MemoryBuffer::getFile(const char *Filename, std::string *ErrStr, i
     }
 
     llvm::OwningPtr<MemoryBuffer> SB(Buf);
-    char *BufPtr = const_cast<char *>(SB->getBufferStart());
-
-    size_t BytesLeft = FileSize;
-    while (BytesLeft) {
-        ssize_t NumRead = ::read(FD, BufPtr, BytesLeft);
-        if (NumRead != -1) {
-            BytesLeft -= NumRead;
-            BufPtr += NumRead;
-        }else if (errno == EINTR) {
-            // try again
-        }else {
-            // error reading
-            close(FD);
-            if (ErrStr) *ErrStr = "error reading file data";
-            return 0;
-        }
+    if (!ReadFileData(FD, const_cast<char *>(SB->getBufferStart()), FileSize)) {
+        close(FD);
+        if (ErrStr) *ErrStr = "error reading file data";
+        return 0;
     }
     close(FD);
+    ++TheLoadStats.NumRead;
+    TheLoadStats.BytesRead += FileSize;
     return SB.take();
 }
 
@@ -10,7 +10,9 @@
 
 #ifndef CLANGSIMPLIFY_MEMORYBUFFER_H
 #define CLANGSIMPLIFY_MEMORYBUFFER_H
+#include <atomic>
 #include <iostream>
+#include <stdint.h>
 namespace CPToyC {
     namespace Compiler {
         class MemoryBuffer {
@@ -20,13 +22,22 @@ namespace CPToyC {
             bool MustDeleteBuffer;
 
         protected:
-            MemoryBuffer() : MustDeleteBuffer(false) {}
+            /// HasTailPadding - True if TailPadding zeroed bytes follow BufferEnd.
+            bool HasTailPadding;
+
+            MemoryBuffer() : MustDeleteBuffer(false), HasTailPadding(false) {}
 
             void init(const char *BufStart, const char *BufEnd);
 
             void initCopyOf(const char *BufStart, const char *BufEnd);
 
         public:
+            /// TailPadding - Every buffer this class allocates or maps is followed by
+            /// at least this many readable, zeroed bytes, starting with the nul at
+            /// BufferEnd.  This lets the lexer issue wide loads without checking
+            /// against the end of the buffer.
+            enum { TailPadding = 64 };
+
             virtual ~MemoryBuffer();
 
             const char *getBufferStart() const { return BufferStart; }
@@ -35,12 +46,39 @@ namespace CPToyC {
 
             size_t getBufferSize() const { return BufferEnd - BufferStart; }
 
+            /// hasTailPadding - Return true if the buffer is followed by TailPadding
+            /// zeroed bytes.  Only buffers wrapping client memory (getMemBuffer) lack
+            /// it.
+            bool hasTailPadding() const { return HasTailPadding; }
+
             virtual const char *getBufferIdentifier() const {
                 return "Unknown buffer";
             }
 
+            /// getFile - Open the specified file as a MemoryBuffer.  Files of at least
+            /// LargeFileThreshold bytes are mmapped; when the file doesn't leave
+            /// TailPadding bytes free in its last page, an anonymous zero page is
+            /// mapped behind it to supply the padding.  Smaller files are read into
+            /// slabs shared between many buffers.
             static MemoryBuffer *getFile(const char *Filename, std::string *ErrStr = 0, int64_t FileSize = -1);
 
+            enum { LargeFileThreshold = 4096*4 };
+
+            /// LoadStats - Counts of the policies getFile used to bring files in.
+            /// Files may be loaded from several threads at once.
+            struct LoadStats {
+                std::atomic<unsigned> NumMapped;         // mmapped, the page tail is the padding.
+                std::atomic<unsigned> NumMappedOverlay;  // mmapped in front of a zero page.
+                std::atomic<unsigned> NumPooled;         // read into a shared slab.
+                std::atomic<unsigned> NumRead;           // read into a buffer of their own.
+                std::atomic<uint64_t> BytesMapped;
+                std::atomic<uint64_t> BytesPooled;
+                std::atomic<uint64_t> BytesRead;
+                std::atomic<unsigned> NumSlabs;          // slabs allocated for pooled reads.
+            };
+
+            static const LoadStats &getLoadStats();
+
             static MemoryBuffer *getMemBuffer(const char *StartPtr, const char *EndPtr, const char *BufferName = "");
 
             static MemoryBuffer *
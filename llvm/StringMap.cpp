@@ -12,7 +12,11 @@
 //===----------------------------------------------------------------------===//
 
 #include "StringMap.h"
+#include "MathExtras.h"
 #include <cassert>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 using namespace llvm;
 
 StringMapImpl::StringMapImpl(unsigned InitSize, unsigned itemSize) {
@@ -26,38 +30,52 @@ StringMapImpl::StringMapImpl(unsigned InitSize, unsigned itemSize) {
   
   // Otherwise, initialize it with zero buckets to avoid the allocation.
   TheTable = 0;
+  Tags = 0;
   NumBuckets = 0;
   NumItems = 0;
   NumTombstones = 0;
 }
 
+/// AllocateTable - Allocate the buckets and their tags, all empty, in one
+/// block.  The block is freed by freeing the buckets.
+static StringMapImpl::ItemBucket *AllocateTable(unsigned NumBuckets,
+                                                unsigned char *&Tags) {
+  // Allocate one extra bucket, set it to look filled so the iterators stop at
+  // end.
+  StringMapImpl::ItemBucket *Table = (StringMapImpl::ItemBucket*)
+      calloc(1, (NumBuckets+1)*sizeof(StringMapImpl::ItemBucket) + NumBuckets);
+  Table[NumBuckets].Item = (StringMapEntryBase*)2;
+  Tags = (unsigned char*)(Table+NumBuckets+1);
+  return Table;
+}
+
 void StringMapImpl::init(unsigned InitSize) {
   assert((InitSize & (InitSize-1)) == 0 &&
          "Init Size must be a power of 2 or zero!");
-  NumBuckets = InitSize ? InitSize : 16;
+  NumBuckets = InitSize > GroupSize ? InitSize : GroupSize;
   NumItems = 0;
   NumTombstones = 0;
   
-  TheTable = (ItemBucket*)calloc(NumBuckets+1, sizeof(ItemBucket));
-  
-  // Allocate one extra bucket, set it to look filled so the iterators stop at
-  // end.
-  TheTable[NumBuckets].Item = (StringMapEntryBase*)2;
+  TheTable = AllocateTable(NumBuckets, Tags);
 }
 
+/// MatchTags - Return a mask of the buckets in the group starting at Group
+/// that have the specified tag.
+static inline unsigned MatchTags(const unsigned char *Group, unsigned char Tag) {
+#ifdef __SSE2__
+  __m128i G = _mm_loadu_si128((const __m128i*)Group);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(G, _mm_set1_epi8((char)Tag)));
+#else
+  unsigned Mask = 0;
+  for (unsigned i = 0; i != StringMapImpl::GroupSize; ++i)
+    if (Group[i] == Tag)
+      Mask |= 1U << i;
+  return Mask;
+#endif
+}
 
-/// HashString - Compute a hash code for the specified string.
-///
-static unsigned HashString(const char *Start, const char *End) {
-  // Bernstein hash function.
-  unsigned int Result = 0;
-  // TODO: investigate whether a modified bernstein hash function performs
-  // better: http://eternallyconfuzzled.com/tuts/algorithms/jsw_tut_hashing.aspx
-  //   X*33+c -> X*33^c
-  while (Start != End)
-    Result = Result * 33 + *Start++;
-  Result = Result + (Result >> 5);
-  return Result;
+static inline unsigned char getTagFor(unsigned FullHashValue) {
+  return StringMapImpl::FullTag | (FullHashValue & 0x7F);
 }
 
 /// LookupBucketFor - Look up the bucket that the specified string should end
@@ -65,56 +83,58 @@ static unsigned HashString(const char *Start, const char *End) {
 /// specified bucket will be non-null.  Otherwise, it will be null.  In either
 /// case, the FullHashValue field of the bucket will be set to the hash value
 /// of the string.
-unsigned StringMapImpl::LookupBucketFor(const StringRef &Name) {
-  unsigned HTSize = NumBuckets;
-  if (HTSize == 0) {  // Hash table unallocated so far?
+unsigned StringMapImpl::LookupBucketFor(const StringRef &Name,
+                                        unsigned FullHashValue) {
+  if (NumBuckets == 0)  // Hash table unallocated so far?
     init(16);
-    HTSize = NumBuckets;
-  }
-  unsigned FullHashValue = HashString(Name.begin(), Name.end());
-  unsigned BucketNo = FullHashValue & (HTSize-1);
-  
+  unsigned GroupMask = NumBuckets/GroupSize - 1;
+  unsigned GroupNo = (FullHashValue >> 7) & GroupMask;
+  unsigned char Tag = getTagFor(FullHashValue);
+
   unsigned ProbeAmt = 1;
   int FirstTombstone = -1;
   while (1) {
-    ItemBucket &Bucket = TheTable[BucketNo];
-    StringMapEntryBase *BucketItem = Bucket.Item;
-    // If we found an empty bucket, this key isn't in the table yet, return it.
-    if (BucketItem == 0) {
-      // If we found a tombstone, we want to reuse the tombstone instead of an
-      // empty bucket.  This reduces probing.
-      if (FirstTombstone != -1) {
-        TheTable[FirstTombstone].FullHashValue = FullHashValue;
-        return FirstTombstone;
-      }
-      
-      Bucket.FullHashValue = FullHashValue;
-      return BucketNo;
-    }
-    
-    if (BucketItem == getTombstoneVal()) {
-      // Skip over tombstones.  However, remember the first one we see.
-      if (FirstTombstone == -1) FirstTombstone = BucketNo;
-    } else if (Bucket.FullHashValue == FullHashValue) {
-      // If the full hash value matches, check deeply for a match.  The common
-      // case here is that we are only looking at the buckets (for item info
-      // being non-null and for the full hash value) not at the items.  This
-      // is important for cache locality.
-      
+    unsigned GroupStart = GroupNo*GroupSize;
+    const unsigned char *Group = Tags+GroupStart;
+
+    // Only look at the buckets whose tag matches.  The common case here is
+    // that we are only looking at the tags and the full hash value, not at the
+    // items.  This is important for cache locality.
+    for (unsigned M = MatchTags(Group, Tag); M; M &= M-1) {
+      unsigned BucketNo = GroupStart + CountTrailingZeros_32(M);
+      ItemBucket &Bucket = TheTable[BucketNo];
+      if (Bucket.FullHashValue != FullHashValue)
+        continue;
+
       // Do the comparison like this because Name isn't necessarily
       // null-terminated!
+      StringMapEntryBase *BucketItem = Bucket.Item;
       char *ItemStr = (char*)BucketItem+ItemSize;
       if (Name == StringRef(ItemStr, BucketItem->getKeyLength())) {
         // We found a match!
         return BucketNo;
       }
     }
-    
-    // Okay, we didn't find the item.  Probe to the next bucket.
-    BucketNo = (BucketNo+ProbeAmt) & (HTSize-1);
-    
-    // Use quadratic probing, it has fewer clumping artifacts than linear
-    // probing and has good cache behavior in the common case.
+
+    // Skip over tombstones.  However, remember the first one we see.
+    if (FirstTombstone == -1)
+      if (unsigned M = MatchTags(Group, TombstoneTag))
+        FirstTombstone = GroupStart + CountTrailingZeros_32(M);
+
+    // If the group has an empty bucket, this key isn't in the table yet.  If we
+    // found a tombstone, we want to reuse the tombstone instead of an empty
+    // bucket.  This reduces probing.
+    if (unsigned M = MatchTags(Group, EmptyTag)) {
+      unsigned BucketNo = FirstTombstone != -1 ?
+          FirstTombstone : GroupStart + CountTrailingZeros_32(M);
+      TheTable[BucketNo].FullHashValue = FullHashValue;
+      Tags[BucketNo] = Tag;
+      return BucketNo;
+    }
+
+    // Okay, we didn't find the item.  Probe to the next group.  Use quadratic
+    // probing: the triangular steps visit every group.
+    GroupNo = (GroupNo+ProbeAmt) & GroupMask;
     ++ProbeAmt;
   }
 }
@@ -124,41 +144,39 @@ unsigned StringMapImpl::LookupBucketFor(const StringRef &Name) {
 /// in the map, return the bucket number of the key.  Otherwise return -1.
 /// This does not modify the map.
 int StringMapImpl::FindKey(const StringRef &Key) const {
-  unsigned HTSize = NumBuckets;
-  if (HTSize == 0) return -1;  // Really empty table?
+  if (NumBuckets == 0) return -1;  // Really empty table?
   unsigned FullHashValue = HashString(Key.begin(), Key.end());
-  unsigned BucketNo = FullHashValue & (HTSize-1);
-  
+  unsigned GroupMask = NumBuckets/GroupSize - 1;
+  unsigned GroupNo = (FullHashValue >> 7) & GroupMask;
+  unsigned char Tag = getTagFor(FullHashValue);
+
   unsigned ProbeAmt = 1;
   while (1) {
-    ItemBucket &Bucket = TheTable[BucketNo];
-    StringMapEntryBase *BucketItem = Bucket.Item;
-    // If we found an empty bucket, this key isn't in the table yet, return.
-    if (BucketItem == 0)
-      return -1;
-    
-    if (BucketItem == getTombstoneVal()) {
-      // Ignore tombstones.
-    } else if (Bucket.FullHashValue == FullHashValue) {
-      // If the full hash value matches, check deeply for a match.  The common
-      // case here is that we are only looking at the buckets (for item info
-      // being non-null and for the full hash value) not at the items.  This
-      // is important for cache locality.
-      
+    unsigned GroupStart = GroupNo*GroupSize;
+    const unsigned char *Group = Tags+GroupStart;
+
+    for (unsigned M = MatchTags(Group, Tag); M; M &= M-1) {
+      unsigned BucketNo = GroupStart + CountTrailingZeros_32(M);
+      ItemBucket &Bucket = TheTable[BucketNo];
+      if (Bucket.FullHashValue != FullHashValue)
+        continue;
+
       // Do the comparison like this because NameStart isn't necessarily
       // null-terminated!
+      StringMapEntryBase *BucketItem = Bucket.Item;
       char *ItemStr = (char*)BucketItem+ItemSize;
       if (Key == StringRef(ItemStr, BucketItem->getKeyLength())) {
         // We found a match!
         return BucketNo;
       }
     }
-    
-    // Okay, we didn't find the item.  Probe to the next bucket.
-    BucketNo = (BucketNo+ProbeAmt) & (HTSize-1);
-    
-    // Use quadratic probing, it has fewer clumping artifacts than linear
-    // probing and has good cache behavior in the common case.
+
+    // If the group has an empty bucket, this key isn't in the table.
+    if (MatchTags(Group, EmptyTag))
+      return -1;
+
+    // Okay, we didn't find the item.  Probe to the next group.
+    GroupNo = (GroupNo+ProbeAmt) & GroupMask;
     ++ProbeAmt;
   }
 }
@@ -180,6 +198,7 @@ StringMapEntryBase *StringMapImpl::RemoveKey(const StringRef &Key) {
   
   StringMapEntryBase *Result = TheTable[Bucket].Item;
   TheTable[Bucket].Item = getTombstoneVal();
+  Tags[Bucket] = TombstoneTag;
   --NumItems;
   ++NumTombstones;
   return Result;
@@ -191,38 +210,34 @@ StringMapEntryBase *StringMapImpl::RemoveKey(const StringRef &Key) {
 /// the appropriate mod-of-hashtable-size.
 void StringMapImpl::RehashTable() {
   unsigned NewSize = NumBuckets*2;
-  // Allocate one extra bucket which will always be non-empty.  This allows the
-  // iterators to stop at end.
-  ItemBucket *NewTableArray =(ItemBucket*)calloc(NewSize+1, sizeof(ItemBucket));
-  NewTableArray[NewSize].Item = (StringMapEntryBase*)2;
+  unsigned char *NewTags;
+  ItemBucket *NewTableArray = AllocateTable(NewSize, NewTags);
+  unsigned GroupMask = NewSize/GroupSize - 1;
   
   // Rehash all the items into their new buckets.  Luckily :) we already have
-  // the hash values available, so we don't have to rehash any strings.
+  // the hash values available, so we don't have to rehash any strings.  The
+  // new table has no tombstones, so each goes in the first empty bucket.
   for (ItemBucket *IB = TheTable, *E = TheTable+NumBuckets; IB != E; ++IB) {
     if (IB->Item && IB->Item != getTombstoneVal()) {
-      // Fast case, bucket available.
       unsigned FullHash = IB->FullHashValue;
-      unsigned NewBucket = FullHash & (NewSize-1);
-      if (NewTableArray[NewBucket].Item == 0) {
-        NewTableArray[FullHash & (NewSize-1)].Item = IB->Item;
-        NewTableArray[FullHash & (NewSize-1)].FullHashValue = FullHash;
-        continue;
-      }
-      
-      // Otherwise probe for a spot.
-      unsigned ProbeSize = 1;
-      do {
-        NewBucket = (NewBucket + ProbeSize++) & (NewSize-1);
-      } while (NewTableArray[NewBucket].Item);
-      
+      unsigned GroupNo = (FullHash >> 7) & GroupMask;
+      unsigned ProbeAmt = 1;
+      unsigned M;
+      while (!(M = MatchTags(NewTags+GroupNo*GroupSize, EmptyTag)))
+        GroupNo = (GroupNo+ProbeAmt++) & GroupMask;
+
       // Finally found a slot.  Fill it in.
+      unsigned NewBucket = GroupNo*GroupSize + CountTrailingZeros_32(M);
       NewTableArray[NewBucket].Item = IB->Item;
       NewTableArray[NewBucket].FullHashValue = FullHash;
+      NewTags[NewBucket] = getTagFor(FullHash);
     }
   }
   
   free(TheTable);
   
   TheTable = NewTableArray;
+  Tags = NewTags;
   NumBuckets = NewSize;
+  NumTombstones = 0;
 }
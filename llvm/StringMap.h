@@ -18,6 +18,7 @@
 #include "Allocator.h"
 #include <cstring>
 #include <string>
+#include <stdint.h>
 
 namespace llvm {
   template<typename ValueT>
@@ -40,6 +41,35 @@ public:
 };
 
 
+/// HashString - Compute a hash code for the specified string.  The string is
+/// read a word at a time; a tail shorter than a word is read with overlapping
+/// loads rather than byte by byte.
+inline unsigned HashString(const char *Start, const char *End) {
+  const uint64_t K = 0x9E3779B97F4A7C15ULL;
+  size_t Len = End - Start;
+  uint64_t H = Len * K;
+  uint64_t W;
+  uint32_t Lo, Hi;
+  if (Len >= 8) {
+    for (; Len > 8; Start += 8, Len -= 8) {
+      memcpy(&W, Start, 8);
+      H = (((H << 5) | (H >> 59)) ^ W) * K;
+    }
+    memcpy(&W, End-8, 8);
+    H = (((H << 5) | (H >> 59)) ^ W) * K;
+  } else if (Len >= 4) {
+    memcpy(&Lo, Start, 4);
+    memcpy(&Hi, End-4, 4);
+    H = (H ^ (Lo | (uint64_t)Hi << 32)) * K;
+  } else if (Len) {
+    H = (H ^ ((unsigned char)Start[0] | (unsigned char)Start[Len/2] << 8 |
+              (unsigned char)End[-1] << 16)) * K;
+  }
+  H ^= H >> 32;
+  H *= K;
+  return (unsigned)(H >> 32);
+}
+
 /// StringMapEntryBase - Shared base class of StringMapEntry instances.
 class StringMapEntryBase {
   unsigned StrLen;
@@ -64,8 +94,20 @@ public:
     StringMapEntryBase *Item;
   };
 
+  /// The buckets are probed a group at a time through a parallel array of tag
+  /// bytes, one per bucket: EmptyTag, TombstoneTag, or FullTag plus the low
+  /// bits of the full hash value of the key.  Only the buckets whose tag
+  /// matches are looked at.
+  static constexpr unsigned GroupSize = 16;
+  enum {
+    EmptyTag = 0,
+    TombstoneTag = 1,
+    FullTag = 0x80
+  };
+
 protected:
   ItemBucket *TheTable;
+  unsigned char *Tags;
   unsigned NumBuckets;
   unsigned NumItems;
   unsigned NumTombstones;
@@ -74,6 +116,7 @@ protected:
   explicit StringMapImpl(unsigned itemSize) : ItemSize(itemSize) {
     // Initialize the map with zero buckets to allocation.
     TheTable = 0;
+    Tags = 0;
     NumBuckets = 0;
     NumItems = 0;
     NumTombstones = 0;
@@ -95,8 +138,12 @@ protected:
   /// up in.  If it already exists as a key in the map, the Item pointer for the
   /// specified bucket will be non-null.  Otherwise, it will be null.  In either
   /// case, the FullHashValue field of the bucket will be set to the hash value
-  /// of the string.
-  unsigned LookupBucketFor(const StringRef &Key);
+  /// of the string.  The bucket is tagged as holding the key, which the
+  /// caller must then store in it.
+  unsigned LookupBucketFor(const StringRef &Key) {
+    return LookupBucketFor(Key, HashString(Key.begin(), Key.end()));
+  }
+  unsigned LookupBucketFor(const StringRef &Key, unsigned FullHashValue);
 
   /// FindKey - Look up the bucket that contains the specified key. If it exists
   /// in the map, return the bucket number of the key.  Otherwise return -1.
@@ -340,6 +387,7 @@ public:
       if (I->Item && I->Item != getTombstoneVal()) {
         static_cast<MapEntryTy*>(I->Item)->Destroy(Allocator);
         I->Item = 0;
+        Tags[I-TheTable] = EmptyTag;
       }
     }
 
@@ -352,7 +400,17 @@ public:
   template <typename InitTy>
   StringMapEntry<ValueTy> &GetOrCreateValue(const StringRef &Key,
                                             InitTy Val) {
-    unsigned BucketNo = LookupBucketFor(Key);
+    return GetOrCreateValueWithHash(Key, HashString(Key.begin(), Key.end()),
+                                    Val);
+  }
+
+  /// GetOrCreateValueWithHash - Like GetOrCreateValue, for a caller that has
+  /// already computed HashString of the key.
+  template <typename InitTy>
+  StringMapEntry<ValueTy> &GetOrCreateValueWithHash(const StringRef &Key,
+                                                    unsigned FullHashValue,
+                                                    InitTy Val) {
+    unsigned BucketNo = LookupBucketFor(Key, FullHashValue);
     ItemBucket &Bucket = TheTable[BucketNo];
     if (Bucket.Item && Bucket.Item != getTombstoneVal())
       return *static_cast<MapEntryTy*>(Bucket.Item);
@@ -377,6 +435,11 @@ public:
     return GetOrCreateValue(Key, ValueTy());
   }
 
+  StringMapEntry<ValueTy> &GetOrCreateValueWithHash(const StringRef &Key,
+                                                    unsigned FullHashValue) {
+    return GetOrCreateValueWithHash(Key, FullHashValue, ValueTy());
+  }
+
   template <typename InitTy>
   StringMapEntry<ValueTy> &GetOrCreateValue(const char *KeyStart,
                                             const char *KeyEnd,
@@ -1,18 +1,63 @@
 #include <iostream>
 #include <string>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "Lex/Preprocessor.h"
+#include "Lex/PTHManager.h"
 #include "Basic/FileManager.h"
 #include "Basic/SourceManager.h"
 #include "Basic/HeaderSearch.h"
+#include "Basic/HeaderGuardCache.h"
+#include "Basic/HeaderMap.h"
+#include "Basic/StatCache.h"
+#include "Basic/FileContentStore.h"
 #include "Frontend/TextDiagnosticBuffer.h"
 #include "Frontend/InitHeaderSearch.h"
 #include "Frontend/Utils.h"
+#include "llvm/MemoryBuffer.h"
 #include "llvm/raw_ostream.h"
 
 using namespace CPToyC::Compiler;
 
 bool VerifyDiagnostics = true;
 
+/// Stats - Print performance metrics and statistics (-print-stats).
+static bool Stats = false;
+
+/// OutputFile - Specify output file (-o).
+static std::string OutputFile;
+
+/// TokenCache - Use specified token cache file (-token-cache).
+static std::string TokenCache;
+
+/// IncludeDirs - Search these directories or header maps for #include <x>
+/// before the system directories (-I).
+static std::vector<std::string> IncludeDirs;
+
+/// IncludeGuardCache - Read and update the include guards recorded in the
+/// specified file (-include-guard-cache).
+static std::string IncludeGuardCache;
+
+/// CacheDirListings - Read each directory once and look files up in its listing
+/// before stat'ing them (-cache-dir-listings).
+static bool CacheDirListings = false;
+
+/// IncludeIndex - Resolve #includes through an index of the names in the search
+/// directories (-include-index).
+static bool IncludeIndex = false;
+
+/// StatCacheFile - Answer stat calls from the results saved by an earlier run
+/// in the specified file, and save the results of this one (-stat-cache).
+static std::string StatCacheFile;
+
 enum ProgActions {
     RewriteObjC,                  // ObjC->C Rewriter.
     RewriteBlocks,                // ObjC->C Rewriter for Blocks.
@@ -39,20 +84,33 @@ enum ProgActions {
     DumpRawTokens,                // Dump out raw tokens.
     RunAnalysis,                  // Run one or more source code analyses.
     GeneratePTH,                  // Generate pre-tokenized header.
+    GenerateHeaderMap,            // Generate a header map from include dirs.
+    BenchmarkIdentifiers,         // Time interning the identifiers of the input.
     GeneratePCH,                  // Generate pre-compiled header.
     InheritanceView               // View C++ inheritance for a specified class.
 };
 
+/// ProgAction - The action to perform on the input (-emit-pth,
+/// -emit-header-map, -bench-identifiers, default -E).
+static ProgActions ProgAction = PrintPreprocessedInput;
+
+/// NumThreads - Preprocess this many translation units at once (-j, 0 for one
+/// per core).
+static unsigned NumThreads = 1;
+
 class DriverPreprocessorFactory : public PreprocessorFactory {
     Diagnostic        &Diags;
     const LangOptions &LangInfo;
     SourceManager &SourceMgr;
     HeaderSearch &HeaderInfo;
+    const PTHFile *TokenCacheFile;
 
 public:
     DriverPreprocessorFactory(Diagnostic &diags, const LangOptions &opts,
-                              SourceManager &SM, HeaderSearch &Headers)
-        : Diags(diags), LangInfo(opts), SourceMgr(SM), HeaderInfo(Headers) {
+                              SourceManager &SM, HeaderSearch &Headers,
+                              const PTHFile *PTH)
+        : Diags(diags), LangInfo(opts), SourceMgr(SM), HeaderInfo(Headers),
+          TokenCacheFile(PTH) {
     }
 
     virtual ~DriverPreprocessorFactory() {}
@@ -61,6 +119,11 @@ public:
         // Create the Preprocessor.
         llvm::OwningPtr<Preprocessor> PP(new Preprocessor(Diags, LangInfo,
                                                           SourceMgr, HeaderInfo));
+
+        // The token cache was loaded once by main; each preprocessor resolves
+        // its identifiers in a PTHManager of its own.
+        if (TokenCacheFile)
+            PP->setPTHManager(new PTHManager(*TokenCacheFile));
         return PP.take();
     }
 };
@@ -70,6 +133,10 @@ public:
 void InitializeIncludePaths(const char *Argv0, HeaderSearch &Headers,
                             FileManager &FM, const LangOptions &Lang) {
     InitHeaderSearch Init(Headers, false);
+
+    // Handle -I... options.
+    for (unsigned i = 0, e = IncludeDirs.size(); i != e; ++i)
+        Init.AddPath(IncludeDirs[i], InitHeaderSearch::Angled, false, true, false);
 #if 0
     // Handle -I... and -F... options, walking the lists in parallel.
     unsigned Iidx = 0, Fidx = 0;
@@ -213,8 +280,11 @@ static llvm::raw_ostream* ComputeOutFile(const std::string& InFile,
     return Ret;
 }
 
+/// ProcessInputFile - Perform the action on the specified translation unit.
+/// Preprocessed output goes to Out if set, otherwise to stdout.
 static void ProcessInputFile(Preprocessor &PP, PreprocessorFactory &PPF,
-                             const std::string &InFile, ProgActions PA) {
+                             const std::string &InFile, ProgActions PA,
+                             llvm::raw_ostream *Out = nullptr) {
     llvm::OwningPtr<llvm::raw_ostream> OS;
     bool ClearSourceMgr = false;
     bool CompleteTranslationUnit = true;
@@ -248,13 +318,81 @@ static void ProcessInputFile(Preprocessor &PP, PreprocessorFactory &PPF,
             ClearSourceMgr = true;
             break;
         }
+        case GeneratePTH: {
+            if (OutputFile.empty() || OutputFile == "-") {
+                std::cout << "ERROR: PTH requires an output file (-o)!" << std::endl;
+                ::exit(1);
+            }
+            std::string Error;
+            llvm::raw_fd_ostream PTHOut(OutputFile.c_str(), true, true, Error);
+            if (!Error.empty()) {
+                std::cout << "ERROR: " << Error << std::endl;
+                ::exit(1);
+            }
+            CacheTokens(PP, &PTHOut);
+            ClearSourceMgr = true;
+            break;
+        }
+        case BenchmarkIdentifiers: {
+            // Collect the identifiers of the main file in the order the lexer
+            // meets them, then intern the stream into fresh identifier tables,
+            // hashing each name as the lexer does, for about a second.
+            SourceManager &SM = PP.getSourceManager();
+            Lexer RawLex(SM.getMainFileID(), SM, PP.getLangOptions());
+            std::string Spellings;
+            std::vector<std::pair<unsigned, unsigned> > Stream;
+
+            Token RawTok;
+            RawLex.LexFromRawLexer(RawTok);
+            while (RawTok.isNot(tok::eof)) {
+                if (RawTok.is(tok::identifier)) {
+                    std::string Name = PP.getSpelling(RawTok);
+                    Stream.push_back(std::make_pair(Spellings.size(), Name.size()));
+                    Spellings += Name;
+                }
+                RawLex.LexFromRawLexer(RawTok);
+            }
+
+            typedef std::chrono::steady_clock Clock;
+            Clock::duration Elapsed = Clock::duration::zero();
+            unsigned Rounds = 0, NumDistinct = 0;
+            while (!Stream.empty() && Elapsed < std::chrono::seconds(1)) {
+                IdentifierTable Table(PP.getLangOptions());
+                const char *Base = Spellings.data();
+                Clock::time_point Start = Clock::now();
+                for (unsigned i = 0, e = Stream.size(); i != e; ++i) {
+                    const char *Name = Base + Stream[i].first;
+                    const char *NameEnd = Name + Stream[i].second;
+                    Table.get(Name, NameEnd, llvm::HashString(Name, NameEnd));
+                }
+                Elapsed += Clock::now() - Start;
+                NumDistinct = Table.size();
+                ++Rounds;
+            }
+
+            double Seconds = std::chrono::duration<double>(Elapsed).count();
+            fprintf(stderr, "%s: %u identifiers, %u entries in the table, "
+                    "%u rounds: %.0f lookups/s\n", InFile.c_str(),
+                    (unsigned)Stream.size(), NumDistinct, Rounds,
+                    Seconds > 0 ? (double)Stream.size()*Rounds/Seconds : 0.0);
+            ClearSourceMgr = true;
+            break;
+        }
         case PrintPreprocessedInput:
-            OS.reset(ComputeOutFile(InFile, nullptr, true));
+            if (!Out) {
+                OS.reset(ComputeOutFile(InFile, nullptr, true));
+                Out = OS.get();
+            }
             break;
         case ParseNoop:
             break;
         case RunPreprocessorOnly:
             break;
+        case GenerateHeaderMap:
+            // The inputs are include directories; main handles this action
+            // before any translation unit is set up.
+            assert(0 && "Header maps are not generated per translation unit!");
+            break;
     }
 
     if (PA == RunPreprocessorOnly) {    // Just lex as fast as we can, no output.
@@ -272,76 +410,329 @@ static void ProcessInputFile(Preprocessor &PP, PreprocessorFactory &PPF,
 #endif
     } else if (PA == PrintPreprocessedInput){  // -E mode.
         if (false)
-            DoPrintMacros(PP, OS.get());
+            DoPrintMacros(PP, Out);
         else
-            DoPrintPreprocessedInput(PP, OS.get(), false,
+            DoPrintPreprocessedInput(PP, Out, false,
                                      false,
                                      true, false);
         ClearSourceMgr = true;
     }
 }
 
-int main(int argc, char *argv[])
-{
-	if (argc != 2) {
-		std::cout << "./cptoyc filename" << std::endl;
-		return 0;
-	}
+/// StatsLock - Keeps the statistics of translation units preprocessed on
+/// different threads from interleaving.
+static std::mutex StatsLock;
+
+/// TUWorker - The state for preprocessing translation units one after the
+/// other on one thread.  The FileManager, the file contents, the include guard
+/// cache and the token cache may be shared with other workers; the rest belongs
+/// to this one and stays warm across the translation units it is given.
+class TUWorker {
+    FileManager &FileMgr;
+    llvm::OwningPtr<DiagnosticClient> DiagClient;
+    Diagnostic Diags;
+    LangOptions LangInfo;
+    SourceManager SourceMgr;
+    HeaderSearch HeaderInfo;
+    HeaderGuardCache *GuardCache;
+    const PTHFile *TokenCacheFile;
 
+public:
+    TUWorker(const char *Argv0, FileManager &FM, FileContentStore *Contents,
+             HeaderGuardCache *GC, const PTHFile *PTH)
+        : FileMgr(FM),
+          DiagClient(VerifyDiagnostics ? new TextDiagnosticBuffer() : nullptr),
+          Diags(DiagClient.get()), HeaderInfo(FM), GuardCache(GC),
+          TokenCacheFile(PTH) {
+        // Initialize language options, inferring file types from input filenames.
+        if (DiagClient)
+            DiagClient->setLangOptions(&LangInfo);
+        LangInfo.Bool = 1;
+        LangInfo.BCPLComment = 1;
+        LangInfo.C99 = 1;
+        LangInfo.HexFloats = 1;
+        LangInfo.CharIsSigned = 1;
+        LangInfo.ImplicitInt = 1;
 
+        if (Contents)
+            SourceMgr.setFileContentStore(Contents);
 
-	llvm::OwningPtr<DiagnosticClient> DiagClient;
-	if (VerifyDiagnostics) {
-	    DiagClient.reset(new TextDiagnosticBuffer());
-	}
+        // Process the -I options and set them in the HeaderInfo.  The search
+        // paths and the results of earlier lookups are shared by all translation
+        // units of this worker.
+        InitializeIncludePaths(Argv0, HeaderInfo, FileMgr, LangInfo);
+        HeaderInfo.SetUseIncludeIndex(IncludeIndex);
 
-    // Configure our handling of diagnostics.
-    Diagnostic Diags(DiagClient.get());
+        // Headers whose guard macro is already defined are skipped without being
+        // opened when an earlier run recorded the guard.
+        if (GuardCache)
+            HeaderInfo.SetGuardCache(GuardCache);
+    }
 
-    llvm::OwningPtr<SourceManager> SourceMgr;
+    /// Process - Preprocess the specified translation unit.  Output and errors
+    /// go to OS if set, otherwise to stdout.
+    void Process(const std::string &InFile, llvm::raw_ostream *OS);
+};
 
-    // Create a file manager object to provide access to and cache the filesystem.
-	FileManager FileMgr;
+void TUWorker::Process(const std::string &InFile, llvm::raw_ostream *OS) {
+    SourceMgr.clearIDTables();
+    HeaderInfo.RevalidateIncludeIndex();
+
+    // Set up the preprocessor with these options.
+    DriverPreprocessorFactory PPFactory(Diags, LangInfo, SourceMgr, HeaderInfo,
+                                        TokenCacheFile);
+
+    llvm::OwningPtr<Preprocessor> PP(PPFactory.CreatePreprocessor());
+    if (!PP)
+        return;
+
+    const FileEntry *File = FileMgr.getFile(InFile);
+    if (File) SourceMgr.createMainFileID(File, SourceLocation());
+    if (SourceMgr.getMainFileID().isInvalid()) {
+//        PP->getDiagnostics().Report(FullSourceLoc(), diag::err_fe_error_reading)
+//                << InFile.c_str();
+        if (OS)
+            *OS << "err_fe_error_reading: " << InFile << "\n";
+        else
+            std::cout << "err_fe_error_reading: " << InFile << std::endl;
+        return;
+    }
 
-    for (int i = 0; i < 1; ++i) {
-        std::string InFile = argv[1];
+    if (GuardCache)
+        GuardCache->setIdentifierTable(PP->getIdentifierTable());
 
-        if (!SourceMgr) {
-            SourceMgr.reset(new SourceManager());
-        } else {
-            SourceMgr->clearIDTables();
+    ProcessInputFile(*PP, PPFactory, InFile, ProgAction, OS);
+
+    if (Stats) {
+        std::lock_guard<std::mutex> Guard(StatsLock);
+        fprintf(stderr, "\nSTATISTICS FOR '%s':\n", InFile.c_str());
+        PP->PrintStats();
+        PP->getIdentifierTable().PrintStats();
+        PP->getHeaderSearchInfo().PrintStats();
+        PP->getSourceManager().PrintStats();
+        fprintf(stderr, "\n");
+    }
+
+    // What we learnt about headers refers to this Preprocessor's identifiers.
+    HeaderInfo.ClearFileInfo();
+}
+
+/// ProcessInParallel - Preprocess the inputs on NumThreads threads, which take
+/// the next unclaimed translation unit whenever they finish one.  The output of
+/// each is collected and written to stdout in the order of the inputs.
+static void ProcessInParallel(const char *Argv0,
+                              const std::vector<std::string> &Inputs,
+                              FileManager &FileMgr, HeaderGuardCache *GC,
+                              const PTHFile *PTH) {
+    FileContentStore Contents;
+    unsigned NumInputs = Inputs.size();
+
+    std::vector<std::string> Outputs(NumInputs);
+    std::vector<bool> Done(NumInputs, false);
+    std::mutex Lock;
+    std::condition_variable Ready;
+    std::atomic<unsigned> NextInput(0);
+
+    std::vector<std::thread> Threads;
+    for (unsigned t = 0, e = std::min(NumThreads, NumInputs); t != e; ++t) {
+        Threads.push_back(std::thread([&] {
+            TUWorker Worker(Argv0, FileMgr, &Contents, GC, PTH);
+            for (unsigned i; (i = NextInput++) < NumInputs; ) {
+                std::string Out;
+                {
+                    llvm::raw_string_ostream OS(Out);
+                    Worker.Process(Inputs[i], &OS);
+                }
+                std::lock_guard<std::mutex> Guard(Lock);
+                Outputs[i].swap(Out);
+                Done[i] = true;
+                Ready.notify_all();
+            }
+        }));
+    }
+
+    for (unsigned i = 0; i != NumInputs; ++i) {
+        std::string Out;
+        {
+            std::unique_lock<std::mutex> Guard(Lock);
+            Ready.wait(Guard, [&] { return Done[i]; });
+            Outputs[i].swap(Out);
         }
+        fwrite(Out.data(), 1, Out.size(), stdout);
+    }
+    fflush(stdout);
 
-        // Initialize language options, inferring file types from input filenames.
-        LangOptions LangInfo;
-        DiagClient->setLangOptions(&LangInfo);
-        LangInfo.Bool = 1;
-        LangInfo.BCPLComment = 1;
-        LangInfo.C99 = 1;
-        LangInfo.HexFloats = 1;
-        LangInfo.CharIsSigned = 1;
-        LangInfo.ImplicitInt = 1;
+    for (unsigned t = 0, e = Threads.size(); t != e; ++t)
+        Threads[t].join();
+}
+
+/// ReadResponseFile - Append the input files listed in the specified response
+/// file (@file) to Inputs.  Names are separated by whitespace.
+static bool ReadResponseFile(const char *Path, std::vector<std::string> &Inputs) {
+    llvm::OwningPtr<MemoryBuffer> Buf(MemoryBuffer::getFile(Path));
+    if (!Buf)
+        return false;
+
+    const char *Ptr = Buf->getBufferStart(), *End = Buf->getBufferEnd();
+    while (Ptr != End) {
+        if (isspace((unsigned char) *Ptr)) {
+            ++Ptr;
+            continue;
+        }
+        const char *NameStart = Ptr;
+        while (Ptr != End && !isspace((unsigned char) *Ptr))
+            ++Ptr;
+        Inputs.push_back(std::string(NameStart, Ptr));
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<std::string> InputFilenames;
+	for (int i = 1; i < argc; ++i) {
+	    if (strcmp(argv[i], "-print-stats") == 0)
+	        Stats = true;
+	    else if (strcmp(argv[i], "-emit-pth") == 0)
+	        ProgAction = GeneratePTH;
+	    else if (strcmp(argv[i], "-emit-header-map") == 0)
+	        ProgAction = GenerateHeaderMap;
+	    else if (strcmp(argv[i], "-bench-identifiers") == 0)
+	        ProgAction = BenchmarkIdentifiers;
+	    else if (strncmp(argv[i], "-I", 2) == 0 && (argv[i][2] || i+1 < argc))
+	        IncludeDirs.push_back(argv[i][2] ? argv[i]+2 : argv[++i]);
+	    else if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+	        OutputFile = argv[++i];
+	    else if (strcmp(argv[i], "-token-cache") == 0 && i+1 < argc)
+	        TokenCache = argv[++i];
+	    else if (strcmp(argv[i], "-include-guard-cache") == 0 && i+1 < argc)
+	        IncludeGuardCache = argv[++i];
+	    else if (strcmp(argv[i], "-cache-dir-listings") == 0)
+	        CacheDirListings = true;
+	    else if (strcmp(argv[i], "-include-index") == 0)
+	        IncludeIndex = true;
+	    else if (strcmp(argv[i], "-stat-cache") == 0 && i+1 < argc)
+	        StatCacheFile = argv[++i];
+	    else if (strncmp(argv[i], "-j", 2) == 0 && (argv[i][2] || i+1 < argc)) {
+	        NumThreads = atoi(argv[i][2] ? argv[i]+2 : argv[++i]);
+	        if (NumThreads == 0)
+	            NumThreads = std::max(1U, std::thread::hardware_concurrency());
+	    } else if (argv[i][0] == '@') {
+	        if (!ReadResponseFile(argv[i]+1, InputFilenames)) {
+	            std::cout << "err_fe_error_reading: " << argv[i]+1 << std::endl;
+	            return 0;
+	        }
+	    } else
+	        InputFilenames.push_back(argv[i]);
+	}
+	// A pre-tokenized header is written to a single -o file.
+	if (InputFilenames.empty() ||
+	    (ProgAction == GeneratePTH && InputFilenames.size() != 1)) {
+		std::cout << "./cptoyc [-print-stats] [-emit-pth -o file] [-I dir] "
+		             "[-token-cache file] [-include-guard-cache file] "
+		             "[-cache-dir-listings] [-include-index] [-stat-cache file] "
+		             "[-j N] "
+		             "filename... [@responsefile]\n"
+		             "./cptoyc -bench-identifiers filename... [@responsefile]\n"
+		             "./cptoyc -emit-header-map -o file dir... [@responsefile]"
+		          << std::endl;
+		return 0;
+	}
+
+    // The inputs are include directories, in search order.  The header map
+    // written can then be passed with -I in their place.
+    if (ProgAction == GenerateHeaderMap) {
+        if (OutputFile.empty() || OutputFile == "-") {
+            std::cout << "ERROR: a header map requires an output file (-o)!"
+                      << std::endl;
+            return 1;
+        }
+        HeaderMapBuilder Builder;
+        for (unsigned i = 0, e = InputFilenames.size(); i != e; ++i)
+            if (!Builder.AddDirectory(InputFilenames[i]))
+                std::cout << "warning: ignoring nonexistent directory '"
+                          << InputFilenames[i] << "'" << std::endl;
+        std::string ErrStr;
+        if (!Builder.WriteToFile(OutputFile, &ErrStr)) {
+            std::cout << "ERROR: " << ErrStr << std::endl;
+            return 1;
+        }
+        if (Stats)
+            fprintf(stderr, "%d headers mapped from %d directories.\n",
+                    Builder.size(), (int)InputFilenames.size());
+        return 0;
+    }
 
-        // Process the -I options and set them in the HeaderInfo.
-        HeaderSearch HeaderInfo(FileMgr);
 
-        InitializeIncludePaths(argv[0], HeaderInfo, FileMgr, LangInfo);
 
-        // Set up the preprocessor with these options.
-        DriverPreprocessorFactory PPFactory(Diags, LangInfo, *SourceMgr.get(), HeaderInfo);
+    // Load and check the token cache once; every translation unit shares it.
+    // A bad cache fails the whole run.
+    llvm::OwningPtr<PTHFile> TokenCacheFile;
+    if (!TokenCache.empty()) {
+        std::string ErrStr;
+        TokenCacheFile.reset(PTHFile::Create(TokenCache, &ErrStr));
+        if (!TokenCacheFile) {
+            std::cout << "err_invalid_pth_file: " << ErrStr << std::endl;
+            return 1;
+        }
+    }
 
-        llvm::OwningPtr<Preprocessor> PP(PPFactory.CreatePreprocessor());
+    // Create a file manager object to provide access to and cache the filesystem.
+	FileManager FileMgr;
+	FileMgr.setCacheDirectoryListings(CacheDirListings);
+
+    // The FileManager owns the stat cache; a bad cache file is replaced.
+    PersistentStatCache *StatCache = nullptr;
+    if (!StatCacheFile.empty()) {
+        StatCache = new PersistentStatCache();
+        std::string ErrStr;
+        if (!StatCache->ReadFromFile(StatCacheFile, &ErrStr))
+            std::cout << "warning: ignoring stat cache: " << ErrStr << std::endl;
+        FileMgr.setStatCache(StatCache);
+    }
 
-        const FileEntry *File = FileMgr.getFile(InFile);
-        if (File) SourceMgr->createMainFileID(File, SourceLocation());
-        if (SourceMgr->getMainFileID().isInvalid()) {
-//            PP->getDiagnostics().Report(FullSourceLoc(), diag::err_fe_error_reading)
-//                    << InFile.c_str();
-            std::cout << "err_fe_error_reading" << std::endl;
-            return 0;
+    // A file that is not a guard cache is left alone rather than overwritten.
+    HeaderGuardCache GuardCache;
+    bool UseGuardCache = !IncludeGuardCache.empty();
+    if (UseGuardCache) {
+        std::string ErrStr;
+        if (!GuardCache.ReadFromFile(IncludeGuardCache, &ErrStr)) {
+            std::cout << "warning: ignoring include guard cache: " << ErrStr
+                      << std::endl;
+            UseGuardCache = false;
         }
-        ProcessInputFile(*PP, PPFactory, InFile, PrintPreprocessedInput);
-        HeaderInfo.ClearFileInfo();
+    }
+    HeaderGuardCache *GC = UseGuardCache ? &GuardCache : nullptr;
+
+    if (NumThreads > 1 && InputFilenames.size() > 1) {
+        ProcessInParallel(argv[0], InputFilenames, FileMgr, GC,
+                          TokenCacheFile.get());
+    } else {
+        TUWorker Worker(argv[0], FileMgr, nullptr, GC, TokenCacheFile.get());
+        for (unsigned i = 0, e = InputFilenames.size(); i != e; ++i)
+            Worker.Process(InputFilenames[i], nullptr);
+    }
+
+    if (UseGuardCache) {
+        std::string ErrStr;
+        if (!GuardCache.WriteToFile(IncludeGuardCache, &ErrStr))
+            std::cout << "warning: could not save include guard cache: "
+                      << ErrStr << std::endl;
+    }
+
+    if (StatCache) {
+        std::string ErrStr;
+        if (!StatCache->WriteToFile(StatCacheFile, &ErrStr))
+            std::cout << "warning: could not save stat cache: " << ErrStr
+                      << std::endl;
+    }
+
+    if (Stats) {
+        if (StatCache)
+            StatCache->PrintStats();
+        if (UseGuardCache)
+            GuardCache.PrintStats();
+        FileMgr.PrintStats();
     }
 	return 0;
-}
\ No newline at end of file
+}